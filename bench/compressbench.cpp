@@ -0,0 +1,101 @@
+// Space and throughput with and without per-file compression.
+//
+// Usage: compressbench [files] [bytesPerFile]
+// Formats a scratch image twice, once storing files raw and once with
+// compression on, writes the same log-like text to each file and reads it
+// back. Reports MB/s for both passes and the data blocks each layout used.
+#include "../filesystem/blockmanager.hpp"
+#include "../filesystem/FileSystem.hpp"
+#include "../filesystem/log.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+using namespace std;
+
+// Log lines: a few fixed shapes with varying numbers, like real text data
+static string makeText(int bytes, int seed) {
+    static const char* levels[] = { "INFO", "WARN", "DEBUG", "ERROR" };
+    static const char* events[] = { "request served", "cache miss", "block flushed", "retrying write", "session closed" };
+    mt19937 rng(seed);
+    string out;
+    while ((int)out.size() < bytes) {
+        ostringstream line;
+        line << "2026-01-" << 10 + rng() % 20 << " " << rng() % 24 << ":" << rng() % 60 << " ["
+             << levels[rng() % 4] << "] worker-" << rng() % 16 << " " << events[rng() % 5]
+             << " id=" << rng() % 100000 << " latency_us=" << rng() % 5000 << "\n";
+        out += line.str();
+    }
+    out.resize(bytes);
+    return out;
+}
+
+struct Result {
+    double writeMBps;
+    double readMBps;
+    long long usedBlocks;
+    int failures;
+};
+
+static Result run(bool compress, int files, int bytes, int blockSize, long long blocks) {
+    string disk = "bench/compressbench_disk.bin";
+    string meta = "bench/compressbench_meta.bin";
+    remove(disk.c_str());
+    remove(meta.c_str());
+    Result r = { 0, 0, 0, 0 };
+    {
+        BlockManager bm(disk, meta, blockSize, (int)blocks);
+        bm.setCompressNewFiles(compress);
+        bm.init();
+        FileSystem fs(&bm);
+        long long baseline = bm.statfs().freeBlocks;
+
+        vector<string> texts;
+        for (int i = 0; i < files; i++) texts.push_back(makeText(bytes, i));
+
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < files; i++) {
+            string name = "f" + to_string(i);
+            if (!fs.createFile(name, bytes) || !fs.writeFile(name, texts[i])) r.failures++;
+        }
+        double writeSecs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < files; i++) {
+            if (fs.readFile("f" + to_string(i)) != texts[i]) r.failures++;
+        }
+        double readSecs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        double mb = (double)files * bytes / (1024.0 * 1024.0);
+        r.writeMBps = mb / writeSecs;
+        r.readMBps = mb / readSecs;
+        // Data blocks only: each file also has one index block
+        r.usedBlocks = baseline - bm.statfs().freeBlocks - files;
+    }
+    remove(disk.c_str());
+    remove(meta.c_str());
+    return r;
+}
+
+int main(int argc, char** argv) {
+    int files = argc > 1 ? atoi(argv[1]) : 200;
+    int bytes = argc > 2 ? atoi(argv[2]) : 256 * 1024;
+    Log::setLevel(LOG_OFF);  // Keep per-call library messages out of the timing
+
+    int blockSize = 4096;
+    int blocksPerFile = 1 + (bytes + blockSize - 1) / blockSize;
+    long long blocks = 64 + (long long)files * blocksPerFile;
+
+    printf("files=%d bytes_per_file=%d block_size=%d\n", files, bytes, blockSize);
+    printf("%-10s %10s %10s %12s %8s %9s\n", "mode", "write MB/s", "read MB/s", "data blocks", "ratio", "failures");
+    long long rawBlocks = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        Result r = run(pass == 1, files, bytes, blockSize, blocks);
+        if (pass == 0) rawBlocks = r.usedBlocks;
+        printf("%-10s %10.1f %10.1f %12lld %8.2f %9d\n", pass ? "compressed" : "raw",
+               r.writeMBps, r.readMBps, r.usedBlocks,
+               r.usedBlocks ? (double)rawBlocks / r.usedBlocks : 0.0, r.failures);
+    }
+    return 0;
+}
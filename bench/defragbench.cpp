@@ -0,0 +1,94 @@
+// Sequential read throughput of fragmented files before and after defrag.
+//
+// Usage: defragbench [files] [blocksPerFile]
+// Builds files by appending one block to each in turn, so their blocks end
+// up interleaved on disk, then reads every file back with the page cache
+// dropped, runs the defragmenter and reads them again.
+#include "../filesystem/blockmanager.hpp"
+#include "../filesystem/FileSystem.hpp"
+#include "../filesystem/log.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+static void dropCache(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    close(fd);
+}
+
+// Mean extents per file, counted the same way as `frag`
+static double meanExtents(FileSystem& fs, int files) {
+    long long extents = 0;
+    for (int i = 0; i < files; i++) {
+        int prev = -2;
+        for (int b : fs.root->files["f" + to_string(i)].blocks) {
+            if (b < 0) continue;
+            if (b != prev + 1) extents++;
+            prev = b;
+        }
+    }
+    return (double)extents / files;
+}
+
+// Returns MB/s for reading every file once from a cold cache
+static double readAll(FileSystem& fs, const string& disk, int files, long long bytes, int& failures) {
+    dropCache(disk);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < files; i++) {
+        if ((long long)fs.readFile("f" + to_string(i)).size() != bytes) failures++;
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return (double)files * bytes / (1024.0 * 1024.0) / secs;
+}
+
+int main(int argc, char** argv) {
+    int files = argc > 1 ? atoi(argv[1]) : 32;
+    int blocksPerFile = argc > 2 ? atoi(argv[2]) : 128;
+    Log::setLevel(LOG_OFF);
+
+    int blockSize = 4096;
+    string disk = "bench/defragbench_disk.bin";
+    string meta = "bench/defragbench_meta.bin";
+    remove(disk.c_str());
+    remove(meta.c_str());
+    // Room for a second copy of everything, so defrag finds contiguous runs
+    BlockManager bm(disk, meta, blockSize, 64 + 2 * files * (blocksPerFile + 1));
+    bm.init();
+    FileSystem fs(&bm);
+
+    string block(blockSize, 'd');
+    for (int i = 0; i < files; i++) fs.createFile("f" + to_string(i), 0);
+    for (int r = 0; r < blocksPerFile; r++) {
+        for (int i = 0; i < files; i++) {
+            string name = "f" + to_string(i);
+            fs.appendFile(name, block);
+            fs.fsync(name);
+        }
+    }
+
+    long long bytes = (long long)blocksPerFile * blockSize;
+    int failures = 0;
+    printf("files=%d blocks_per_file=%d block_size=%d backend=%s\n", files, blocksPerFile, blockSize, bm.ioBackend());
+    printf("%-8s %14s %10s\n", "layout", "extents/file", "read MB/s");
+    double before = readAll(fs, disk, files, bytes, failures);
+    printf("%-8s %14.1f %10.1f\n", "before", meanExtents(fs, files), before);
+
+    auto start = chrono::steady_clock::now();
+    fs.defrag(0);
+    double defragSecs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    double after = readAll(fs, disk, files, bytes, failures);
+    printf("%-8s %14.1f %10.1f\n", "after", meanExtents(fs, files), after);
+    printf("defrag=%.3fs failures=%d\n", defragSecs, failures);
+
+    remove(disk.c_str());
+    remove(meta.c_str());
+    return failures == 0 ? 0 : 1;
+}
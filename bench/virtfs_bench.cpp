@@ -0,0 +1,332 @@
+// Standard filesystem workloads against FileSystem/BlockManager.
+//
+// Usage: virtfs_bench [--dir DIR] [--scale N] [--seed N] [--only NAME]
+// Every workload runs on a freshly formatted image in DIR (created if
+// missing) with a fixed random seed, so runs are comparable. One JSON
+// object per workload is printed to stdout:
+//   ops, seconds, ops_per_s, p50_us / p99_us (per-operation latency),
+//   logical_bytes (file data the workload asked to write),
+//   device_bytes (image blocks actually written, metadata included),
+//   write_amp (device_bytes per logical byte; 0 when nothing was written)
+#include "../filesystem/blockmanager.hpp"
+#include "../filesystem/FileSystem.hpp"
+#include "../filesystem/log.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+static const int BLOCK_SIZE = 4096;
+static const int IMAGE_BLOCKS = 65536;  // 256 MiB image, sparse on the host
+
+struct Options {
+    string dir;
+    int scale;
+    unsigned seed;
+    string only;
+};
+
+// Per-workload measurements; latencies in microseconds
+struct Sample {
+    vector<double> latencies;
+    double seconds;
+    long long logicalBytes;
+    long long deviceBytes;
+};
+
+// A mounted image; fsck's report is kept off stdout
+class Mount {
+public:
+    unique_ptr<BlockManager> bm;
+    unique_ptr<FileSystem> fs;
+
+    Mount(const string& dir, bool format) : disk(dir + "/virtualdisc.bin"), meta(dir + "/meta.bin") {
+        if (format) {
+            remove(disk.c_str());
+            remove(meta.c_str());
+            remove((meta + ".ddt").c_str());
+        }
+        saved = cout.rdbuf(nullptr);
+        bm.reset(new BlockManager(disk, meta, BLOCK_SIZE, IMAGE_BLOCKS));
+        bm->init();
+        fs.reset(new FileSystem(bm.get()));
+        fs->load();
+    }
+    ~Mount() {
+        fs->save();
+        fs.reset();
+        bm.reset();
+        cout.rdbuf(saved);
+    }
+
+private:
+    string disk, meta;
+    streambuf* saved;
+};
+
+static double percentile(vector<double> v, double p) {
+    if (v.empty()) return 0;
+    sort(v.begin(), v.end());
+    size_t i = (size_t)(p * (v.size() - 1) + 0.5);
+    return v[min(i, v.size() - 1)];
+}
+
+// Time one operation and record its latency
+template <typename F>
+static void timed(Sample& s, F op) {
+    auto t0 = chrono::steady_clock::now();
+    op();
+    s.latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+}
+
+static void report(const string& name, const Sample& s) {
+    double ops = (double)s.latencies.size();
+    double amp = s.logicalBytes > 0 ? (double)s.deviceBytes / s.logicalBytes : 0.0;
+    printf("{\"workload\":\"%s\",\"ops\":%.0f,\"seconds\":%.6f,\"ops_per_s\":%.1f,"
+           "\"p50_us\":%.1f,\"p99_us\":%.1f,\"logical_bytes\":%lld,\"device_bytes\":%lld,\"write_amp\":%.3f}\n",
+           name.c_str(), ops, s.seconds, s.seconds > 0 ? ops / s.seconds : 0.0,
+           percentile(s.latencies, 0.50), percentile(s.latencies, 0.99),
+           s.logicalBytes, s.deviceBytes, amp);
+    fflush(stdout);
+}
+
+// Runs body on a fresh image and fills in the totals around it; setup is
+// neither timed nor counted as written
+static Sample run(const Options& opt, function<void(Mount&, Sample&)> body,
+                  function<void(Mount&)> setup = nullptr) {
+    Sample s;
+    s.logicalBytes = 0;
+    Mount m(opt.dir, true);
+    if (setup) {
+        setup(m);
+        m.fs->save();
+    }
+    long long before = m.bm->getBlocksWritten();
+    auto t0 = chrono::steady_clock::now();
+    body(m, s);
+    m.fs->save();  // buffered data and the final tree count as written
+    s.seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    s.deviceBytes = (m.bm->getBlocksWritten() - before) * BLOCK_SIZE;
+    return s;
+}
+
+// Many small files: create, write and delete, each one an operation
+static Sample smallFiles(const Options& opt) {
+    mt19937 rng(opt.seed);
+    int n = 500 * opt.scale;
+    return run(opt, [&](Mount& m, Sample& s) {
+        for (int i = 0; i < n; i++) {
+            string name = "s" + to_string(i);
+            string body(100 + rng() % 3000, (char)('a' + i % 26));
+            s.logicalBytes += body.size();
+            timed(s, [&] { m.fs->createFile(name, body.size()); });
+            timed(s, [&] { m.fs->writeFile(name, body); });
+        }
+        for (int i = 0; i < n; i++) {
+            timed(s, [&] { m.fs->deleteFile("s" + to_string(i)); });
+        }
+    });
+}
+
+// Large files written whole, then read back; one operation per file
+static Sample sequential(const Options& opt, bool read) {
+    int files = 8 * opt.scale;
+    // The largest file a single index block can describe
+    long long bytes = (long long)(BLOCK_SIZE / 4 - 1) * BLOCK_SIZE;
+    string body((size_t)bytes, 's');
+    auto create = [&](Mount& m) {
+        for (int i = 0; i < files; i++) m.fs->createFile("big" + to_string(i), bytes);
+    };
+    auto write = [&](Mount& m, Sample* s) {
+        for (int i = 0; i < files; i++) {
+            string name = "big" + to_string(i);
+            if (!s) {
+                m.fs->writeFile(name, body);
+                continue;
+            }
+            timed(*s, [&] { m.fs->writeFile(name, body); });
+            s->logicalBytes += bytes;
+        }
+    };
+    if (!read) {
+        return run(opt, [&](Mount& m, Sample& s) { write(m, &s); }, create);
+    }
+    return run(opt, [&](Mount& m, Sample& s) {
+        for (int i = 0; i < files; i++) {
+            timed(s, [&] {
+                if ((long long)m.fs->readFile("big" + to_string(i)).size() != bytes) fprintf(stderr, "short read\n");
+            });
+        }
+    }, [&](Mount& m) {
+        create(m);
+        write(m, nullptr);
+    });
+}
+
+// Small appends to randomly chosen files
+static Sample randomAppend(const Options& opt) {
+    mt19937 rng(opt.seed);
+    int files = 32;
+    int appends = 4000 * opt.scale;
+    return run(opt, [&](Mount& m, Sample& s) {
+        for (int i = 0; i < appends; i++) {
+            string name = "a" + to_string(rng() % files);
+            string data(1 + rng() % 512, 'p');
+            s.logicalBytes += data.size();
+            timed(s, [&] { m.fs->appendFile(name, data); });
+        }
+    }, [&](Mount& m) {
+        for (int i = 0; i < files; i++) m.fs->createFile("a" + to_string(i), 0);
+    });
+}
+
+// Deep directory chains: mkdir + cd down, a file per level, back up
+static Sample deepTree(const Options& opt) {
+    int chains = 4 * opt.scale;
+    int depth = 32;
+    return run(opt, [&](Mount& m, Sample& s) {
+        for (int c = 0; c < chains; c++) {
+            for (int d = 0; d < depth; d++) {
+                string name = "d" + to_string(c) + "_" + to_string(d);
+                timed(s, [&] { m.fs->mkdir(name); });
+                timed(s, [&] { m.fs->cd(name); });
+                timed(s, [&] { m.fs->createFile("leaf", 32); });
+                s.logicalBytes += 32;
+            }
+            for (int d = 0; d < depth; d++) m.fs->cd("..");
+        }
+    });
+}
+
+// One large directory listed through readdir, scale times; one operation
+// per page. The directory size is fixed so its tree fits the image.
+static Sample readdirPages(const Options& opt) {
+    int files = 20000;
+    return run(opt, [&](Mount& m, Sample& s) {
+        for (int pass = 0; pass < opt.scale; pass++) {
+            DirCursor cursor;
+            vector<DirEntry> page;
+            long long seen = 0;
+            while (!cursor.done) {
+                timed(s, [&] { m.fs->readdir("", cursor, 256, page); });
+                seen += page.size();
+            }
+            if (seen != files) fprintf(stderr, "readdir returned %lld of %d entries\n", seen, files);
+        }
+    }, [&](Mount& m) {
+        m.fs->beginBatch();
+        for (int i = 0; i < files; i++) m.fs->createFile("e" + to_string(i), 0);
+        m.fs->commitBatch();
+    });
+}
+
+// Populate an image once, then time mounting it and checking it
+static void populate(const Options& opt) {
+    Mount m(opt.dir, true);
+    mt19937 rng(opt.seed);
+    for (int d = 0; d < 10; d++) {
+        string dir = "dir" + to_string(d);
+        m.fs->mkdir(dir);
+        m.fs->cd(dir);
+        for (int f = 0; f < 20 * opt.scale; f++) {
+            string name = "f" + to_string(f);
+            string body(200 + rng() % 8000, 'm');
+            m.fs->createFile(name, body.size());
+            m.fs->writeFile(name, body);
+        }
+        m.fs->cd("..");
+    }
+}
+
+static Sample mountTime(const Options& opt) {
+    populate(opt);
+    Sample s;
+    s.logicalBytes = 0;
+    s.deviceBytes = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int i = 0; i < 5; i++) {
+        timed(s, [&] { Mount m(opt.dir, false); });
+    }
+    s.seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    return s;
+}
+
+static Sample fsckTime(const Options& opt) {
+    populate(opt);
+    Sample s;
+    s.logicalBytes = 0;
+    Mount m(opt.dir, false);
+    long long before = m.bm->getBlocksWritten();
+    auto t0 = chrono::steady_clock::now();
+    for (int i = 0; i < 3; i++) {
+        timed(s, [&] { m.fs->checkMeta(false); });
+    }
+    s.seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    s.deviceBytes = (m.bm->getBlocksWritten() - before) * BLOCK_SIZE;
+    return s;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.dir = "virtfs_bench.tmp";
+    opt.scale = 1;
+    opt.seed = 42;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--dir" && hasValue) opt.dir = argv[++i];
+        else if (arg == "--scale" && hasValue) opt.scale = max(1, atoi(argv[++i]));
+        else if (arg == "--seed" && hasValue) opt.seed = (unsigned)atoi(argv[++i]);
+        else if (arg == "--only" && hasValue) opt.only = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s [--dir DIR] [--scale N] [--seed N] [--only NAME]\n", argv[0]);
+            return 1;
+        }
+    }
+    mkdir(opt.dir.c_str(), 0755);
+    // Only errors, and on stderr, so stdout stays one JSON object per line
+    Log::setLevel(LOG_ERROR);
+    Log::setSink([](LogLevel level, const string& message) {
+        fprintf(stderr, "[%s] %s\n", Log::levelName(level), message.c_str());
+    });
+
+    struct Workload {
+        const char* name;
+        function<Sample()> fn;
+    };
+    vector<Workload> workloads = {
+        { "small_files", [&] { return smallFiles(opt); } },
+        { "seq_write", [&] { return sequential(opt, false); } },
+        { "seq_read", [&] { return sequential(opt, true); } },
+        { "random_append", [&] { return randomAppend(opt); } },
+        { "deep_tree", [&] { return deepTree(opt); } },
+        { "readdir", [&] { return readdirPages(opt); } },
+        { "mount", [&] { return mountTime(opt); } },
+        { "fsck", [&] { return fsckTime(opt); } },
+    };
+    bool any = false;
+    for (auto& w : workloads) {
+        if (!opt.only.empty() && opt.only != w.name) continue;
+        any = true;
+        report(w.name, w.fn());
+    }
+    if (!any) {
+        fprintf(stderr, "Unknown workload: %s\n", opt.only.c_str());
+        return 1;
+    }
+
+    string disk = opt.dir + "/virtualdisc.bin", meta = opt.dir + "/meta.bin";
+    remove(disk.c_str());
+    remove(meta.c_str());
+    rmdir(opt.dir.c_str());
+    return 0;
+}
@@ -1,14 +1,36 @@
 #include "FileSystem.hpp"
-#include "Serializer.hpp"
+#include "log.hpp"
+#include "serializer.hpp"
+#include "search.hpp"
+#include "stats.hpp"
+#include "treewalk.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <future>
 #include <iostream>
 #include <set>
 #include <cmath>
 #include <cstring>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
 using namespace std;
 
 FileSystem::FileSystem(BlockManager* blockManager) {
     bm = blockManager;
     root.reset(new Directory("root", nullptr, bm));
+    root->feed = &changes;
     currentDir = root.get();
 }
 
@@ -17,13 +39,28 @@ void FileSystem::load() {
     if (loaded) {
         // Serializer returns a new tree with parent pointers set
         root.reset(loaded);
+        root->feed = &changes;
         currentDir = root.get();
     }
 }
 
-void FileSystem::save() {
+int FileSystem::subscribe(ChangeFeed::Callback cb) { return changes.subscribe(std::move(cb)); }
+bool FileSystem::unsubscribe(int id) { return changes.unsubscribe(id); }
+
+bool FileSystem::save() {
+    root->fsyncTree();
     // Ensure index blocks are present for all files
-    Serializer::saveDirectory(*bm, root.get());
+    return root->writeTree();
+}
+
+void FileSystem::beginBatch() {
+    root->batchDepth++;
+}
+
+bool FileSystem::commitBatch() {
+    if (root->batchDepth == 0) return true;
+    if (--root->batchDepth > 0 || !root->treeDirty) return true;
+    return root->writeTree();
 }
 
 bool FileSystem::mkdir(const std::string& name) {
@@ -34,26 +71,26 @@ bool FileSystem::removeDirectory(const std::string& name) {
     if (name.empty()) return false;
     // prevent removing root
     if (name == root->name) {
-        cout << "[ERROR] Cannot remove root directory\n";
+        FS_FAIL(FS_INVALID, "Cannot remove root directory");
         return false;
     }
     Directory* target = currentDir->findSubdir(name);
     if (!target) {
-        cout << "[ERROR] Directory not found: " << name << "\n";
+        FS_FAIL(FS_NOT_FOUND, "Directory not found: " << name);
         return false;
     }
     // prevent deleting current working dir or ancestor of it
     Directory* tmp = currentDir;
     while (tmp) {
         if (tmp == target) {
-            cout << "[ERROR] Cannot remove current or parent directory\n";
+            FS_FAIL(FS_INVALID, "Cannot remove current or parent directory");
             return false;
         }
         tmp = tmp->parent;
     }
 
     bool ok = currentDir->removeDirectory(name, *bm);
-    if (!ok) cout << "[ERROR] Failed to remove directory: " << name << "\n";
+    if (!ok) FS_FAIL(FS_INVALID, "Failed to remove directory: " << name);
     return ok;
 }
 
@@ -62,30 +99,69 @@ bool FileSystem::chmodEntry(int mode, const std::string& name) {
 }
 
 bool FileSystem::checkMeta(bool repair) {
+    // Buffered appends have no blocks yet; put them on disk before checking
+    root->fsyncTree();
     int total = bm->getTotalBlocks();
     // gather referenced blocks from directory tree
     std::set<int> referenced;
     std::map<int, std::vector<std::string>> owners;
+    long long fileCount = 0, dirCount = 0;
+    std::map<int, int> refs;  // data block → number of file slots using it
     std::function<void(Directory*)> walk = [&](Directory* d) {
+        dirCount++;
+        fileCount += d->files.size();
         for (auto& p : d->files) {
             const FileMeta& fm = p.second;
             if (fm.indexBlock >= 0) referenced.insert(fm.indexBlock);
             owners[fm.indexBlock].push_back(d->name + "/" + fm.filename + " (index)");
             for (int b : fm.blocks) {
+                if (b < 0) continue;  // hole or packed slot
                 referenced.insert(b);
+                refs[b]++;
                 owners[b].push_back(d->name + "/" + fm.filename + " (data)");
             }
         }
         for (auto& sd : d->subdirs) walk(sd.get());
     };
     walk(root.get());
+    // Blocks holding the serialized tree belong to the superblock
+    for (int b : bm->getTreeBlocks()) {
+        referenced.insert(b);
+        owners[b].push_back("superblock (tree)");
+    }
+    // Released inside an open batch: the saved tree still names them
+    for (int b : root->batchFreed) {
+        referenced.insert(b);
+        owners[b].push_back("open batch (released)");
+    }
+    // Snapshot trees own their data blocks too; their index blocks are not kept
+    for (auto& snap : bm->getSnapshots()) {
+        unique_ptr<Directory> tree = openSnapshot(snap.name);
+        if (!tree) continue;
+        std::function<void(Directory*)> snapWalk = [&](Directory* d) {
+            for (auto& p : d->files) {
+                for (int b : p.second.blocks) {
+                    if (b < 0) continue;
+                    referenced.insert(b);
+                    refs[b]++;
+                    owners[b].push_back("snapshot " + snap.name + ":" + d->name + "/" + p.first + " (data)");
+                }
+            }
+            for (auto& sd : d->subdirs) snapWalk(sd.get());
+        };
+        snapWalk(tree.get());
+    }
+    for (int b : bm->getSnapshotBlocks()) {
+        referenced.insert(b);
+        owners[b].push_back("superblock (snapshots)");
+    }
 
     std::vector<int> used, orphan, missing;
     std::vector<std::string> actions;
     for (int i = 0; i < total; ++i) {
         if (!bm->isBlockFree(i)) {
             used.push_back(i);
-            if (i == 0) continue; // skip directory block (reserved)
+            if (i == 0) continue; // skip superblock (reserved)
             if (referenced.find(i) == referenced.end()) {
                 // block used but not referenced: orphan
                 orphan.push_back(i);
@@ -97,7 +173,7 @@ bool FileSystem::checkMeta(bool repair) {
         if (bm->isBlockFree(r)) missing.push_back(r);
     }
 
-    cout << "fsck: total blocks=" << total << " used=" << used.size() << "\n";
+    cout << "fsck: total blocks=" << total << " used=" << used.size() << " groups=" << bm->getGroupCount() << "\n";
     if (!orphan.empty()) {
         cout << "Orphaned blocks: \n";
         for (int b : orphan) {
@@ -120,16 +196,72 @@ bool FileSystem::checkMeta(bool repair) {
         cout << "\n";
     } else cout << "No referenced-but-free blocks.\n";
 
+    // Cached usage counters must agree with the tree and the bitmap
+    FsStats st = bm->statfs();
+    long long freeInBitmap = total - (long long)used.size();
+    if (st.files != fileCount || st.dirs != dirCount || st.freeBlocks != freeInBitmap) {
+        cout << "Usage counters out of date: files " << st.files << "/" << fileCount
+             << ", dirs " << st.dirs << "/" << dirCount
+             << ", free " << st.freeBlocks << "/" << freeInBitmap << " (cached/actual)\n";
+        if (repair) {
+            bm->setUsage(fileCount, dirCount);
+            actions.push_back("reset-usage-counters");
+        }
+    } else cout << "Usage counters consistent.\n";
+
+    // Subtree totals behind du must match a fresh count
+    int badTotals = 0;
+    std::function<void(Directory*, long long&, long long&, long long&)> count =
+        [&](Directory* d, long long& bytes, long long& nfiles, long long& ndirs) {
+        bytes = 0;
+        nfiles = (long long)d->files.size();
+        ndirs = (long long)d->subdirs.size();
+        for (auto& p : d->files) bytes += p.second.fileSize;
+        for (auto& sd : d->subdirs) {
+            long long b, f, n;
+            count(sd.get(), b, f, n);
+            bytes += b;
+            nfiles += f;
+            ndirs += n;
+        }
+        if (bytes != d->treeBytes || nfiles != d->treeFiles || ndirs != d->treeDirs) badTotals++;
+    };
+    long long tb, tf, td;
+    count(root.get(), tb, tf, td);
+    if (badTotals > 0) {
+        cout << "Subtree totals out of date in " << badTotals << " director" << (badTotals == 1 ? "y" : "ies") << "\n";
+        if (repair) {
+            root->recountTree();
+            actions.push_back("recount-subtree-totals");
+        }
+    } else cout << "Subtree totals consistent.\n";
+
+    // Shared blocks: the owner counts must match the tree
+    int badRefs = 0;
+    for (auto& r : refs) {
+        if (r.second > 1 || bm->getRefCount(r.first) > 1) {
+            if (bm->getRefCount(r.first) != r.second) badRefs++;
+        }
+    }
+    if (badRefs > 0) {
+        cout << "Shared-block reference counts wrong for " << badRefs << " block(s)\n";
+        if (repair) {
+            bm->setRefCounts(refs);
+            actions.push_back("reset-refcounts");
+        }
+    }
+
     if (repair && !orphan.empty()) {
         for (int b : orphan) {
             bm->freeBlock(b);
-            cout << "[fsck-repair] Freed block: " << b << "\n";
+            actions.push_back("freed-orphan:" + to_string(b));
+            FS_LOG(LOG_INFO, "fsck-repair: Freed block: " << b);
         }
     }
     // Fix referenced but free blocks by marking them used
     if (repair && !missing.empty()) {
         for (int b : missing) {
-            cout << "[fsck-repair] Marking referenced-but-free block used: " << b << "\n";
+            FS_LOG(LOG_INFO, "fsck-repair: Marking referenced-but-free block used: " << b);
             bm->markBlockUsed(b);
             actions.push_back("mark-used:" + to_string(b));
         }
@@ -140,42 +272,49 @@ bool FileSystem::checkMeta(bool repair) {
     std::function<void(Directory*)> repairWalk = [&](Directory* d) {
         for (auto &p : d->files) {
             FileMeta &fm = const_cast<FileMeta&>(p.second);
+            if (fm.isInline()) {
+                // no blocks to check; the stored bytes must match the size
+                if ((long long)fm.inlineData.size() != fm.fileSize) {
+                    FS_LOG(LOG_INFO, "fsck-repair: Inline data of " << d->name << "/" << fm.filename << " is "
+                         << fm.inlineData.size() << " bytes, size says " << fm.fileSize);
+                    fm.inlineData.resize((size_t)fm.fileSize, '\0');
+                    actions.push_back("fix-inline-size for " + d->name + "/" + fm.filename);
+                }
+                continue;
+            }
             // remove invalid block indices > total
             vector<int> validBlocks;
             for (int b : fm.blocks) {
-                if (b >= 0 && b < total) validBlocks.push_back(b);
+                if (b == HOLE_BLOCK || b == PACKED_BLOCK || (b >= 0 && b < total)) validBlocks.push_back(b);
                 else {
                     actions.push_back("remove-invalid-block:" + to_string(b) + " in " + d->name + "/" + fm.filename);
-                    cout << "[fsck-repair] Removing invalid block index " << b << " from " << d->name << "/" << fm.filename << "\n";
+                    FS_LOG(LOG_INFO, "fsck-repair: Removing invalid block index " << b << " from " << d->name << "/" << fm.filename);
                 }
             }
             fm.blocks = validBlocks;
 
-            int requiredBlocks = (fm.fileSize == 0) ? 0 : (int)ceil((double)fm.fileSize / blockSize);
+            int requiredBlocks = (int)((fm.fileSize + blockSize - 1) / blockSize);
+            if (fm.compressed) {
+                // Only whole chunks can go: a packed chunk's data spans its first slots
+                int rounded = (requiredBlocks + COMPRESS_CHUNK_BLOCKS - 1) / COMPRESS_CHUNK_BLOCKS * COMPRESS_CHUNK_BLOCKS;
+                requiredBlocks = max(requiredBlocks, min(rounded, (int)fm.blocks.size()));
+            }
             if ((int)fm.blocks.size() > requiredBlocks) {
                 // free extra blocks
                 for (int i = requiredBlocks; i < (int)fm.blocks.size(); ++i) {
                     int toFree = fm.blocks[i];
+                    if (toFree < 0) continue;
                     bm->freeBlock(toFree);
                     actions.push_back("freed-block:" + to_string(toFree) + " from " + d->name + "/" + fm.filename);
-                    cout << "[fsck-repair] Freed extra block " << toFree << " from " << d->name << "/" << fm.filename << "\n";
+                    FS_LOG(LOG_INFO, "fsck-repair: Freed extra block " << toFree << " from " << d->name << "/" << fm.filename);
                 }
                 fm.blocks.erase(fm.blocks.begin() + requiredBlocks, fm.blocks.end());
             } else if ((int)fm.blocks.size() < requiredBlocks) {
-                // allocate missing blocks
+                // pad the missing tail with holes; they read back as zeros
                 int need = requiredBlocks - (int)fm.blocks.size();
-                for (int i = 0; i < need; ++i) {
-                    int b = bm->allocateBlock();
-                    if (b == -1) {
-                        cout << "[fsck-repair] Not enough blocks to satisfy file size for " << d->name << "/" << fm.filename << "; shrinking file\n";
-                        // adjust file size down
-                        fm.fileSize = (int)fm.blocks.size() * blockSize;
-                        break;
-                    }
-                    fm.blocks.push_back(b);
-                    actions.push_back("alloc-block:" + to_string(b) + " for " + d->name + "/" + fm.filename);
-                    cout << "[fsck-repair] Allocated block " << b << " for " << d->name << "/" << fm.filename << "\n";
-                }
+                fm.blocks.insert(fm.blocks.end(), need, HOLE_BLOCK);
+                actions.push_back("hole-fill:" + to_string(need) + " for " + d->name + "/" + fm.filename);
+                FS_LOG(LOG_INFO, "fsck-repair: Added " << need << " hole(s) to " << d->name << "/" << fm.filename);
             }
             // ensure index block content is in sync
             if (fm.indexBlock >= 0) {
@@ -191,22 +330,22 @@ bool FileSystem::checkMeta(bool repair) {
                             memcpy(iblocks.data(), ibuf.data() + sizeof(int), cnt * sizeof(int));
                         }
                         if (iblocks != fm.blocks) {
-                            cout << "[fsck-repair] Index block mismatch in " << d->name << "/" << fm.filename << "; rewriting index block\n";
+                            FS_LOG(LOG_INFO, "fsck-repair: Index block mismatch in " << d->name << "/" << fm.filename << "; rewriting index block");
                             Serializer::writeIndexBlock(*bm, fm);
                             actions.push_back("rewrite-index:" + to_string(fm.indexBlock) + " for " + d->name + "/" + fm.filename);
                         }
                     }
                 } else {
-                    cout << "[fsck-repair] Failed to read index block " << fm.indexBlock << " for " << d->name << "/" << fm.filename << "\n";
+                    FS_LOG(LOG_WARN, "fsck: Failed to read index block " << fm.indexBlock << " for " << d->name << "/" << fm.filename);
                 }
             } else if (fm.fileSize > 0 && fm.blocks.size() > 0) {
                 // if there's file content but no indexBlock, allocate an index block
-                int idx = bm->allocateBlock();
+                int idx = bm->allocateBlock(d->allocGroup);
                 if (idx != -1) {
                     fm.indexBlock = idx;
                     Serializer::writeIndexBlock(*bm, fm);
                     actions.push_back("create-index:" + to_string(idx) + " for " + d->name + "/" + fm.filename);
-                    cout << "[fsck-repair] Created missing index block " << idx << " for " << d->name << "/" << fm.filename << "\n";
+                    FS_LOG(LOG_INFO, "fsck-repair: Created missing index block " << idx << " for " << d->name << "/" << fm.filename);
                 }
             }
         }
@@ -215,13 +354,977 @@ bool FileSystem::checkMeta(bool repair) {
     repairWalk(root.get());
 
     // Persist any changes made to the tree
-    if (repair) root->saveDirectory();
+    if (repair && !root->saveDirectory()) {
+        cout << "fsck: repairs could not be saved (" << statusText(lastStatus()) << ")\n";
+        return false;
+    }
 
     if (!actions.empty()) cout << "fsck: actions taken: \n";
     for (auto &a : actions) cout << "  - " << a << "\n";
     return true;
 }
 
+// Helper: every data block slot in a subtree, one entry per slot
+static void collectDataBlocks(Directory* d, vector<int>& out) {
+    for (auto& p : d->files) {
+        for (int b : p.second.blocks) if (b >= 0) out.push_back(b);
+    }
+    for (auto& sd : d->subdirs) collectDataBlocks(sd.get(), out);
+}
+
+bool FileSystem::createSnapshot(const std::string& name) {
+    for (auto& s : bm->getSnapshots()) {
+        if (s.name == name) {
+            FS_FAIL(FS_EXISTS, "Snapshot already exists: " << name);
+            return false;
+        }
+    }
+    // Buffered appends are put on disk so the snapshot sees them
+    root->fsyncTree();
+    string text = Serializer::treeText(root.get());
+
+    // One more owner per slot: no block is copied now, and the next write
+    // to any of them takes the copy-on-write path
+    vector<int> blocks;
+    collectDataBlocks(root.get(), blocks);
+    for (int b : blocks) bm->refBlock(b);
+    if (!bm->addSnapshot(name, text)) {
+        for (int b : blocks) bm->freeBlock(b);
+        FS_FAIL(FS_NO_SPACE, "No free blocks to store snapshot " << name);
+        return false;
+    }
+    FS_LOG(LOG_INFO, "Snapshot " << name << " created (" << blocks.size() << " data blocks shared)");
+    return true;
+}
+
+unique_ptr<Directory> FileSystem::openSnapshot(const std::string& name) {
+    string text;
+    if (!bm->readSnapshot(name, text)) return nullptr;
+    map<int, int> owners;
+    long long files = 0, dirs = 0;
+    return unique_ptr<Directory>(Serializer::parseTree(*bm, text, owners, files, dirs));
+}
+
+bool FileSystem::deleteSnapshot(const std::string& name) {
+    unique_ptr<Directory> tree = openSnapshot(name);
+    if (!tree) {
+        FS_FAIL(FS_NOT_FOUND, "Snapshot not found: " << name);
+        return false;
+    }
+    // Drop the table entry first: a crash in between leaves orphans for
+    // fsck, never a snapshot naming freed blocks
+    if (!bm->removeSnapshot(name)) {
+        FS_FAIL(FS_IO_ERROR, "Failed to update snapshot table");
+        return false;
+    }
+    vector<int> blocks;
+    collectDataBlocks(tree.get(), blocks);
+    long long before = bm->getFreeBlockCount();
+    for (int b : blocks) bm->freeBlock(b);
+    FS_LOG(LOG_INFO, "Snapshot " << name << " deleted (" << bm->getFreeBlockCount() - before << " blocks freed)");
+    return true;
+}
+
+void FileSystem::listSnapshots() {
+    vector<SnapshotRecord> snaps = bm->getSnapshots();
+    if (snaps.empty()) {
+        cout << "No snapshots.\n";
+        return;
+    }
+    for (auto& s : snaps) {
+        unique_ptr<Directory> tree = openSnapshot(s.name);
+        vector<int> blocks;
+        if (tree) collectDataBlocks(tree.get(), blocks);
+        // Blocks no longer shared with the live tree are what deleting frees
+        set<int> distinct(blocks.begin(), blocks.end());
+        long long exclusive = 0;
+        for (int b : distinct) if (bm->getRefCount(b) == 1) exclusive++;
+        time_t t = (time_t)s.createdAt;
+        char when[30];
+        strftime(when, sizeof(when), "%d-%m-%Y %H:%M:%S", localtime(&t));
+        cout << s.name << "  " << when << "  " << distinct.size() << " blocks, "
+             << exclusive << " held only by this snapshot\n";
+    }
+}
+
+// Helper: walk a '/'-separated path to a directory. Paths starting with
+// "/" or the root's name start at root, others at start; ".." goes up.
+static Directory* resolveDir(Directory* root, Directory* start, const string& path) {
+    vector<string> parts;
+    stringstream ss(path);
+    string part;
+    while (getline(ss, part, '/')) if (!part.empty() && part != ".") parts.push_back(part);
+    Directory* d = start;
+    size_t i = 0;
+    if ((!path.empty() && path[0] == '/') || (!parts.empty() && parts[0] == root->name)) {
+        d = root;
+        if (!parts.empty() && parts[0] == root->name) i = 1;
+    }
+    for (; i < parts.size() && d; i++) d = parts[i] == ".." ? d->parent : d->findSubdir(parts[i]);
+    return d;
+}
+
+// Helper: the directory holding path's last component, which goes in leaf
+static Directory* resolveParent(Directory* root, Directory* start, const string& path, string& leaf) {
+    size_t end = path.find_last_not_of('/');
+    if (end == string::npos) {
+        leaf.clear();
+        return root;
+    }
+    size_t slash = path.rfind('/', end);
+    leaf = path.substr(slash == string::npos ? 0 : slash + 1, end - (slash == string::npos ? 0 : slash + 1) + 1);
+    if (slash == string::npos) {
+        // A bare root name means the root itself
+        if (start == root && leaf == root->name) leaf.clear();
+        return start;
+    }
+    return resolveDir(root, start, path.substr(0, slash + 1));
+}
+
+bool FileSystem::snapshotLs(const std::string& name, const std::string& path) {
+    unique_ptr<Directory> tree = openSnapshot(name);
+    if (!tree) {
+        FS_FAIL(FS_NOT_FOUND, "Snapshot not found: " << name);
+        return false;
+    }
+    Directory* d = resolveDir(tree.get(), tree.get(), path);
+    if (!d) {
+        FS_FAIL(FS_NOT_FOUND, "Directory not found in snapshot: " << path);
+        return false;
+    }
+    d->listContents();
+    return true;
+}
+
+bool FileSystem::snapshotCat(const std::string& name, const std::string& path) {
+    unique_ptr<Directory> tree = openSnapshot(name);
+    if (!tree) {
+        FS_FAIL(FS_NOT_FOUND, "Snapshot not found: " << name);
+        return false;
+    }
+    string leaf;
+    Directory* d = resolveParent(tree.get(), tree.get(), path, leaf);
+    if (!d || leaf.empty() || !d->hasFile(leaf)) {
+        FS_FAIL(FS_NOT_FOUND, "File not found in snapshot: " << path);
+        return false;
+    }
+    cout << d->readFile(leaf) << "\n";
+    return true;
+}
+
+static string pathOf(Directory* d) {
+    string path;
+    for (; d; d = d->parent) path = "/" + d->name + path;
+    return path;
+}
+
+bool FileSystem::rename(const std::string& srcPath, const std::string& dstPath) {
+    string srcLeaf, dstLeaf;
+    Directory* from = resolveParent(root.get(), currentDir, srcPath, srcLeaf);
+    if (!from || srcLeaf.empty() || srcLeaf == "." || srcLeaf == ".." ||
+        (!from->hasFile(srcLeaf) && !from->findSubdir(srcLeaf))) {
+        FS_FAIL(FS_NOT_FOUND, "Not found: " << srcPath);
+        return false;
+    }
+    // An existing directory as destination receives the entry under its own name
+    Directory* to = resolveDir(root.get(), currentDir, dstPath);
+    if (to) dstLeaf = srcLeaf;
+    else to = resolveParent(root.get(), currentDir, dstPath, dstLeaf);
+    if (!to || dstLeaf.empty() || dstLeaf == "." || dstLeaf == "..") {
+        FS_FAIL(FS_NOT_FOUND, "Destination directory not found: " << dstPath);
+        return false;
+    }
+    if ((from->permissions & 2) == 0 || (to->permissions & 2) == 0) {
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot rename");
+        return false;
+    }
+    if (from == to && srcLeaf == dstLeaf) return true;
+    if (to->hasFile(dstLeaf) || to->findSubdir(dstLeaf)) {
+        FS_FAIL(FS_EXISTS, "Destination already exists: " << dstPath);
+        return false;
+    }
+
+    // Only the in-memory entry moves; index and data blocks are untouched
+    auto it = from->files.find(srcLeaf);
+    if (it != from->files.end()) {
+        from->dropBuffer(it->second);
+        FileMeta fm = std::move(it->second);
+        from->files.erase(it);
+        from->addToTree(-fm.fileSize, -1, 0);
+        to->addToTree(fm.fileSize, 1, 0);
+        fm.filename = dstLeaf;
+        FileMeta& moved = to->files[dstLeaf] = std::move(fm);
+        to->trackBuffer(moved, 0);
+        if (!root->saveDirectory()) {
+            // Put it back: the tree on disk still has it at the source
+            to->dropBuffer(moved);
+            FileMeta back = std::move(moved);
+            to->files.erase(dstLeaf);
+            to->addToTree(-back.fileSize, -1, 0);
+            from->addToTree(back.fileSize, 1, 0);
+            back.filename = srcLeaf;
+            FileMeta& home = from->files[srcLeaf] = std::move(back);
+            from->trackBuffer(home, 0);
+            return false;
+        }
+    } else {
+        Directory* moving = from->findSubdir(srcLeaf);
+        for (Directory* d = to; d; d = d->parent) {
+            if (d == moving) {
+                FS_FAIL(FS_INVALID, "Cannot move a directory inside itself");
+                return false;
+            }
+        }
+        size_t pos;
+        unique_ptr<Directory> subtree = from->detachSubdir(moving, &pos);
+        subtree->name = dstLeaf;
+        from->addToTree(-moving->treeBytes, -moving->treeFiles, -(moving->treeDirs + 1));
+        to->addToTree(moving->treeBytes, moving->treeFiles, moving->treeDirs + 1);
+        to->attachSubdir(std::move(subtree));
+        if (!root->saveDirectory()) {  // one tree write covers both directories
+            subtree = to->detachSubdir(moving);
+            to->addToTree(-moving->treeBytes, -moving->treeFiles, -(moving->treeDirs + 1));
+            from->addToTree(moving->treeBytes, moving->treeFiles, moving->treeDirs + 1);
+            subtree->name = srcLeaf;
+            from->attachSubdir(std::move(subtree), pos);
+            return false;
+        }
+    }
+    FS_LOG(LOG_INFO, "Renamed " << srcPath << " to " << dstPath);
+    if (changes.active()) {
+        ChangeEvent e;
+        e.type = CHANGE_RENAME;
+        e.path = pathOf(from) + "/" + srcLeaf;
+        e.newPath = pathOf(to) + "/" + dstLeaf;
+        auto moved = to->files.find(dstLeaf);
+        e.size = moved != to->files.end() ? moved->second.fileSize : -1;
+        changes.publish(e);
+    }
+    return true;
+}
+
+// Helper: runs of consecutive stored blocks in a file; holes and packed
+// slots do not break a run
+static int extentCount(const FileMeta& fm) {
+    int extents = 0, prev = -2;
+    for (int b : fm.blocks) {
+        if (b < 0) continue;
+        if (b != prev + 1) extents++;
+        prev = b;
+    }
+    return extents;
+}
+
+void FileSystem::fragReport() {
+    long long files = 0, fragmented = 0, extents = 0;
+    vector<pair<int, string>> worst;
+    std::function<void(Directory*)> walk = [&](Directory* d) {
+        for (auto& p : d->files) {
+            int e = extentCount(p.second);
+            if (e == 0) continue;  // inline or fully sparse
+            files++;
+            extents += e;
+            if (e > 1) {
+                fragmented++;
+                worst.push_back(make_pair(e, pathOf(d) + "/" + p.first));
+            }
+        }
+        for (auto& sd : d->subdirs) walk(sd.get());
+    };
+    walk(root.get());
+    sort(worst.rbegin(), worst.rend());
+
+    cout << "Files with data: " << files << ", fragmented: " << fragmented << ", extents: " << extents;
+    if (files) cout << " (" << (double)extents / files << " per file)";
+    cout << "\n";
+    for (size_t i = 0; i < worst.size() && i < 5; i++) {
+        cout << "  " << worst[i].second << ": " << worst[i].first << " extents\n";
+    }
+
+    // Free extents bucketed by power-of-two length
+    vector<int> runs = bm->freeRuns();
+    map<int, pair<long long, long long>> buckets;  // floor(log2 len) → runs, blocks
+    int largest = 0;
+    for (int r : runs) {
+        int k = 0;
+        while ((2 << k) <= r) k++;
+        buckets[k].first++;
+        buckets[k].second += r;
+        largest = max(largest, r);
+    }
+    cout << "Free extents: " << runs.size() << ", largest " << largest << " blocks\n";
+    for (auto& b : buckets) {
+        cout << "  " << setw(8) << (1 << b.first) << "-" << left << setw(8) << (2 << b.first) - 1 << right
+             << b.second.first << " runs, " << b.second.second << " blocks\n";
+    }
+}
+
+bool FileSystem::defrag(int maxMBps) {
+    // Buffered appends get their blocks first, so they are moved too
+    root->fsyncTree();
+    vector<pair<Directory*, string>> todo;
+    std::function<void(Directory*)> walk = [&](Directory* d) {
+        for (auto& p : d->files) if (extentCount(p.second) > 1) todo.push_back(make_pair(d, p.first));
+        for (auto& sd : d->subdirs) walk(sd.get());
+    };
+    walk(root.get());
+
+    int blockSize = bm->getBlockSize();
+    const size_t BATCH = 64;  // Blocks in flight per copy step
+    long long moved = 0;
+    int done = 0, skipped = 0;
+    vector<int> released;     // Old blocks, freed once the tree naming the new ones is saved
+    // Files moved since the last save, with their old block lists, to put
+    // back if the save fails
+    vector<pair<FileMeta*, vector<int>>> unsaved;
+    // Fingerprints of the copies; freeing the originals drops their dedup
+    // entries, so these go in after them
+    DedupIndex* dd = bm->dedup();
+    vector<pair<uint64_t, int>> prints;
+    bool saved = true;
+    auto checkpoint = [&]() {
+        bool written = root->saveDirectory();
+        if (written) {
+            root->releaseBlocks(released);
+            // Inside a batch the originals are still allocated, so replace theirs
+            for (auto& p : prints) dd->insert(p.first, p.second, true);
+        } else {
+            for (auto& u : unsaved) {
+                for (int b : u.first->blocks) if (b >= 0) bm->freeBlock(b);
+                for (int b : u.second) if (b >= 0) moved--;
+                u.first->blocks = u.second;
+                Serializer::writeIndexBlock(*bm, *u.first);
+            }
+            done -= (int)unsaved.size();
+        }
+        released.clear();
+        unsaved.clear();
+        prints.clear();
+        return written;
+    };
+    auto start = chrono::steady_clock::now();
+    for (auto& t : todo) {
+        FileMeta& fm = t.first->files[t.second];
+        vector<int> slots;
+        bool shared = false;
+        for (size_t i = 0; i < fm.blocks.size(); i++) {
+            if (fm.blocks[i] < 0) continue;
+            slots.push_back((int)i);
+            if (bm->getRefCount(fm.blocks[i]) > 1) shared = true;
+        }
+        // Shared blocks have other owners whose lists would go stale
+        vector<int> run;
+        if (shared || !bm->allocateBlocks((int)slots.size(), t.first->allocGroup, run)) {
+            skipped++;
+            continue;
+        }
+        bool contiguous = true;
+        for (size_t k = 1; k < run.size(); k++) contiguous = contiguous && run[k] == run[0] + (int)k;
+        bool ok = contiguous;
+        vector<pair<uint64_t, int>> filePrints;  // Compressed chunks are not indexed
+        for (size_t k = 0; k < slots.size() && ok; k += BATCH) {
+            size_t n = min(BATCH, slots.size() - k);
+            vector<vector<char>> buffers(n, vector<char>(blockSize, 0));
+            vector<future<bool>> pending;
+            for (size_t j = 0; j < n; j++) pending.push_back(bm->readBlockAsync(fm.blocks[slots[k + j]], buffers[j]));
+            for (auto& f : pending) ok = f.get() && ok;
+            pending.clear();
+            for (size_t j = 0; j < n && ok && dd && !fm.compressed; j++) {
+                filePrints.push_back(make_pair(DedupIndex::fingerprint(buffers[j]), run[k + j]));
+            }
+            for (size_t j = 0; j < n && ok; j++) pending.push_back(bm->writeBlockAsync(run[k + j], buffers[j]));
+            for (auto& f : pending) ok = f.get() && ok;
+
+            // Throttle: sleep until the copy rate is back under maxMBps
+            if (maxMBps > 0) {
+                double bytes = (double)(moved + k + n) * blockSize;
+                auto due = start + chrono::duration<double>(bytes / (maxMBps * 1024.0 * 1024.0));
+                this_thread::sleep_until(due);
+            }
+        }
+        if (!ok) {
+            for (int b : run) bm->freeBlock(b);
+            skipped++;
+            continue;
+        }
+        unsaved.push_back(make_pair(&fm, fm.blocks));
+        prints.insert(prints.end(), filePrints.begin(), filePrints.end());
+        for (size_t k = 0; k < slots.size(); k++) {
+            released.push_back(fm.blocks[slots[k]]);
+            fm.blocks[slots[k]] = run[k];
+        }
+        Serializer::writeIndexBlock(*bm, fm);
+        moved += slots.size();
+        done++;
+        if (done % 32 == 0 && !checkpoint()) {
+            saved = false;
+            break;
+        }
+    }
+    if (saved && !unsaved.empty()) saved = checkpoint();
+
+    long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    FS_LOG(LOG_INFO, "Defragmented " << done << " file(s), " << moved << " blocks moved in " << ms << " ms"
+           << (skipped ? "; " + to_string(skipped) + " skipped (shared blocks or no contiguous free run)" : ""));
+    return saved;
+}
+
+// One host file waiting to be copied in by the import reader pool
+struct ImportJob {
+    string hostPath;
+    FileMeta* fm;
+};
+
+// Helper: names the tree text can hold as a single token
+static bool importableName(const string& name) {
+    if (name.empty()) return false;
+    for (unsigned char c : name) if (c <= ' ' || c == '/' || c == 127) return false;
+    return true;
+}
+
+// Helper: mirror host directory `path` into `into` (names sorted, so the
+// layout is reproducible). Files get their metadata here; their data is
+// copied later from the collected jobs.
+static void scanHostDir(const string& path, Directory* into, BlockManager* bm, Directory* existing,
+                        vector<ImportJob>& jobs, long long& dirs, long long& skipped) {
+    DIR* dp = opendir(path.c_str());
+    if (!dp) {
+        FS_LOG(LOG_WARN, "import: cannot open " << path);
+        skipped++;
+        return;
+    }
+    vector<string> names;
+    while (struct dirent* e = readdir(dp)) {
+        string n = e->d_name;
+        if (n != "." && n != "..") names.push_back(n);
+    }
+    closedir(dp);
+    sort(names.begin(), names.end());
+
+    int blockSize = bm->getBlockSize();
+    for (const string& n : names) {
+        string hostPath = path + "/" + n;
+        struct stat st;
+        if (!importableName(n) || lstat(hostPath.c_str(), &st) != 0) {
+            FS_LOG(LOG_WARN, "import: skipped " << hostPath << " (unusable name)");
+            skipped++;
+            continue;
+        }
+        // Only the top level can collide: everything below is new
+        if (existing && (existing->hasFile(n) || existing->findSubdir(n))) {
+            FS_LOG(LOG_WARN, "import: skipped " << hostPath << " (already exists)");
+            skipped++;
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            unique_ptr<Directory> sub(new Directory(n, into, bm));
+            sub->permissions = (st.st_mode >> 6) & 7;
+            scanHostDir(hostPath, sub.get(), bm, nullptr, jobs, dirs, skipped);
+            into->attachSubdir(std::move(sub));
+            dirs++;
+        } else if (S_ISREG(st.st_mode)) {
+            long long numBlocks = ((long long)st.st_size + blockSize - 1) / blockSize;
+            if (numBlocks > Serializer::indexCapacity(*bm)) {
+                FS_LOG(LOG_WARN, "import: skipped " << hostPath << " (larger than one index block can map)");
+                skipped++;
+                continue;
+            }
+            FileMeta& fm = into->files[n];
+            fm.filename = n;
+            fm.fileSize = st.st_size;
+            fm.permissions = (st.st_mode >> 6) & 7;
+            fm.modifiedAt = st.st_mtime;
+            if (fm.fileSize <= bm->getInlineLimit()) fm.inlineData.assign((size_t)fm.fileSize, '\0');
+            else fm.blocks.assign(numBlocks, HOLE_BLOCK);  // Placed once the total is known
+            ImportJob job = { hostPath, &fm };
+            jobs.push_back(job);
+        } else {
+            FS_LOG(LOG_WARN, "import: skipped " << hostPath << " (not a regular file or directory)");
+            skipped++;
+        }
+    }
+}
+
+// Helper: read up to len bytes; returns how many arrived
+static long long readFully(int fd, char* out, long long len) {
+    long long done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, out + done, (size_t)(len - done));
+        if (n <= 0) break;
+        done += n;
+    }
+    return done;
+}
+
+// Helper: copy one host file into its reserved blocks, index block first.
+// Adjacent blocks go out in one write of up to SEGMENT blocks.
+static bool importFile(BlockManager* bm, const ImportJob& job, vector<char>& buf) {
+    static const int SEGMENT = 256;
+    FileMeta& fm = *job.fm;
+    int fd = open(job.hostPath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = true;
+    if (fm.isInline()) {
+        ok = readFully(fd, &fm.inlineData[0], fm.fileSize) == fm.fileSize;
+        close(fd);
+        return ok;
+    }
+
+    long long blockSize = bm->getBlockSize();
+    if (buf.size() < (size_t)(SEGMENT * blockSize)) buf.resize(SEGMENT * blockSize);
+    vector<int> seq(1, fm.indexBlock);
+    seq.insert(seq.end(), fm.blocks.begin(), fm.blocks.end());
+    for (size_t i = 0; i < seq.size() && ok;) {
+        size_t n = 1;
+        while (i + n < seq.size() && n < (size_t)SEGMENT && seq[i + n] == seq[i] + (int)n) n++;
+        memset(buf.data(), 0, n * blockSize);
+        size_t k = 0;
+        if (i == 0) {
+            vector<char> index = Serializer::buildIndexBlock(*bm, fm);
+            memcpy(buf.data(), index.data(), blockSize);
+            k = 1;
+        }
+        // Data slots i+k .. i+n-1 are file blocks i+k-1 .. i+n-2
+        long long from = (long long)(i + k - 1) * blockSize;
+        long long want = min((long long)(i + n - 1) * blockSize, fm.fileSize) - from;
+        if (want > 0 && readFully(fd, buf.data() + k * blockSize, want) != want) ok = false;
+        ok = bm->writeBlocks(seq[i], (int)n, buf.data()) && ok;
+        i += n;
+    }
+    close(fd);
+    return ok;
+}
+
+bool FileSystem::importTree(const std::string& hostDir, const std::string& destPath) {
+    auto start = chrono::steady_clock::now();
+    Directory* dest = destPath.empty() ? currentDir : resolveDir(root.get(), currentDir, destPath);
+    if (!dest) {
+        FS_FAIL(FS_NOT_FOUND, "Destination directory not found: " << destPath);
+        return false;
+    }
+    if ((dest->permissions & 2) == 0) {
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot import into this directory");
+        return false;
+    }
+    struct stat st;
+    if (stat(hostDir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        FS_FAIL(FS_NOT_FOUND, "Host directory not found: " << hostDir);
+        return false;
+    }
+
+    // 1. Walk the host tree into a detached staging directory
+    Directory staging(dest->name, nullptr, bm);
+    vector<ImportJob> jobs;
+    long long dirs = 0, skipped = 0;
+    scanHostDir(hostDir, &staging, bm, dest, jobs, dirs, skipped);
+
+    // 2. Reserve every block up front and lay files out in walk order, each
+    //    index block directly ahead of its data. The tree is written once at
+    //    the end, so the blocks it will grow by must stay free.
+    long long needed = 0, bytes = 0;
+    for (auto& j : jobs) {
+        bytes += j.fm->fileSize;
+        if (j.fm->fileSize > bm->getInlineLimit()) needed += 1 + (long long)j.fm->blocks.size();
+    }
+    long long treeBytes = (long long)(Serializer::treeText(root.get()).size() + Serializer::treeText(&staging).size());
+    long long treeGrowth = max(0LL, (treeBytes + bm->getBlockSize() - 9) / (bm->getBlockSize() - 8)
+                                    - (long long)bm->getTreeBlocks().size());
+    vector<pair<int, int>> extents;
+    long long unreserved = bm->getFreeBlockCount() - bm->getReservedBlocks();
+    if (needed + treeGrowth > unreserved || !bm->reserveExtents(needed, extents)) {
+        FS_FAIL(FS_NO_SPACE, "Not enough free blocks to import " << hostDir << ": " << needed << " needed, "
+                << unreserved - treeGrowth << " free");
+        return false;
+    }
+    size_t e = 0;
+    int offset = 0;
+    auto take = [&]() {
+        if (offset == extents[e].second) {
+            e++;
+            offset = 0;
+        }
+        return extents[e].first + offset++;
+    };
+    for (auto& j : jobs) {
+        if (j.fm->fileSize <= bm->getInlineLimit()) continue;
+        j.fm->indexBlock = take();
+        for (int& b : j.fm->blocks) b = take();
+    }
+
+    // 3. Reader pool: each thread reads whole files and writes their blocks,
+    //    so host reads and image writes of different files overlap
+    atomic<size_t> next(0);
+    atomic<long long> failed(0);
+    int threads = (int)min<size_t>(8, max<size_t>(1, thread::hardware_concurrency()));
+    threads = (int)min<size_t>(threads, max<size_t>(1, jobs.size()));
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&]() {
+            vector<char> buf;
+            for (size_t i = next++; i < jobs.size(); i = next++) {
+                if (importFile(bm, jobs[i], buf)) continue;
+                FS_LOG(LOG_WARN, "import: could not read all of " << jobs[i].hostPath << "; missing data reads as zeros");
+                failed++;
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+
+    // 4. Splice the staged entries in; metadata is written once
+    staging.recountTree();
+    dest->addToTree(staging.treeBytes, staging.treeFiles, staging.treeDirs);
+    vector<string> topFiles;
+    vector<Directory*> topDirs;
+    for (auto& p : staging.files) topFiles.push_back(p.first);
+    for (auto& sd : staging.subdirs) topDirs.push_back(sd.get());
+    for (auto& p : staging.files) dest->files[p.first] = std::move(p.second);
+    for (auto& sd : staging.subdirs) dest->attachSubdir(std::move(sd));
+    staging.subdirs.clear();
+    staging.subdirIndex.clear();
+    bm->adjustUsage((long long)jobs.size(), dirs);
+    if (!root->saveDirectory()) {
+        // Unsplice and give back every reserved block
+        for (auto& name : topFiles) dest->files.erase(name);
+        for (Directory* d : topDirs) dest->detachSubdir(d);
+        dest->addToTree(-staging.treeBytes, -staging.treeFiles, -staging.treeDirs);
+        bm->adjustUsage(-(long long)jobs.size(), -dirs);
+        vector<int> reserved;
+        for (auto& x : extents) for (int i = 0; i < x.second; i++) reserved.push_back(x.first + i);
+        bm->freeBlocks(std::move(reserved));
+        bm->saveMeta();
+        return false;
+    }
+    bm->saveMeta();
+
+    // Announce every new entry, parents before children
+    if (changes.active()) {
+        std::function<void(Directory*)> announce = [&](Directory* d) {
+            d->parent->notify(CHANGE_MKDIR, d->name);
+            for (auto& p : d->files) d->notify(CHANGE_CREATE, p.first);
+            for (auto& sd : d->subdirs) announce(sd.get());
+        };
+        for (auto& name : topFiles) dest->notify(CHANGE_CREATE, name);
+        for (Directory* d : topDirs) announce(d);
+    }
+
+    long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    FS_LOG(LOG_INFO, "Imported " << jobs.size() << " file(s), " << dirs << " director" << (dirs == 1 ? "y" : "ies")
+           << ", " << bytes << " bytes in " << ms << " ms" << (skipped ? " (" + to_string(skipped) + " skipped)" : ""));
+    if (failed > 0) {
+        setStatus(FS_IO_ERROR);
+        return false;
+    }
+    return true;
+}
+
+// Receives an export: every directory first, then each file's bytes in order
+class ExportSink {
+public:
+    virtual ~ExportSink() {}
+    virtual bool dir(const string& path, int perm) = 0;
+    virtual bool beginFile(const string& path, long long size, int perm, long mtime) = 0;
+    virtual bool data(const char* p, size_t n) = 0;
+    virtual bool endFile() = 0;
+    virtual bool finish() = 0;
+};
+
+// ustar archive; names too long for the name/prefix split use a GNU
+// long-name entry, sizes beyond 8 GiB the GNU base-256 encoding
+class TarSink : public ExportSink {
+public:
+    explicit TarSink(const string& path) : out(path, ios::binary | ios::trunc) {}
+    bool good() const { return out.good(); }
+
+    bool dir(const string& path, int perm) override {
+        return header(path + "/", 0, perm, time(nullptr), '5');
+    }
+    bool beginFile(const string& path, long long size, int perm, long mtime) override {
+        written = 0;
+        return header(path, size, perm, mtime, '0');
+    }
+    bool data(const char* p, size_t n) override {
+        out.write(p, n);
+        written += n;
+        return out.good();
+    }
+    bool endFile() override {
+        pad(written);
+        return out.good();
+    }
+    bool finish() override {
+        static const char zeros[2 * BLOCK] = {};
+        out.write(zeros, sizeof(zeros));
+        out.close();
+        return !out.fail();
+    }
+
+private:
+    static const int BLOCK = 512;
+    ofstream out;
+    long long written = 0;  // Bytes of the current file so far
+
+    // Fill the last record of an n-byte entry
+    void pad(long long n) {
+        static const char zeros[BLOCK] = {};
+        if (n % BLOCK) out.write(zeros, BLOCK - n % BLOCK);
+    }
+
+    static void number(char* field, int width, long long v) {
+        if (v < (1LL << (3 * (width - 1)))) {
+            snprintf(field, width, "%0*llo", width - 1, v);
+            return;
+        }
+        field[0] = (char)0x80;
+        for (int i = width - 1; i > 0; i--, v >>= 8) field[i] = (char)(v & 0xff);
+    }
+
+    bool header(const string& path, long long size, int perm, long mtime, char type) {
+        string name = path, prefix;
+        if (name.size() > 100) {
+            size_t slash = path.find('/', path.size() > 101 ? path.size() - 101 : 0);
+            if (slash != string::npos && slash <= 155 && path.size() - slash - 1 <= 100 && slash + 1 < path.size()) {
+                prefix = path.substr(0, slash);
+                name = path.substr(slash + 1);
+            } else {
+                // GNU long name: the next entry's real name as data
+                string longName = path + '\0';
+                if (!header("././@LongLink", (long long)longName.size(), 0, 0, 'L')) return false;
+                out.write(longName.data(), longName.size());
+                pad((long long)longName.size());
+                name = path.substr(0, 100);
+            }
+        }
+        char h[BLOCK] = {};
+        memcpy(h, name.data(), min<size_t>(name.size(), 100));
+        number(h + 100, 8, (perm & 7) << 6);
+        number(h + 108, 8, 0);
+        number(h + 116, 8, 0);
+        number(h + 124, 12, size);
+        number(h + 136, 12, mtime);
+        h[156] = type;
+        memcpy(h + 257, "ustar", 6);
+        memcpy(h + 263, "00", 2);
+        memcpy(h + 345, prefix.data(), min<size_t>(prefix.size(), 155));
+        memset(h + 148, ' ', 8);
+        unsigned sum = 0;
+        for (unsigned char c : h) sum += c;
+        snprintf(h + 148, 8, "%06o", sum);
+        out.write(h, BLOCK);
+        return out.good();
+    }
+};
+
+// Plain files and directories under a host directory. Owner permission
+// bits are applied last, so read-only directories can still be filled.
+class HostDirSink : public ExportSink {
+public:
+    explicit HostDirSink(const string& base) : base(base) {}
+
+    bool dir(const string& path, int perm) override {
+        string p = base + "/" + path;
+        if (mkdir(p.c_str(), 0700) != 0 && errno != EEXIST) return false;
+        dirs.push_back(make_pair(p, perm));
+        return true;
+    }
+    bool beginFile(const string& path, long long, int perm, long mtime) override {
+        fd = open((base + "/" + path).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        filePerm = perm;
+        fileTime = mtime;
+        return fd >= 0;
+    }
+    bool data(const char* p, size_t n) override {
+        while (n > 0) {
+            ssize_t w = write(fd, p, n);
+            if (w <= 0) return false;
+            p += w;
+            n -= w;
+        }
+        return true;
+    }
+    bool endFile() override {
+        struct timespec times[2];
+        times[0].tv_sec = times[1].tv_sec = fileTime;
+        times[0].tv_nsec = times[1].tv_nsec = 0;
+        futimens(fd, times);
+        fchmod(fd, (filePerm & 7) << 6);
+        return close(fd) == 0;
+    }
+    bool finish() override {
+        for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) chmod(it->first.c_str(), (it->second & 7) << 6);
+        return true;
+    }
+
+private:
+    string base;
+    vector<pair<string, int>> dirs;
+    int fd = -1;
+    int filePerm = 6;
+    long fileTime = 0;
+};
+
+// One file of an export, with its first stored block as the sort key
+struct ExportFile {
+    string path;
+    const FileMeta* fm;
+    Directory* dir;
+    int firstBlock;
+};
+
+bool FileSystem::exportTree(const std::string& target, const std::string& srcPath) {
+    auto start = chrono::steady_clock::now();
+    Directory* src = srcPath.empty() ? root.get() : resolveDir(root.get(), currentDir, srcPath);
+    if (!src) {
+        FS_FAIL(FS_NOT_FOUND, "Directory not found: " << srcPath);
+        return false;
+    }
+    // Buffered appends go to disk first, so every byte is in blocks or inline
+    root->fsyncTree();
+
+    vector<pair<string, int>> dirs;
+    vector<ExportFile> files;
+    long long skipped = 0;
+    std::function<void(Directory*, const string&)> walk = [&](Directory* d, const string& prefix) {
+        for (auto& p : d->files) {
+            // Same rule as read and grep: no read bit, no content
+            if ((p.second.permissions & 4) == 0) {
+                FS_LOG(LOG_WARN, "export: skipped " << prefix + p.first << " (no read permission)");
+                skipped++;
+                continue;
+            }
+            int first = -1;
+            for (int b : p.second.blocks) if (b >= 0) { first = b; break; }
+            ExportFile f = { prefix + p.first, &p.second, d, first };
+            files.push_back(f);
+        }
+        for (auto& sd : d->subdirs) {
+            dirs.push_back(make_pair(prefix + sd->name, sd->permissions));
+            walk(sd.get(), prefix + sd->name + "/");
+        }
+    };
+    walk(src, "");
+    // Physical block order turns the whole export into one sweep over the image
+    stable_sort(files.begin(), files.end(),
+                [](const ExportFile& a, const ExportFile& b) { return a.firstBlock < b.firstBlock; });
+
+    unique_ptr<ExportSink> sink;
+    bool tar = target.size() > 4 && target.compare(target.size() - 4, 4, ".tar") == 0;
+    if (tar) {
+        TarSink* t = new TarSink(target);
+        sink.reset(t);
+        if (!t->good()) {
+            FS_FAIL(FS_IO_ERROR, "Cannot create archive: " << target);
+            return false;
+        }
+    } else {
+        struct stat st;
+        if (::mkdir(target.c_str(), 0755) != 0 && (stat(target.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))) {
+            FS_FAIL(FS_IO_ERROR, "Cannot create host directory: " << target);
+            return false;
+        }
+        sink.reset(new HostDirSink(target));
+    }
+    for (auto& d : dirs) {
+        if (!sink->dir(d.first, d.second)) {
+            FS_FAIL(FS_IO_ERROR, "Cannot write directory " << d.first << " to " << target);
+            return false;
+        }
+    }
+
+    // A reader thread decodes segments of at most ~1 MiB into a queue of
+    // QUEUED entries while this thread writes them out, so memory stays
+    // bounded whatever the file sizes
+    static const size_t QUEUED = 4;
+    int blockSize = bm->getBlockSize();
+    int segBlocks = max(COMPRESS_CHUNK_BLOCKS, (1 << 20) / blockSize / COMPRESS_CHUNK_BLOCKS * COMPRESS_CHUNK_BLOCKS);
+    struct Segment {
+        vector<char> data;
+        bool last;
+        bool ok;
+    };
+    deque<Segment> queue;
+    mutex mu;
+    condition_variable notFull, notEmpty;
+    bool abort = false;
+    auto push = [&](Segment&& s) {
+        unique_lock<mutex> lk(mu);
+        notFull.wait(lk, [&] { return abort || queue.size() < QUEUED; });
+        if (abort) return false;
+        queue.push_back(std::move(s));
+        notEmpty.notify_one();
+        return true;
+    };
+    thread reader([&]() {
+        for (auto& f : files) {
+            const FileMeta& fm = *f.fm;
+            if (fm.isInline()) {
+                Segment s = { vector<char>(fm.inlineData.begin(), fm.inlineData.end()), true, true };
+                if (!push(std::move(s))) return;
+                continue;
+            }
+            long long left = fm.fileSize;
+            int block = 0;
+            do {
+                Segment s;
+                s.ok = f.dir->readBlocks(fm, block, segBlocks, s.data);
+                s.data.resize((size_t)min<long long>(left, (long long)segBlocks * blockSize), 0);
+                left -= s.data.size();
+                block += segBlocks;
+                s.last = left == 0;
+                if (!push(std::move(s))) return;
+            } while (left > 0);
+        }
+    });
+
+    long long bytes = 0, failed = 0;
+    bool ok = true;
+    for (auto& f : files) {
+        ok = sink->beginFile(f.path, f.fm->fileSize, f.fm->permissions, f.fm->modifiedAt);
+        bool readOk = true;
+        while (true) {
+            Segment s;
+            {
+                unique_lock<mutex> lk(mu);
+                notEmpty.wait(lk, [&] { return !queue.empty(); });
+                s = std::move(queue.front());
+                queue.pop_front();
+                notFull.notify_one();
+            }
+            readOk = readOk && s.ok;
+            if (ok) ok = sink->data(s.data.data(), s.data.size());
+            bytes += s.data.size();
+            if (s.last) break;
+        }
+        if (ok) ok = sink->endFile();
+        if (!readOk) {
+            FS_LOG(LOG_WARN, "export: read error in " << f.path << "; unreadable blocks written as zeros");
+            failed++;
+        }
+        if (!ok) break;
+    }
+    if (!ok) {
+        lock_guard<mutex> lk(mu);
+        abort = true;
+        notFull.notify_all();
+    }
+    reader.join();
+    ok = sink->finish() && ok;
+    Stats::add(Stats::LOGICAL_READ, bytes);
+    if (!ok) {
+        FS_FAIL(FS_IO_ERROR, "Export to " << target << " failed while writing");
+        return false;
+    }
+
+    long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    FS_LOG(LOG_INFO, "Exported " << files.size() << " file(s), " << dirs.size() << " director"
+           << (dirs.size() == 1 ? "y" : "ies") << ", " << bytes << " bytes to " << target << " in " << ms << " ms"
+           << (skipped ? ", " + to_string(skipped) + " unreadable file(s) skipped" : ""));
+    if (failed > 0) {
+        setStatus(FS_IO_ERROR);
+        return false;
+    }
+    return true;
+}
+
 bool FileSystem::cd(const std::string& name) {
     if (name == "..") {
         if (currentDir->parent) {
@@ -234,7 +1337,7 @@ bool FileSystem::cd(const std::string& name) {
     if (!d) return false;
     // require execute permission on the target directory
     if ((d->permissions & 1) == 0) {
-        cout << "[ERROR] Permission denied: cannot enter directory\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot enter directory");
         return false;
     }
     currentDir = d;
@@ -245,6 +1348,16 @@ void FileSystem::ls() {
     currentDir->listContents();
 }
 
+bool FileSystem::readdir(const std::string& path, DirCursor& cursor, size_t max, std::vector<DirEntry>& out) {
+    Directory* d = path.empty() ? currentDir : resolveDir(root.get(), currentDir, path);
+    if (!d) {
+        out.clear();
+        FS_FAIL(FS_NOT_FOUND, "Directory not found: " << path);
+        return false;
+    }
+    return d->readdir(cursor, max, out);
+}
+
 string FileSystem::pwd() {
     string path;
     Directory* cur = currentDir;
@@ -255,11 +1368,288 @@ string FileSystem::pwd() {
     return path;
 }
 
-bool FileSystem::createFile(const std::string& filename, int size) { return currentDir->createFile(filename, size); }
+bool FileSystem::createFile(const std::string& filename, long long size) { return currentDir->createFile(filename, size); }
 bool FileSystem::deleteFile(const std::string& filename) { return currentDir->deleteFile(filename); }
+bool FileSystem::cloneFile(const std::string& src, const std::string& dst) { return currentDir->cloneFile(src, dst); }
 bool FileSystem::writeFile(const std::string& filename, const std::string& content) { return currentDir->writeFile(filename, content); }
 string FileSystem::readFile(const std::string& filename) { return currentDir->readFile(filename); }
 void FileSystem::listFiles() { currentDir->listFiles(); }
 bool FileSystem::appendFile(const std::string& filename, const std::string& data) { return currentDir->appendFile(filename, data); }
-bool FileSystem::resizeFile(const std::string& filename, int newSize) { return currentDir->resizeFile(filename, newSize); }
+bool FileSystem::resizeFile(const std::string& filename, long long newSize) { return currentDir->resizeFile(filename, newSize); }
 void FileSystem::infoFile(const std::string& filename) { currentDir->infoFile(filename); }
+bool FileSystem::compress(const std::string& filename, bool on) { return currentDir->setCompression(filename, on); }
+
+void FileSystem::df() {
+    FsStats st = bm->statfs();
+    long long used = st.totalBlocks - st.freeBlocks;
+    cout << "Block size: " << st.blockSize << " bytes\n";
+    cout << "Blocks:     " << st.totalBlocks << " total, " << used << " used, " << st.freeBlocks << " free ("
+         << (st.totalBlocks ? used * 100 / st.totalBlocks : 0) << "% used)\n";
+    if (st.reservedBlocks) cout << "Reserved:   " << st.reservedBlocks << " free blocks held for buffered appends\n";
+    cout << "Bytes:      " << used * st.blockSize << " used, " << st.freeBlocks * st.blockSize << " free\n";
+    cout << "Host:       " << bm->hostBytes() << " bytes allocated to the image file";
+    if (bm->getDiscardedBlocks()) {
+        cout << " (" << bm->getDiscardedBlocks() << " blocks discarded in " << bm->getDiscardRanges() << " ranges)";
+    }
+    cout << "\n";
+    cout << "Files:      " << st.files << "\n";
+    cout << "Dirs:       " << st.dirs << "\n";
+    cout << "Groups:    ";
+    for (int f : st.groupFree) cout << " " << f;
+    cout << " (free blocks per group)\n";
+}
+
+bool FileSystem::du(const std::string& path) {
+    Directory* d = path.empty() ? currentDir : resolveDir(root.get(), currentDir, path);
+    if (!d) {
+        FS_FAIL(FS_NOT_FOUND, "Directory not found: " << path);
+        return false;
+    }
+    // Every line comes from the totals kept on the directory, not a walk
+    auto line = [](Directory* x) {
+        cout << setw(14) << x->treeBytes << " B " << setw(9) << x->treeFiles << " files " << setw(7) << x->treeDirs
+             << " dirs  " << pathOf(x) << "\n";
+    };
+    for (auto& sd : d->subdirs) line(sd.get());
+    line(d);
+    return true;
+}
+
+bool FileSystem::find(const std::string& path, const std::string& pattern) {
+    Directory* d = path.empty() ? currentDir : resolveDir(root.get(), currentDir, path);
+    if (!d) {
+        FS_FAIL(FS_NOT_FOUND, "Directory not found: " << path);
+        return false;
+    }
+    string glob = pattern.empty() ? "*" : pattern;
+    vector<vector<string>> hits(TreeWalk::workers());
+    TreeWalk::run(d, [&](Directory* dir, int w) {
+        string base = pathOf(dir) + "/";
+        for (auto& p : dir->files) {
+            if (fnmatch(glob.c_str(), p.first.c_str(), 0) == 0) hits[w].push_back(base + p.first);
+        }
+        for (auto& sd : dir->subdirs) {
+            if (fnmatch(glob.c_str(), sd->name.c_str(), 0) == 0) hits[w].push_back(base + sd->name + "/");
+        }
+    });
+    vector<string> all;
+    for (auto& h : hits) all.insert(all.end(), h.begin(), h.end());
+    sort(all.begin(), all.end());
+    for (auto& p : all) cout << p << "\n";
+    return true;
+}
+
+// Helper: bytes [from, to) of a file as the caller sees it: on-disk
+// blocks, then any buffered appends
+static bool readRange(Directory* d, const FileMeta& fm, long long from, long long to, vector<char>& out) {
+    out.clear();
+    if (fm.isInline()) {
+        out.assign(fm.inlineData.begin() + from, fm.inlineData.begin() + to);
+        return true;
+    }
+    bool ok = true;
+    long long blockSize = d->bm->getBlockSize();
+    long long disk = fm.fileSize - (long long)fm.pendingAppend.size();
+    if (from < disk) {
+        long long first = from / blockSize;
+        if (fm.compressed) first -= first % COMPRESS_CHUNK_BLOCKS;
+        long long end = min(to, disk);
+        long long last = (end + blockSize - 1) / blockSize;
+        vector<char> buf;
+        ok = d->readBlocks(fm, (int)first, (int)(last - first), buf);
+        buf.resize((size_t)((last - first) * blockSize), 0);
+        out.insert(out.end(), buf.begin() + (from - first * blockSize), buf.begin() + (end - first * blockSize));
+    }
+    if (to > disk) {
+        long long start = max(from, disk) - disk;
+        out.insert(out.end(), fm.pendingAppend.begin() + start, fm.pendingAppend.begin() + (to - disk));
+    }
+    return ok;
+}
+
+bool FileSystem::grep(const std::string& pattern, const std::string& path) {
+    auto start = chrono::steady_clock::now();
+    Directory* d = path.empty() ? currentDir : resolveDir(root.get(), currentDir, path);
+    if (!d) {
+        FS_FAIL(FS_NOT_FOUND, "Directory not found: " << path);
+        return false;
+    }
+    if (pattern.empty()) {
+        FS_FAIL(FS_INVALID, "Empty search pattern");
+        return false;
+    }
+
+    struct Target {
+        string path;
+        Directory* dir;
+        const FileMeta* fm;
+        int firstBlock;
+    };
+    int workers = TreeWalk::workers();
+    vector<vector<Target>> found(workers);
+    vector<long long> unreadable(workers, 0);
+    TreeWalk::run(d, [&](Directory* dir, int w) {
+        string base = pathOf(dir) + "/";
+        for (auto& p : dir->files) {
+            const FileMeta& fm = p.second;
+            if ((fm.permissions & 4) == 0) {
+                unreadable[w]++;
+                continue;
+            }
+            if (fm.fileSize < (long long)pattern.size()) continue;
+            int first = -1;
+            for (int b : fm.blocks) if (b >= 0) { first = b; break; }
+            Target t = { base + p.first, dir, &fm, first };
+            found[w].push_back(t);
+        }
+    });
+    vector<Target> targets;
+    for (auto& v : found) targets.insert(targets.end(), v.begin(), v.end());
+    // Physical order keeps the combined read stream moving forward
+    stable_sort(targets.begin(), targets.end(),
+                [](const Target& a, const Target& b) { return a.firstBlock < b.firstBlock; });
+
+    // Work items are ~1 MiB slices, so one large file still spreads over
+    // every thread. A slice owns the matches that start inside it and reads
+    // pattern.size() - 1 bytes past its end for those that cross over.
+    int blockSize = bm->getBlockSize();
+    long long slice = (long long)max(COMPRESS_CHUNK_BLOCKS, (1 << 20) / blockSize / COMPRESS_CHUNK_BLOCKS *
+                                     COMPRESS_CHUNK_BLOCKS) * blockSize;
+    struct Item {
+        size_t target;
+        long long from, to;
+        long long matches;
+        long long firstMatch;
+        bool ok;
+    };
+    vector<Item> items;
+    for (size_t t = 0; t < targets.size(); t++) {
+        long long size = targets[t].fm->fileSize;
+        for (long long from = 0; from < size; from += slice) {
+            Item it = { t, from, min(from + slice, size), 0, -1, true };
+            items.push_back(it);
+        }
+    }
+
+    atomic<size_t> next(0);
+    atomic<long long> scanned(0);
+    vector<thread> pool;
+    int threads = (int)min<size_t>(workers, max<size_t>(1, items.size()));
+    for (int w = 0; w < threads; w++) {
+        pool.emplace_back([&]() {
+            vector<char> buf;
+            for (size_t i = next++; i < items.size(); i = next++) {
+                Item& it = items[i];
+                const Target& t = targets[it.target];
+                long long end = min(it.to + (long long)pattern.size() - 1, t.fm->fileSize);
+                it.ok = readRange(t.dir, *t.fm, it.from, end, buf);
+                scanned += it.to - it.from;
+                // Only matches starting before it.to belong to this slice
+                size_t limit = (size_t)(it.to - it.from);
+                for (size_t pos = Search::find(buf.data(), buf.size(), pattern); pos != Search::npos && pos < limit;
+                     pos = Search::find(buf.data(), buf.size(), pattern, pos + 1)) {
+                    if (it.firstMatch < 0) it.firstMatch = it.from + (long long)pos;
+                    it.matches++;
+                }
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+
+    // Items of a file are consecutive and in offset order
+    struct Hit {
+        string path;
+        long long matches;
+        long long firstMatch;
+    };
+    vector<Hit> hits;
+    long long total = 0, failed = 0;
+    for (size_t i = 0; i < items.size();) {
+        size_t t = items[i].target;
+        Hit h = { targets[t].path, 0, -1 };
+        bool ok = true;
+        for (; i < items.size() && items[i].target == t; i++) {
+            if (h.firstMatch < 0) h.firstMatch = items[i].firstMatch;
+            h.matches += items[i].matches;
+            ok = ok && items[i].ok;
+        }
+        if (!ok) {
+            FS_LOG(LOG_WARN, "grep: read error in " << h.path);
+            failed++;
+        }
+        if (h.matches > 0) hits.push_back(h);
+        total += h.matches;
+    }
+    sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) { return a.path < b.path; });
+    for (auto& h : hits) {
+        cout << h.path << ": " << h.matches << " match" << (h.matches == 1 ? "" : "es") << ", first at byte "
+             << h.firstMatch << "\n";
+    }
+    Stats::add(Stats::LOGICAL_READ, scanned.load());
+
+    long long skipped = 0;
+    for (long long u : unreadable) skipped += u;
+    long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    FS_LOG(LOG_INFO, "grep: " << total << " match(es) in " << hits.size() << " of " << targets.size() << " file(s), "
+           << scanned.load() << " bytes scanned in " << ms << " ms (" << Search::backend() << ")"
+           << (skipped ? ", " + to_string(skipped) + " unreadable file(s) skipped" : ""));
+    if (failed > 0) {
+        setStatus(FS_IO_ERROR);
+        return false;
+    }
+    return true;
+}
+
+void FileSystem::stats() {
+    Stats::print(cout);
+}
+
+void FileSystem::resetStats() {
+    Stats::reset();
+    FS_LOG(LOG_INFO, "Statistics reset");
+}
+
+void FileSystem::dedupReport() {
+    // Logical = data block slots across all files; physical = distinct blocks behind them
+    long long logical = 0;
+    std::set<int> physical;
+    std::function<void(Directory*)> walk = [&](Directory* d) {
+        for (auto& p : d->files) {
+            for (int b : p.second.blocks) {
+                if (b < 0) continue;
+                logical++;
+                physical.insert(b);
+            }
+        }
+        for (auto& sd : d->subdirs) walk(sd.get());
+    };
+    walk(root.get());
+
+    int blockSize = bm->getBlockSize();
+    long long saved = logical - (long long)physical.size();
+    cout << "Data blocks: " << logical << " logical, " << physical.size() << " physical";
+    if (!physical.empty()) cout << " (dedup ratio " << (double)logical / physical.size() << ":1)";
+    cout << "\nSpace saved: " << saved << " blocks (" << saved * blockSize << " bytes)\n";
+
+    DedupIndex* dd = bm->dedup();
+    if (!dd) {
+        cout << "Dedup is off (mount with --dedup to share identical blocks)\n";
+        return;
+    }
+    DedupStats st = dd->stats();
+    long long written = st.logicalWrites - st.sharedWrites - st.zeroWrites;
+    cout << "Block writes since mount: " << st.logicalWrites << " requested, " << written << " written, "
+         << st.sharedWrites << " shared, " << st.zeroWrites << " zero (now holes)\n";
+    if (st.logicalWrites > 0) {
+        cout << "Write amplification: " << (double)written / st.logicalWrites << " ("
+             << (st.logicalWrites - written) * blockSize << " bytes of writes avoided)\n";
+    }
+    cout << "Fingerprints: " << st.indexEntries << ", hash collisions: " << st.collisions << "\n";
+}
+
+bool FileSystem::fsync(const std::string& filename) {
+    if (!filename.empty()) return currentDir->fsyncFile(filename);
+    root->fsyncTree();
+    FS_LOG(LOG_INFO, "All append buffers synced");
+    return true;
+}
@@ -1,39 +1,89 @@
 #ifndef FILESYSTEM_HPP
 #define FILESYSTEM_HPP
 
-#include "BlockManager.hpp"
-#include "Directory.hpp"
+#include "blockmanager.hpp"
+#include "directory.hpp"
 #include <memory>
 #include <string>
+#include <vector>
 
 class FileSystem {
 public:
     BlockManager* bm;
     std::unique_ptr<Directory> root;
     Directory* currentDir;
+    ChangeFeed changes;           // Every mutation below root, once it has succeeded
 
     FileSystem(BlockManager* blockManager);
     void load();
-    void save();
+    bool save();                  // Flushes append buffers, then persists the tree
+
+    // Batches defer the tree save each mutation normally does until the
+    // outermost commitBatch, so a run of commands costs one tree write.
+    // A crash inside a batch loses its namespace changes; fsck frees the
+    // blocks they had allocated. Blocks the batch releases stay allocated
+    // until the tree is written, so the saved tree never names a reused
+    // block. commitBatch returns false if the deferred save failed; the tree
+    // stays dirty and the released blocks queued so the next save retries it.
+    void beginBatch();
+    bool commitBatch();
+
+    // Change notifications: cb sees each create, write, append, resize,
+    // delete, chmod, mkdir, rmdir and rename after it succeeds, on the
+    // thread that made it (see ChangeFeed)
+    int subscribe(ChangeFeed::Callback cb);
+    bool unsubscribe(int id);
 
     // Directory commands
     bool mkdir(const std::string& name);
     bool cd(const std::string& name);
     void ls();
+    // Paged listing of path (empty: current directory) with each entry's
+    // metadata; call again with the same cursor until cursor.done
+    bool readdir(const std::string& path, DirCursor& cursor, size_t max, std::vector<DirEntry>& out);
     std::string pwd();
     bool removeDirectory(const std::string& name);
+    bool rename(const std::string& srcPath, const std::string& dstPath); // Files or directories, across directories
     bool chmodEntry(int mode, const std::string& name);
     bool checkMeta(bool repair);
+    void df();                    // Disk usage from the cached superblock counters
+    bool du(const std::string& path);  // Subtree totals of path and its subdirectories, O(1) each
+    bool find(const std::string& path, const std::string& pattern); // Glob over names below path, walked in parallel
+    bool grep(const std::string& pattern, const std::string& path); // Files below path containing pattern
+    void stats();                 // I/O counters and per-operation latency since mount or reset
+    void resetStats();
+    void dedupReport();           // Sharing ratio over the tree, plus dedup write counters
+    void fragReport();            // Extents per file and free-space fragmentation
+    bool defrag(int maxMBps);     // Move fragmented files into contiguous runs; 0 = unthrottled
+    // Copy a host directory tree into destPath (empty: current directory).
+    // Space is reserved in one pass, a reader pool streams the data, and the
+    // tree and bitmap are written once at the end.
+    bool importTree(const std::string& hostDir, const std::string& destPath);
+    // Stream srcPath (empty: the whole tree) to a .tar archive or a host
+    // directory, reading files in physical block order
+    bool exportTree(const std::string& target, const std::string& srcPath);
+
+    // Snapshots: point-in-time copies of the tree that share every data
+    // block; later writes to a shared block copy it first
+    bool createSnapshot(const std::string& name);
+    bool deleteSnapshot(const std::string& name);
+    void listSnapshots();
+    std::unique_ptr<Directory> openSnapshot(const std::string& name); // Read-only use; null if missing
+    bool snapshotLs(const std::string& name, const std::string& path);
+    bool snapshotCat(const std::string& name, const std::string& path);
 
     // File commands delegate to currentDir
-    bool createFile(const std::string& filename, int size);
+    bool createFile(const std::string& filename, long long size);
     bool deleteFile(const std::string& filename);
+    bool cloneFile(const std::string& src, const std::string& dst);
     bool writeFile(const std::string& filename, const std::string& content);
     std::string readFile(const std::string& filename);
     void listFiles();
     bool appendFile(const std::string& filename, const std::string& data);
-    bool resizeFile(const std::string& filename, int newSize);
+    bool resizeFile(const std::string& filename, long long newSize);
     void infoFile(const std::string& filename);
+    bool compress(const std::string& filename, bool on);
+    bool fsync(const std::string& filename); // Empty name → every file
 };
 
 #endif
@@ -0,0 +1,297 @@
+#include "asyncfs.hpp"
+
+#ifdef VIRTFS_HAVE_COROUTINES
+
+#include "log.hpp"
+#include "stats.hpp"
+#include <cstring>
+using namespace std;
+
+// ---------------------------------------------------------------------------
+// Executor / AsyncMutex
+// ---------------------------------------------------------------------------
+
+Executor::Executor(int numThreads) : stopping(false) {
+    if (numThreads < 1) numThreads = 1;
+    for (int i = 0; i < numThreads; i++) threads.emplace_back(&Executor::run, this);
+}
+
+Executor::~Executor() {
+    {
+        lock_guard<mutex> lk(mu);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+void Executor::post(coroutine_handle<> h) {
+    {
+        lock_guard<mutex> lk(mu);
+        ready.push_back(h);
+    }
+    cv.notify_one();
+}
+
+void Executor::run() {
+    while (true) {
+        coroutine_handle<> h;
+        {
+            unique_lock<mutex> lk(mu);
+            cv.wait(lk, [this] { return stopping || !ready.empty(); });
+            if (ready.empty()) return;
+            h = ready.front();
+            ready.pop_front();
+        }
+        h.resume();
+    }
+}
+
+bool AsyncMutex::LockAwaiter::await_suspend(coroutine_handle<> h) {
+    lock_guard<mutex> lk(m.mu);
+    if (!m.locked) {
+        m.locked = true;
+        return false;  // acquired, continue without suspending
+    }
+    m.waiters.push_back(h);
+    return true;
+}
+
+void AsyncMutex::unlock(Executor& ex) {
+    coroutine_handle<> next;
+    {
+        lock_guard<mutex> lk(mu);
+        if (waiters.empty()) {
+            locked = false;
+            return;
+        }
+        next = waiters.front();
+        waiters.pop_front();
+    }
+    ex.post(next);
+}
+
+// ---------------------------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------------------------
+
+// Awaitable group of block reads/writes submitted together; the awaiting
+// coroutine is resumed on the executor once the last one completes.
+class AsyncFileSystem::BlockBatch {
+private:
+    struct Op {
+        bool write;
+        int index;
+        vector<char>* buffer;
+    };
+
+    AsyncFileSystem& afs;
+    vector<Op> ops;
+    atomic<int> remaining;
+    atomic<bool> ok;
+    coroutine_handle<> waiter;
+
+    void complete(bool success) {
+        if (!success) ok = false;
+        if (--remaining == 0) afs.ex.post(waiter);
+    }
+
+public:
+    explicit BlockBatch(AsyncFileSystem& afs_) : afs(afs_), remaining(0), ok(true) {}
+
+    void read(int index, vector<char>& buffer) { ops.push_back(Op{ false, index, &buffer }); }
+    void write(int index, vector<char>& buffer) { ops.push_back(Op{ true, index, &buffer }); }
+
+    bool await_ready() const noexcept { return ops.empty(); }
+
+    bool await_suspend(coroutine_handle<> h) {
+        waiter = h;
+        // One extra count held by this function so a fast completion cannot
+        // resume (and destroy) the batch while requests are still being issued
+        remaining = (int)ops.size() + 1;
+        for (const Op& op : ops) {
+            auto done = [this](bool success) { complete(success); };
+            if (op.write) afs.bm.submitWrite(op.index, *op.buffer, done);
+            else afs.bm.submitRead(op.index, *op.buffer, done);
+        }
+        return --remaining != 0;  // false → every request already finished
+    }
+
+    bool await_resume() const noexcept { return ok; }
+};
+
+// Releases a per-file AsyncMutex when the coroutine leaves scope
+class AsyncFileSystem::FileGuard {
+private:
+    AsyncMutex& m;
+    Executor& ex;
+
+public:
+    FileGuard(AsyncMutex& m_, Executor& ex_) : m(m_), ex(ex_) {}
+    ~FileGuard() { m.unlock(ex); }
+};
+
+AsyncFileSystem::AsyncFileSystem(FileSystem& fs_, int threads)
+    : fs(fs_), bm(*fs_.bm), ex(threads) {
+    fs.beginBatch();
+}
+
+AsyncFileSystem::~AsyncFileSystem() {
+    lock_guard<mutex> lk(metaMu);
+    fs.commitBatch();
+}
+
+AsyncMutex& AsyncFileSystem::fileLock(Directory* dir, const string& filename) {
+    lock_guard<mutex> lk(metaMu);
+    unique_ptr<AsyncMutex>& m = fileLocks[make_pair(dir, filename)];
+    if (!m) m.reset(new AsyncMutex());
+    return *m;
+}
+
+bool AsyncFileSystem::flush() {
+    lock_guard<mutex> lk(metaMu);
+    bool saved = fs.commitBatch();
+    fs.beginBatch();
+    return saved;
+}
+
+// ---------------------------------------------------------------------------
+// File operations. Directory does the checks, metadata and allocation under
+// metaMu without suspending; block data moves through BlockBatch with the
+// lock released. Operations on the same file are ordered by its AsyncMutex.
+// ---------------------------------------------------------------------------
+
+Task<bool> AsyncFileSystem::createFile(string filename, long long size) {
+    // Only the index block is written, and the tree save waits for flush()
+    lock_guard<mutex> lk(metaMu);
+    co_return fs.currentDir->createFile(filename, size);
+}
+
+Task<bool> AsyncFileSystem::writeFile(string filename, string content) {
+    Directory* dir = fs.currentDir;
+    AsyncMutex& fileMutex = fileLock(dir, filename);
+    co_await fileMutex.lock();
+    FileGuard guard(fileMutex, ex);
+
+    WritePlan plan;
+    {
+        lock_guard<mutex> lk(metaMu);
+        bool ok = dir->prepareWrite(filename, content, plan);
+        if (!ok || plan.blocks.empty()) co_return ok;
+    }
+
+    int blockSize = bm.getBlockSize();
+    vector<vector<char>> buffers(plan.blocks.size(), vector<char>(blockSize, 0));
+    BlockBatch batch(*this);
+    for (size_t i = 0; i < plan.blocks.size(); i++) {
+        long long from = (long long)i * blockSize;
+        long long n = min<long long>(blockSize, (long long)content.size() - from);
+        if (n > 0) memcpy(buffers[i].data(), content.data() + from, (size_t)n);
+        batch.write(plan.blocks[i], buffers[i]);
+    }
+    bool ok = co_await batch;
+
+    lock_guard<mutex> lk(metaMu);
+    co_return dir->finishWrite(plan, buffers, ok);
+}
+
+Task<bool> AsyncFileSystem::appendFile(string filename, string data) {
+    Directory* dir = fs.currentDir;
+    AsyncMutex& fileMutex = fileLock(dir, filename);
+    co_await fileMutex.lock();
+    FileGuard guard(fileMutex, ex);
+
+    WritePlan plan;
+    {
+        lock_guard<mutex> lk(metaMu);
+        bool ok = dir->prepareAppend(filename, data, plan);
+        if (!ok || plan.blocks.empty()) co_return ok;
+    }
+
+    int blockSize = bm.getBlockSize();
+    vector<vector<char>> buffers(plan.blocks.size(), vector<char>(blockSize, 0));
+    bool ok = true;
+    if (plan.tailFrom != -1) {
+        // Read-modify-write of the partially filled tail block
+        BlockBatch readBatch(*this);
+        readBatch.read(plan.tailFrom, buffers[0]);
+        ok = co_await readBatch;
+    }
+    if (ok) {
+        BlockBatch batch(*this);
+        size_t dataOffset = 0;
+        int offsetInBlock = plan.offset;
+        for (size_t i = 0; i < plan.blocks.size(); i++) {
+            size_t n = min(data.size() - dataOffset, (size_t)(blockSize - offsetInBlock));
+            memcpy(buffers[i].data() + offsetInBlock, data.data() + dataOffset, n);
+            dataOffset += n;
+            offsetInBlock = 0;
+            batch.write(plan.blocks[i], buffers[i]);
+        }
+        ok = co_await batch;
+    }
+
+    lock_guard<mutex> lk(metaMu);
+    co_return dir->finishWrite(plan, buffers, ok);
+}
+
+Task<string> AsyncFileSystem::readFile(string filename) {
+    // Held until the data is copied out, so a write or append to the file
+    // cannot change its blocks under the read
+    Directory* dir = fs.currentDir;
+    AsyncMutex& fileMutex = fileLock(dir, filename);
+    co_await fileMutex.lock();
+    FileGuard guard(fileMutex, ex);
+
+    int blockSize = bm.getBlockSize();
+    vector<int> blocks;
+    long long diskSize;
+    string pending;
+    {
+        lock_guard<mutex> lk(metaMu);
+        auto it = dir->files.find(filename);
+        if (it == dir->files.end()) {
+            FS_FAIL(FS_NOT_FOUND, "File not found!");
+            co_return string();
+        }
+        FileMeta& fm = it->second;
+        if ((fm.permissions & 4) == 0) {
+            FS_FAIL(FS_PERMISSION, "Permission denied: cannot read file");
+            co_return string();
+        }
+        if (fm.isInline()) {
+            Stats::add(Stats::LOGICAL_READ, (long long)fm.inlineData.size());
+            co_return fm.inlineData;
+        }
+        if (fm.compressed) co_return dir->readFile(filename);
+        // Buffered appends are answered from memory, as Directory::readFile does
+        pending = fm.pendingAppend;
+        diskSize = fm.fileSize - (long long)pending.size();
+        int needed = (int)min<long long>(fm.blocks.size(), (diskSize + blockSize - 1) / blockSize);
+        blocks.assign(fm.blocks.begin(), fm.blocks.begin() + needed);
+    }
+
+    vector<vector<char>> buffers(blocks.size(), vector<char>(blockSize, 0));
+    BlockBatch batch(*this);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (blocks[i] != HOLE_BLOCK) batch.read(blocks[i], buffers[i]);
+    }
+    if (!co_await batch) {
+        FS_FAIL(FS_IO_ERROR, "Failed to read data blocks of " << filename);
+        co_return string();
+    }
+
+    // Holes stay zero-filled in their buffers
+    string result;
+    long long bytesLeft = diskSize;
+    for (size_t i = 0; i < buffers.size() && bytesLeft > 0; i++) {
+        int n = (int)min<long long>(bytesLeft, blockSize);
+        result.append(buffers[i].begin(), buffers[i].begin() + n);
+        bytesLeft -= n;
+    }
+    result += pending;
+    Stats::add(Stats::LOGICAL_READ, (long long)result.size());
+    co_return result;
+}
+
+#endif // VIRTFS_HAVE_COROUTINES
@@ -0,0 +1,168 @@
+#ifndef ASYNC_FS_HPP
+#define ASYNC_FS_HPP
+
+// co_await-able FileSystem operations (C++20 only; compiles to nothing in
+// older language modes so the rest of the tree stays C++11).
+#if defined(__has_include)
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define VIRTFS_HAVE_COROUTINES 1
+#endif
+#endif
+
+#ifdef VIRTFS_HAVE_COROUTINES
+
+#include "FileSystem.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Lazily started coroutine returning T; resumes its awaiter when done.
+template <typename T>
+class Task {
+public:
+    struct promise_type {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                std::coroutine_handle<> c = h.promise().continuation;
+                return c ? c : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_value(T v) { value = std::move(v); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    Task(Task&& other) noexcept : h(std::exchange(other.h, {})) {}
+    Task(const Task&) = delete;
+    ~Task() { if (h) h.destroy(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        h.promise().continuation = awaiter;
+        return h;
+    }
+    T await_resume() {
+        if (h.promise().error) std::rethrow_exception(h.promise().error);
+        return std::move(*h.promise().value);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h_) : h(h_) {}
+    std::coroutine_handle<promise_type> h;
+};
+
+// Eagerly started, self-destroying coroutine for fire-and-forget work.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Block the calling thread until the task finishes (not from an Executor thread).
+template <typename T>
+T syncWait(Task<T> task) {
+    std::promise<T> result;
+    std::future<T> f = result.get_future();
+    [](Task<T> t, std::promise<T>& p) -> Detached {
+        try { p.set_value(co_await t); }
+        catch (...) { p.set_exception(std::current_exception()); }
+    }(std::move(task), result);
+    return f.get();
+}
+
+// Small thread pool that resumes coroutines. I/O completions are handed here
+// so engine threads never run (or block in) filesystem code.
+class Executor {
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::coroutine_handle<>> ready;
+    std::mutex mu;
+    std::condition_variable cv;
+    bool stopping;
+
+    void run();
+
+public:
+    explicit Executor(int numThreads);
+    ~Executor();
+    void post(std::coroutine_handle<> h);
+};
+
+// FIFO mutex whose lock() suspends instead of blocking the thread.
+class AsyncMutex {
+private:
+    std::mutex mu;
+    bool locked = false;
+    std::deque<std::coroutine_handle<>> waiters;
+
+public:
+    struct LockAwaiter {
+        AsyncMutex& m;
+        bool await_ready() noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        void await_resume() noexcept {}
+    };
+    LockAwaiter lock() { return LockAwaiter{ *this }; }
+    void unlock(Executor& ex);  // Hands ownership to the next waiter, if any
+};
+
+class AsyncFileSystem {
+public:
+    // Operations act on fs.currentDir at call time. While coroutines are in
+    // flight the wrapped FileSystem must only be used through this object.
+    // The FileSystem is kept inside a batch, so tree saves wait for flush().
+    AsyncFileSystem(FileSystem& fs, int threads = 2);
+    ~AsyncFileSystem();
+
+    Task<bool> createFile(std::string filename, long long size);
+    Task<bool> writeFile(std::string filename, std::string content);
+    Task<bool> appendFile(std::string filename, std::string data);
+    Task<std::string> readFile(std::string filename);
+
+    // Persist the directory tree once for all operations since the last
+    // flush; false if it could not be written
+    bool flush();
+
+    Executor& executor() { return ex; }
+
+private:
+    class BlockBatch;
+    class FileGuard;
+
+    FileSystem& fs;
+    BlockManager& bm;
+    Executor ex;
+    std::mutex metaMu;   // Guards the directory tree and block bitmap
+    std::map<std::pair<Directory*, std::string>, std::unique_ptr<AsyncMutex>> fileLocks;
+
+    AsyncMutex& fileLock(Directory* dir, const std::string& filename);
+};
+
+#endif // VIRTFS_HAVE_COROUTINES
+
+#endif
@@ -0,0 +1,332 @@
+#include "asyncio.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define VIRTFS_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+using namespace std;
+
+// Helper: transfer the whole range, retrying short reads/writes
+static bool preadFull(int fd, char* buf, int len, long long offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n; len -= (int)n; offset += n;
+    }
+    return true;
+}
+
+static bool pwriteFull(int fd, const char* buf, int len, long long offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n; len -= (int)n; offset += n;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Portable fallback: a fixed pool of workers doing pread/pwrite. The number of
+// workers is the queue depth.
+// ---------------------------------------------------------------------------
+class ThreadPoolEngine : public AsyncIOEngine {
+private:
+    struct Request {
+        bool write;
+        long long offset;
+        char* buf;
+        int len;
+        Callback done;
+    };
+
+    int fd;
+    int depth;
+    vector<thread> workers;
+    deque<Request> queue;
+    mutex mu;
+    condition_variable workReady;
+    condition_variable idle;
+    int pending;   // queued + running
+    bool stopping;
+
+    void workerLoop() {
+        while (true) {
+            Request r;
+            {
+                unique_lock<mutex> lk(mu);
+                workReady.wait(lk, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                r = std::move(queue.front());
+                queue.pop_front();
+            }
+            bool ok = r.write ? pwriteFull(fd, r.buf, r.len, r.offset)
+                              : preadFull(fd, r.buf, r.len, r.offset);
+            if (r.done) r.done(ok);
+            lock_guard<mutex> lk(mu);
+            if (--pending == 0) idle.notify_all();
+        }
+    }
+
+    void submit(Request r) {
+        {
+            lock_guard<mutex> lk(mu);
+            queue.push_back(std::move(r));
+            pending++;
+        }
+        workReady.notify_one();
+    }
+
+public:
+    ThreadPoolEngine(int fd_, int depth_) : fd(fd_), depth(depth_), pending(0), stopping(false) {
+        for (int i = 0; i < depth; i++) workers.emplace_back(&ThreadPoolEngine::workerLoop, this);
+    }
+
+    ~ThreadPoolEngine() {
+        drain();
+        {
+            lock_guard<mutex> lk(mu);
+            stopping = true;
+        }
+        workReady.notify_all();
+        for (auto& t : workers) t.join();
+        close(fd);
+    }
+
+    void submitRead(long long offset, char* buf, int len, Callback done) {
+        Request r = { false, offset, buf, len, done };
+        submit(std::move(r));
+    }
+
+    void submitWrite(long long offset, const char* buf, int len, Callback done) {
+        Request r = { true, offset, const_cast<char*>(buf), len, done };
+        submit(std::move(r));
+    }
+
+    void drain() {
+        unique_lock<mutex> lk(mu);
+        idle.wait(lk, [this] { return pending == 0; });
+    }
+
+    const char* name() const { return "threadpool"; }
+    int queueDepth() const { return depth; }
+};
+
+#ifdef VIRTFS_HAVE_IO_URING
+// ---------------------------------------------------------------------------
+// io_uring backend driven through the raw syscalls (no liburing needed).
+// Submitters fill SQEs under a mutex; a reaper thread blocks in
+// io_uring_enter(GETEVENTS) and runs the callbacks.
+// ---------------------------------------------------------------------------
+class UringEngine : public AsyncIOEngine {
+private:
+    struct Request {
+        struct iovec iov;
+        Callback done;
+    };
+
+    int fd;
+    int ringFd;
+    int depth;
+
+    void* sqRing;
+    size_t sqRingLen;
+    void* cqRing;
+    size_t cqRingLen;
+    struct io_uring_sqe* sqes;
+    size_t sqesLen;
+
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    mutex mu;
+    condition_variable slotFree;
+    condition_variable idle;
+    int inFlight;   // SQEs owned by the kernel (bounded by depth)
+    int pending;    // submitted but callback not yet finished
+    thread reaper;
+
+    static int enter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    // Queue one SQE and hand it to the kernel. Caller holds mu.
+    void pushSqe(int opcode, Request* r, long long offset) {
+        unsigned tail = *sqTail;
+        unsigned idx = tail & *sqMask;
+        struct io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = (unsigned char)opcode;
+        if (r) {
+            sqe->fd = fd;
+            sqe->addr = (unsigned long long)(uintptr_t)&r->iov;
+            sqe->len = 1;
+            sqe->off = (unsigned long long)offset;
+        }
+        sqe->user_data = (unsigned long long)(uintptr_t)r;
+        sqArray[idx] = idx;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        while (enter(ringFd, 1, 0, 0) < 0 && errno == EINTR) {}
+    }
+
+    void submit(int opcode, long long offset, char* buf, int len, Callback done) {
+        Request* r = new Request;
+        r->iov.iov_base = buf;
+        r->iov.iov_len = (size_t)len;
+        r->done = done;
+        unique_lock<mutex> lk(mu);
+        slotFree.wait(lk, [this] { return inFlight < depth; });
+        inFlight++;
+        pending++;
+        pushSqe(opcode, r, offset);
+    }
+
+    void reapLoop() {
+        while (true) {
+            if (enter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return;
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            bool stop = false;
+            for (; head != tail; head++) {
+                struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+                Request* r = (Request*)(uintptr_t)cqe->user_data;
+                int res = cqe->res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                if (!r) { stop = true; continue; }  // shutdown NOP
+                bool ok = res == (int)r->iov.iov_len;
+                // Release the slot before the callback so it may submit more I/O
+                {
+                    lock_guard<mutex> lk(mu);
+                    inFlight--;
+                }
+                slotFree.notify_one();
+                if (r->done) r->done(ok);
+                delete r;
+                lock_guard<mutex> lk(mu);
+                if (--pending == 0) idle.notify_all();
+            }
+            if (stop) return;
+        }
+    }
+
+    UringEngine(int fd_, int ringFd_, int depth_) :
+        fd(fd_), ringFd(ringFd_), depth(depth_),
+        sqRing(MAP_FAILED), sqRingLen(0), cqRing(MAP_FAILED), cqRingLen(0),
+        sqes((struct io_uring_sqe*)MAP_FAILED), sqesLen(0), inFlight(0), pending(0) {}
+
+public:
+    static UringEngine* create(int fd, int depth) {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        // One extra entry for the shutdown NOP
+        int ringFd = (int)syscall(__NR_io_uring_setup, (unsigned)depth + 1, &p);
+        if (ringFd < 0) return nullptr;
+
+        UringEngine* e = new UringEngine(fd, ringFd, depth);
+        e->sqRingLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        e->cqRingLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) e->sqRingLen = e->cqRingLen = max(e->sqRingLen, e->cqRingLen);
+
+        e->sqRing = mmap(nullptr, e->sqRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (e->sqRing != MAP_FAILED) {
+            e->cqRing = single ? e->sqRing
+                               : mmap(nullptr, e->cqRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        }
+        e->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+        if (e->cqRing != MAP_FAILED) {
+            e->sqes = (struct io_uring_sqe*)mmap(nullptr, e->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        }
+        if (e->sqes == MAP_FAILED) {
+            e->fd = -1;  // caller still owns fd on failure
+            delete e;
+            return nullptr;
+        }
+
+        char* sq = (char*)e->sqRing;
+        char* cq = (char*)e->cqRing;
+        e->sqTail = (unsigned*)(sq + p.sq_off.tail);
+        e->sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+        e->sqArray = (unsigned*)(sq + p.sq_off.array);
+        e->cqHead = (unsigned*)(cq + p.cq_off.head);
+        e->cqTail = (unsigned*)(cq + p.cq_off.tail);
+        e->cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+        e->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+        e->reaper = thread(&UringEngine::reapLoop, e);
+        return e;
+    }
+
+    ~UringEngine() {
+        if (reaper.joinable()) {
+            drain();
+            {
+                lock_guard<mutex> lk(mu);
+                pushSqe(IORING_OP_NOP, nullptr, 0);
+            }
+            reaper.join();
+        }
+        if (sqes != MAP_FAILED) munmap(sqes, sqesLen);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingLen);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingLen);
+        close(ringFd);
+        if (fd >= 0) close(fd);
+    }
+
+    void submitRead(long long offset, char* buf, int len, Callback done) {
+        submit(IORING_OP_READV, offset, buf, len, done);
+    }
+
+    void submitWrite(long long offset, const char* buf, int len, Callback done) {
+        submit(IORING_OP_WRITEV, offset, const_cast<char*>(buf), len, done);
+    }
+
+    void drain() {
+        unique_lock<mutex> lk(mu);
+        idle.wait(lk, [this] { return pending == 0; });
+    }
+
+    const char* name() const { return "io_uring"; }
+    int queueDepth() const { return depth; }
+};
+#endif
+
+unique_ptr<AsyncIOEngine> AsyncIOEngine::create(const string& path, int queueDepth, Backend backend) {
+    if (queueDepth < 1) queueDepth = 1;
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) return unique_ptr<AsyncIOEngine>();
+
+#ifdef VIRTFS_HAVE_IO_URING
+    if (backend != THREAD_POOL) {
+        UringEngine* e = UringEngine::create(fd, queueDepth);
+        if (e) return unique_ptr<AsyncIOEngine>(e);
+    }
+#endif
+    if (backend == IO_URING) {
+        close(fd);
+        return unique_ptr<AsyncIOEngine>();
+    }
+    return unique_ptr<AsyncIOEngine>(new ThreadPoolEngine(fd, queueDepth));
+}
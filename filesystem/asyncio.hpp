@@ -0,0 +1,36 @@
+#ifndef ASYNC_IO_HPP
+#define ASYNC_IO_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+
+// Asynchronous positional I/O against the disk image.
+// Requests are submitted without blocking (unless the queue is full) and
+// complete out of order; the callback runs on an engine-owned thread with
+// ok == true if the whole range was transferred. Callbacks may submit
+// further requests.
+class AsyncIOEngine {
+public:
+    typedef std::function<void(bool ok)> Callback;
+
+    enum Backend {
+        AUTO,        // io_uring if the kernel allows it, else thread pool
+        IO_URING,
+        THREAD_POOL
+    };
+
+    virtual ~AsyncIOEngine() {}
+
+    // Buffers must stay valid until the callback has run.
+    virtual void submitRead(long long offset, char* buf, int len, Callback done) = 0;
+    virtual void submitWrite(long long offset, const char* buf, int len, Callback done) = 0;
+    virtual void drain() = 0;                  // Wait until nothing is in flight
+    virtual const char* name() const = 0;
+    virtual int queueDepth() const = 0;
+
+    // Opens path for read/write; returns nullptr if neither backend can be set up.
+    static std::unique_ptr<AsyncIOEngine> create(const std::string& path, int queueDepth, Backend backend = AUTO);
+};
+
+#endif
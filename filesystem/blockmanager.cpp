@@ -1,6 +1,20 @@
 #include "blockmanager.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
 #include <fstream>
-#include <iostream>
+#include <sstream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 using namespace std;
 
 BlockManager::BlockManager(
@@ -9,13 +23,110 @@ BlockManager::BlockManager(
     int blockSize,
     int totalBlocks
 ) : diskPath(diskPath), metaPath(metaPath),
-    blockSize(blockSize), totalBlocks(totalBlocks)
+    blockSize(blockSize), totalBlocks(totalBlocks),
+    freeTotal(0), reservedTotal(0), fileCount(0), dirCount(1), inlineLimit(DEFAULT_INLINE_LIMIT), compressDefault(false),
+    discardOn(false), discardedBlocks(0), discardRanges(0), blocksWritten(0), legacyLayout(false), listedTree(false)
 {
-    freeBlockBitmap.resize(totalBlocks, true);
-    freeBlockBitmap[0] = false;  // Block 0 is reserved for directory listing
+    setupGroups();
+}
+
+bool BlockManager::validGeometry(int blockSize, long long totalBlocks, string& why) {
+    if (blockSize < MIN_BLOCK_SIZE || blockSize > MAX_BLOCK_SIZE || (blockSize & (blockSize - 1)) != 0) {
+        why = "block size must be a power of two between " + to_string(MIN_BLOCK_SIZE) +
+              " and " + to_string(MAX_BLOCK_SIZE);
+        return false;
+    }
+    // Block numbers are 32-bit; byte offsets and sizes are 64-bit
+    if (totalBlocks < 2 || totalBlocks > INT32_MAX) {
+        why = "block count must be between 2 and " + to_string(INT32_MAX) + " (use a larger block size)";
+        return false;
+    }
+    return true;
+}
+
+void BlockManager::setupGroups() {
+    groups.clear();
+    // One group per hardware thread, but never fewer than 32 blocks per group
+    int cpus = (int)thread::hardware_concurrency();
+    int numGroups = max(1, min(max(cpus, 1), totalBlocks / 32));
+    groupSize = (int)(((long long)totalBlocks + numGroups - 1) / numGroups);
+    for (int start = 0; start < totalBlocks; start += groupSize) {
+        unique_ptr<AllocGroup> g(new AllocGroup());
+        g->start = start;
+        g->bitmap.assign(min(groupSize, totalBlocks - start), true);
+        g->freeCount = (int)g->bitmap.size();
+        g->cursor = 0;
+        groups.push_back(std::move(g));
+        if (totalBlocks - start <= groupSize) break;  // avoid int overflow near INT32_MAX
+    }
+    // Block 0 is reserved for the superblock
+    groups[0]->bitmap[0] = false;
+    groups[0]->freeCount--;
+    groups[0]->cursor = 1;
+    freeTotal = (long long)totalBlocks - 1;
+}
+
+BlockManager::AllocGroup& BlockManager::groupOf(int index) {
+    return *groups[index / groupSize];
+}
+
+bool BlockManager::readSuperblock() {
+    ifstream disk(diskPath, ios::binary);
+    if (!disk.good()) return false;
+    vector<char> head(SUPERBLOCK_HEADER, 0);
+    disk.read(head.data(), head.size());
+    if (disk.gcount() < SUPERBLOCK_HEADER) return false;
+
+    Superblock found;
+    if (!found.decode(head)) {
+        // No magic: either a blank image or one from before superblocks,
+        // whose tree text sits in block 0 with the caller's geometry
+        for (char c : head) {
+            if (c != 0) { legacyLayout = true; break; }
+        }
+        return false;
+    }
+    string why;
+    if (!validGeometry(found.blockSize, found.totalBlocks, why)) {
+        FS_LOG(LOG_WARN, "Ignoring superblock with bad geometry: " << why);
+        return false;
+    }
+    // Re-read the whole of block 0 now that the block size is known
+    vector<char> block(found.blockSize, 0);
+    disk.seekg(0);
+    disk.read(block.data(), block.size());
+    found.decode(block);
+    sb = found;
+    return true;
+}
+
+void BlockManager::writeSuperblock() {
+    sb.version = listedTree ? 4 : SUPERBLOCK_VERSION;
+    sb.blockSize = blockSize;
+    sb.totalBlocks = totalBlocks;
+    sb.freeBlocks = freeTotal.load();
+    sb.fileCount = fileCount.load();
+    sb.dirCount = dirCount.load();
+    sb.inlineLimit = inlineLimit;
+    vector<char> block(blockSize, 0);
+    sb.encode(block);
+    writeBlock(0, block);
 }
 
 void BlockManager::init() {
+    // An existing image decides its own geometry
+    bool formatted = readSuperblock();
+    if (formatted && (sb.blockSize != blockSize || sb.totalBlocks != totalBlocks)) {
+        blockSize = sb.blockSize;
+        totalBlocks = (int)sb.totalBlocks;
+        setupGroups();
+    }
+    if (formatted && sb.hasInlineLimit()) inlineLimit = sb.inlineLimit;
+    if (formatted) {
+        FS_LOG(LOG_INFO, "Superblock: " << totalBlocks << " blocks of " << blockSize
+             << " bytes (" << getDiskBytes() << " bytes)");
+    }
+
     // If meta file exists → load bitmap
     ifstream meta(metaPath, ios::binary);
     if (meta.good()) {
@@ -26,63 +137,114 @@ void BlockManager::init() {
         if (msize < totalBlocks) {
             // Corrupt or incomplete metadata — recreate it
             saveMeta();
-            cout << "[WARN] Metadata file incomplete — reinitialized.\n";
+            FS_LOG(LOG_WARN, "Metadata file incomplete — reinitialized.");
         } else {
             loadMeta();
-            cout << "[INFO] Metadata loaded.\n";
+            FS_LOG(LOG_INFO, "Metadata loaded.");
         }
     } else {
         // Create new metadata
         saveMeta();
-        cout << "[INFO] Metadata initialized.\n";
+        FS_LOG(LOG_INFO, "Metadata initialized.");
+    }
+    // The superblock and tree chain must never be handed out, whatever
+    // meta.bin says
+    listedTree = formatted && !sb.hasTreeChain();
+    if (formatted && sb.hasTreeChain()) sb.treeBlocks = chainBlocks(sb.treeHead);
+    if (isBlockFree(0)) markBlockUsed(0);
+    for (int b : sb.treeBlocks) {
+        if (b > 0 && b < totalBlocks && isBlockFree(b)) markBlockUsed(b);
+    }
+    snapshots.clear();
+    string table;
+    if (formatted && sb.hasSnapshots() && sb.snapTable > 0 && readChain(sb.snapTable, table)) {
+        istringstream in(table);
+        SnapshotRecord rec;
+        while (in >> rec.name >> rec.createdAt >> rec.treeHead) snapshots.push_back(rec);
+        for (int b : getSnapshotBlocks()) {
+            if (isBlockFree(b)) markBlockUsed(b);
+        }
+    }
+    // The bitmap is authoritative for free space; the file and directory
+    // counts are checked again once the tree is loaded
+    if (formatted && sb.hasCounters()) {
+        if (sb.freeBlocks != freeTotal.load()) {
+            FS_LOG(LOG_WARN, "Superblock free count " << sb.freeBlocks << " differs from bitmap ("
+                 << freeTotal.load() << ") — using bitmap.");
+        }
+        fileCount = sb.fileCount;
+        dirCount = sb.dirCount;
     }
 
     // Ensure the disk file exists and has the expected size.
     // Opening with ios::in|ios::out won't create the file on its own,
     // so create/resize it if missing or too small.
+    long long expected = getDiskBytes();
     fstream disk(diskPath, ios::in | ios::out | ios::binary);
     if (!disk.good()) {
         // Create a new disk file of size blockSize * totalBlocks
         ofstream dcreate(diskPath, ios::binary);
         // Seek to the final byte and write a single zero to allocate space
-        long long fullSize = (long long)blockSize * (long long)totalBlocks;
-        if (fullSize > 0) {
-            dcreate.seekp(fullSize - 1);
+        if (expected > 0) {
+            dcreate.seekp(expected - 1);
             char zero = 0;
             dcreate.write(&zero, 1);
         }
         dcreate.close();
-        cout << "[INFO] Disk file created/resized.\n";
+        FS_LOG(LOG_INFO, "Disk file created/resized.");
     } else {
         // Optionally, ensure disk is at least the expected size
         disk.seekg(0, ios::end);
-        auto size = disk.tellg();
-        long long expected = (long long)blockSize * (long long)totalBlocks;
+        long long size = (long long)disk.tellg();
         disk.close();
         if (size < expected) {
-            // Expand the file to the expected size
-            ofstream dcreate(diskPath, ios::binary | ios::app);
-            long long need = expected - size;
-            const int chunk = 4096;
-            vector<char> zeros(min<long long>(need, chunk), 0);
-            while (need > 0) {
-                int toWrite = (int)min<long long>(need, zeros.size());
-                dcreate.write(zeros.data(), toWrite);
-                need -= toWrite;
-            }
-            dcreate.close();
-            cout << "[INFO] Disk file expanded to expected size.\n";
+            // Extend with one byte at the end; the gap stays sparse
+            fstream dgrow(diskPath, ios::in | ios::out | ios::binary);
+            dgrow.seekp(expected - 1);
+            char zero = 0;
+            dgrow.write(&zero, 1);
+            dgrow.close();
+            FS_LOG(LOG_INFO, "Disk file expanded to expected size.");
         }
     }
+
+    // Format: a blank image gets a superblock; legacy images are upgraded on
+    // the first tree save so their block 0 tree text stays readable until then
+    if (!formatted && !legacyLayout) {
+        writeSuperblock();
+        FS_LOG(LOG_INFO, "Formatted: " << totalBlocks << " blocks of " << blockSize << " bytes");
+    }
+
+    if (dedupIdx) {
+        // Fingerprints of blocks freed while unmounted are dropped here;
+        // the rest are verified byte-for-byte before being shared anyway
+        dedupIdx->load(metaPath + ".ddt");
+        for (int b = 1; b < totalBlocks; b++) {
+            if (isBlockFree(b)) dedupIdx->erase(b);
+        }
+        FS_LOG(LOG_INFO, "Dedup enabled (" << dedupIdx->stats().indexEntries << " fingerprints)");
+    }
+
+    // Queue depth of 32 keeps a whole small file's reads in flight at once
+    io = AsyncIOEngine::create(diskPath, 32);
+    if (io) FS_LOG(LOG_INFO, "Async I/O backend: " << io->name());
 }
 
 void BlockManager::loadMeta() {
     ifstream meta(metaPath, ios::binary);
 
-    for (int i = 0; i < totalBlocks; i++) {
-        char bit;
-        meta.read(&bit, 1);
-        freeBlockBitmap[i] = (bit == '1');
+    string bits;
+    for (auto& g : groups) {
+        lock_guard<mutex> lk(g->lock);
+        bits.resize(g->bitmap.size());
+        meta.read(&bits[0], bits.size());
+        int freeCount = 0;
+        for (size_t i = 0; i < g->bitmap.size(); i++) {
+            g->bitmap[i] = (bits[i] == '1');
+            if (g->bitmap[i]) freeCount++;
+        }
+        freeTotal += freeCount - g->freeCount.load();
+        g->freeCount = freeCount;
     }
 
     meta.close();
@@ -91,69 +253,695 @@ void BlockManager::loadMeta() {
 // restoreMeta removed — resting on manual recovery tools if needed
 
 void BlockManager::saveMeta() {
+    Stats::Timer timer(Stats::OP_SAVE_META);
+    Stats::add(Stats::META_SAVES);
+    string bits;
+    bits.reserve(totalBlocks);
+    for (auto& g : groups) {
+        lock_guard<mutex> lk(g->lock);
+        for (bool bit : g->bitmap) bits += bit ? '1' : '0';
+    }
+
     ofstream meta(metaPath, ios::binary);
+    meta.write(bits.data(), bits.size());
+    meta.close();
+
+    if (dedupIdx) dedupIdx->save(metaPath + ".ddt");
+    flushDiscards();
+}
 
-    for (bool bit : freeBlockBitmap) {
-        char c = bit ? '1' : '0';
-        meta.write(&c, 1);
+BlockManager::~BlockManager() {
+    flushDiscards();
+}
+
+void BlockManager::setDiscard(bool on) {
+    discardOn = on;
+}
+
+size_t BlockManager::queueDiscard(int index, bool freed) {
+    lock_guard<mutex> lk(discardLock);
+    if (freed) discardQueue.insert(index);
+    else discardQueue.erase(index);
+    return discardQueue.size();
+}
+
+void BlockManager::flushDiscards() {
+    lock_guard<mutex> lk(discardLock);
+    if (discardQueue.empty()) return;
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    int fd = open(diskPath.c_str(), O_WRONLY);
+    if (fd >= 0) {
+        // The queue is sorted, so neighbouring blocks merge into one range
+        auto it = discardQueue.begin();
+        while (it != discardQueue.end()) {
+            int first = *it, last = first;
+            for (++it; it != discardQueue.end() && *it == last + 1; ++it) last = *it;
+            if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)first * blockSize,
+                          (off_t)(last - first + 1) * blockSize) != 0) {
+                FS_LOG(LOG_WARN, "Hole punching not supported by the host filesystem; discard disabled");
+                discardOn = false;
+                break;
+            }
+            discardedBlocks += last - first + 1;
+            discardRanges++;
+        }
+        close(fd);
     }
+#endif
+    discardQueue.clear();
+}
 
+long long BlockManager::hostBytes() const {
+    struct stat st;
+    if (stat(diskPath.c_str(), &st) != 0) return 0;
+    return (long long)st.st_blocks * 512;
+}
+
+long long BlockManager::getDiscardedBlocks() const {
+    return discardedBlocks.load();
+}
+
+long long BlockManager::getDiscardRanges() const {
+    return discardRanges.load();
+}
+
+long long BlockManager::getBlocksWritten() const {
+    return blocksWritten.load();
+}
+
+void BlockManager::saveBits(AllocGroup& g, int from, int to) {
+    // meta.bin holds one character per block, so only the changed entries
+    // are rewritten
+    string bits;
+    bits.reserve(to - from);
+    for (int i = from; i < to; i++) bits += g.bitmap[i] ? '1' : '0';
+
+    fstream meta(metaPath, ios::binary | ios::in | ios::out);
+    if (!meta.good()) return;
+    Stats::add(Stats::BITMAP_UPDATES);
+    meta.seekp((long long)g.start + from);
+    meta.write(bits.data(), bits.size());
     meta.close();
 }
 
+bool BlockManager::writeTree(const string& data) {
+    lock_guard<mutex> lk(treeLock);
+    // Chain format (see writeChain), rewritten in place: only growth
+    // allocates, from group 0 near the superblock
+    int payload = blockSize - 8;
+    int needed = max(1, (int)((data.size() + payload - 1) / payload));
+    if (needed > (int)sb.treeBlocks.size()) {
+        vector<int> more;
+        if (!allocateBlocks(needed - (int)sb.treeBlocks.size(), 0, more)) {
+            FS_FAIL(FS_NO_SPACE, "No free blocks for directory tree (" << data.size() << " bytes)");
+            return false;
+        }
+        sb.treeBlocks.insert(sb.treeBlocks.end(), more.begin(), more.end());
+    }
+    vector<int> spare(sb.treeBlocks.begin() + needed, sb.treeBlocks.end());
+    sb.treeBlocks.resize(needed);
+
+    vector<char> buffer(blockSize, 0);
+    for (int i = 0; i < needed; i++) {
+        fill(buffer.begin(), buffer.end(), 0);
+        int32_t next = i + 1 < needed ? sb.treeBlocks[i + 1] : 0;
+        size_t off = (size_t)i * payload;
+        int32_t len = (int32_t)min<size_t>(payload, data.size() - min(off, data.size()));
+        memcpy(buffer.data(), &next, 4);
+        memcpy(buffer.data() + 4, &len, 4);
+        if (len > 0) memcpy(buffer.data() + 8, data.data() + off, len);
+        if (!writeBlock(sb.treeBlocks[i], buffer)) {
+            FS_FAIL(FS_IO_ERROR, "Failed to write directory tree block " << sb.treeBlocks[i]);
+            return false;
+        }
+    }
+    sb.treeHead = sb.treeBlocks[0];
+    sb.treeBytes = (long long)data.size();
+    legacyLayout = false;
+    listedTree = false;
+    writeSuperblock();
+    if (!spare.empty()) freeBlocks(spare);
+    return true;
+}
+
+bool BlockManager::readTree(string& data) {
+    lock_guard<mutex> lk(treeLock);
+    data.clear();
+    vector<char> buffer;
+    if (legacyLayout) {
+        if (!readBlock(0, buffer)) return false;
+        // Find the end of actual data (before padding nulls)
+        size_t end = buffer.size();
+        while (end > 0 && buffer[end - 1] == 0) end--;
+        data.assign(buffer.begin(), buffer.begin() + end);
+        return true;
+    }
+    if (!listedTree) {
+        if (sb.treeHead == 0) return true;  // Formatted, never saved
+        return readChain(sb.treeHead, data);
+    }
+    for (int b : sb.treeBlocks) {
+        if (!readBlock(b, buffer)) return false;
+        data.append(buffer.begin(), buffer.end());
+    }
+    if ((long long)data.size() > sb.treeBytes) data.resize((size_t)sb.treeBytes);
+    return true;
+}
+
+vector<int> BlockManager::getTreeBlocks() {
+    lock_guard<mutex> lk(treeLock);
+    return sb.treeBlocks;
+}
+
+bool BlockManager::writeChain(const string& data, int& head) {
+    int payload = blockSize - 8;
+    int needed = max(1, (int)((data.size() + payload - 1) / payload));
+    vector<int> blocks;
+    if (!allocateBlocks(needed, 0, blocks)) return false;
+    for (int i = 0; i < needed; i++) {
+        vector<char> buffer(blockSize, 0);
+        int32_t next = i + 1 < needed ? blocks[i + 1] : 0;
+        size_t off = (size_t)i * payload;
+        int32_t len = (int32_t)min<size_t>(payload, data.size() - min(off, data.size()));
+        memcpy(buffer.data(), &next, 4);
+        memcpy(buffer.data() + 4, &len, 4);
+        if (len > 0) memcpy(buffer.data() + 8, data.data() + off, len);
+        writeBlock(blocks[i], buffer);
+    }
+    head = blocks[0];
+    return true;
+}
+
+bool BlockManager::readChain(int head, string& data) {
+    data.clear();
+    vector<char> buffer;
+    // The step limit stops a corrupt chain that loops back on itself
+    for (int b = head, steps = 0; b != 0; steps++) {
+        if (b < 0 || b >= totalBlocks || steps >= totalBlocks || !readBlock(b, buffer)) return false;
+        int32_t next, len;
+        memcpy(&next, buffer.data(), 4);
+        memcpy(&len, buffer.data() + 4, 4);
+        if (len < 0 || len > blockSize - 8) return false;
+        data.append(buffer.begin() + 8, buffer.begin() + 8 + len);
+        b = next;
+    }
+    return true;
+}
+
+vector<int> BlockManager::chainBlocks(int head) {
+    vector<int> out;
+    vector<char> buffer;
+    for (int b = head; b > 0 && b < totalBlocks && (int)out.size() < totalBlocks; ) {
+        out.push_back(b);
+        if (!readBlock(b, buffer)) break;
+        int32_t next;
+        memcpy(&next, buffer.data(), 4);
+        b = next;
+    }
+    return out;
+}
+
+bool BlockManager::saveSnapshotTable() {
+    // The new table is written before the old one is released
+    ostringstream out;
+    for (auto& s : snapshots) out << s.name << " " << s.createdAt << " " << s.treeHead << "\n";
+    int head = 0;
+    if (!snapshots.empty() && !writeChain(out.str(), head)) return false;
+    vector<int> old = chainBlocks(sb.snapTable);
+    sb.snapTable = head;
+    writeSuperblock();
+    for (int b : old) freeBlock(b);
+    return true;
+}
+
+vector<SnapshotRecord> BlockManager::getSnapshots() {
+    lock_guard<mutex> lk(treeLock);
+    return snapshots;
+}
+
+bool BlockManager::addSnapshot(const string& name, const string& tree) {
+    lock_guard<mutex> lk(treeLock);
+    SnapshotRecord rec;
+    rec.name = name;
+    rec.createdAt = (long long)time(nullptr);
+    if (!writeChain(tree, rec.treeHead)) return false;
+    snapshots.push_back(rec);
+    if (!saveSnapshotTable()) {
+        snapshots.pop_back();
+        for (int b : chainBlocks(rec.treeHead)) freeBlock(b);
+        return false;
+    }
+    return true;
+}
+
+bool BlockManager::readSnapshot(const string& name, string& tree) {
+    lock_guard<mutex> lk(treeLock);
+    for (auto& s : snapshots) {
+        if (s.name == name) return readChain(s.treeHead, tree);
+    }
+    return false;
+}
+
+bool BlockManager::removeSnapshot(const string& name) {
+    lock_guard<mutex> lk(treeLock);
+    for (size_t i = 0; i < snapshots.size(); i++) {
+        if (snapshots[i].name != name) continue;
+        int head = snapshots[i].treeHead;
+        snapshots.erase(snapshots.begin() + i);
+        if (!saveSnapshotTable()) return false;
+        for (int b : chainBlocks(head)) freeBlock(b);
+        return true;
+    }
+    return false;
+}
+
+vector<int> BlockManager::getSnapshotBlocks() {
+    lock_guard<mutex> lk(treeLock);
+    vector<int> out = chainBlocks(sb.snapTable);
+    for (auto& s : snapshots) {
+        vector<int> tree = chainBlocks(s.treeHead);
+        out.insert(out.end(), tree.begin(), tree.end());
+    }
+    return out;
+}
+
 bool BlockManager::readBlock(int index, vector<char> &buffer) {
     if (index < 0 || index >= totalBlocks) return false;
+    Stats::Timer timer(Stats::OP_BLOCK_READ);
 
     ifstream disk(diskPath, ios::binary);
     if (!disk.good()) return false;
 
     buffer.resize(blockSize);
-    disk.seekg(index * blockSize);
+    disk.seekg((long long)index * blockSize);
     disk.read(buffer.data(), blockSize);
 
     disk.close();
+    Stats::add(Stats::BLOCK_READS);
+    Stats::add(Stats::BYTES_READ, blockSize);
     return true;
 }
 
 bool BlockManager::writeBlock(int index, const vector<char> &buffer) {
     if (index < 0 || index >= totalBlocks) return false;
+    Stats::Timer timer(Stats::OP_BLOCK_WRITE);
 
     fstream disk(diskPath, ios::binary | ios::in | ios::out);
     if (!disk.good()) return false;
 
-    disk.seekp(index * blockSize);
+    disk.seekp((long long)index * blockSize);
     disk.write(buffer.data(), blockSize);
     disk.flush();
 
     disk.close();
+    blocksWritten++;
+    Stats::add(Stats::BLOCK_WRITES);
+    Stats::add(Stats::BYTES_WRITTEN, blockSize);
     return true;
 }
 
-int BlockManager::allocateBlock() {
-    for (int i = 1; i < totalBlocks; i++) {  // Start from block 1, reserve block 0 for directory
-        if (freeBlockBitmap[i]) {
-            freeBlockBitmap[i] = false;
-            saveMeta();
-            return i;
+bool BlockManager::writeBlocks(int first, int count, const char* data) {
+    if (first < 0 || count < 0 || (long long)first + count > totalBlocks) return false;
+    int fd = open(diskPath.c_str(), O_WRONLY);
+    if (fd < 0) return false;
+    long long bytes = (long long)count * blockSize;
+    long long done = 0;
+    while (done < bytes) {
+        ssize_t n = pwrite(fd, data + done, (size_t)(bytes - done), (off_t)first * blockSize + done);
+        if (n <= 0) break;
+        done += n;
+    }
+    close(fd);
+    if (done < bytes) return false;
+    blocksWritten += count;
+    Stats::add(Stats::BLOCK_WRITES, count);
+    Stats::add(Stats::BYTES_WRITTEN, bytes);
+    return true;
+}
+
+void BlockManager::submitRead(int index, vector<char>& buffer, function<void(bool)> done) {
+    if (index < 0 || index >= totalBlocks) { if (done) done(false); return; }
+    if (!io) {
+        bool ok = readBlock(index, buffer);
+        if (done) done(ok);
+        return;
+    }
+    buffer.resize(blockSize);
+    Stats::add(Stats::BLOCK_READS);
+    Stats::add(Stats::BYTES_READ, blockSize);
+    io->submitRead((long long)index * blockSize, buffer.data(), blockSize, done);
+}
+
+void BlockManager::submitWrite(int index, const vector<char>& buffer, function<void(bool)> done) {
+    if (index < 0 || index >= totalBlocks || (int)buffer.size() < blockSize) { if (done) done(false); return; }
+    if (!io) {
+        bool ok = writeBlock(index, buffer);
+        if (done) done(ok);
+        return;
+    }
+    blocksWritten++;
+    Stats::add(Stats::BLOCK_WRITES);
+    Stats::add(Stats::BYTES_WRITTEN, blockSize);
+    io->submitWrite((long long)index * blockSize, buffer.data(), blockSize, done);
+}
+
+future<bool> BlockManager::readBlockAsync(int index, vector<char>& buffer) {
+    shared_ptr<promise<bool>> p = make_shared<promise<bool>>();
+    future<bool> f = p->get_future();
+    submitRead(index, buffer, [p](bool ok) { p->set_value(ok); });
+    return f;
+}
+
+future<bool> BlockManager::writeBlockAsync(int index, const vector<char>& buffer) {
+    shared_ptr<promise<bool>> p = make_shared<promise<bool>>();
+    future<bool> f = p->get_future();
+    submitWrite(index, buffer, [p](bool ok) { p->set_value(ok); });
+    return f;
+}
+
+void BlockManager::drainIO() {
+    if (io) io->drain();
+}
+
+const char* BlockManager::ioBackend() const {
+    return io ? io->name() : "sync";
+}
+
+int BlockManager::allocateBlock(int group) {
+    int n = (int)groups.size();
+    int first = (group >= 0) ? group % n : preferredGroup();
+    if (freeTotal.load() <= reservedTotal.load()) return -1;  // the rest is reserved
+
+    // Try the preferred group first, then spill over to the others in order
+    for (int k = 0; k < n; k++) {
+        AllocGroup& g = *groups[(first + k) % n];
+        if (g.freeCount.load() == 0) continue;  // skip full groups without locking
+        lock_guard<mutex> lk(g.lock);
+        int size = (int)g.bitmap.size();
+        for (int j = 0; j < size; j++) {
+            int pos = (g.cursor + j) % size;
+            if (g.bitmap[pos]) {
+                g.bitmap[pos] = false;
+                g.freeCount--;
+                freeTotal--;
+                g.cursor = (pos + 1) % size;
+                saveBits(g, pos, pos + 1);
+                if (discardOn) queueDiscard(g.start + pos, false);
+                return g.start + pos;
+            }
         }
     }
     return -1; // no free block
 }
 
+bool BlockManager::allocateBlocks(int count, int group, vector<int>& out) {
+    out.clear();
+    if (count <= 0) return true;
+    if (count > freeTotal.load() - reservedTotal.load()) return false;
+    int n = (int)groups.size();
+    int first = (group >= 0) ? group % n : preferredGroup();
+
+    // First choice: `count` adjacent free blocks inside one group, searched
+    // from the group's next-fit cursor
+    for (int k = 0; k < n; k++) {
+        AllocGroup& g = *groups[(first + k) % n];
+        if (g.freeCount.load() < count) continue;
+        lock_guard<mutex> lk(g.lock);
+        int size = (int)g.bitmap.size();
+        int run = 0;
+        for (int j = 0; j < size; j++) {
+            int pos = (g.cursor + j) % size;
+            if (pos == 0) run = 0;  // runs do not wrap around the group end
+            run = g.bitmap[pos] ? run + 1 : 0;
+            if (run == count) {
+                int runStart = pos - count + 1;
+                for (int b = runStart; b <= pos; b++) {
+                    g.bitmap[b] = false;
+                    out.push_back(g.start + b);
+                    if (discardOn) queueDiscard(g.start + b, false);
+                }
+                g.freeCount -= count;
+                freeTotal -= count;
+                g.cursor = (pos + 1) % size;
+                saveBits(g, runStart, pos + 1);
+                return true;
+            }
+        }
+    }
+
+    // Fragmented disk: fall back to block-at-a-time allocation
+    for (int i = 0; i < count; i++) {
+        int b = allocateBlock(group);
+        if (b == -1) {
+            for (int blk : out) freeBlock(blk);
+            out.clear();
+            return false;
+        }
+        out.push_back(b);
+    }
+    return true;
+}
+
+bool BlockManager::reserveExtents(long long count, vector<pair<int, int>>& extents) {
+    extents.clear();
+    if (count <= 0) return true;
+    if (count > freeTotal.load() - reservedTotal.load()) return false;
+    long long need = count;
+    for (auto& gp : groups) {
+        if (need == 0) break;
+        AllocGroup& g = *gp;
+        if (g.freeCount.load() == 0) continue;
+        lock_guard<mutex> lk(g.lock);
+        int size = (int)g.bitmap.size();
+        for (int pos = 0; pos < size && need > 0; pos++) {
+            if (!g.bitmap[pos]) continue;
+            g.bitmap[pos] = false;
+            g.freeCount--;
+            freeTotal--;
+            need--;
+            int b = g.start + pos;
+            if (discardOn) queueDiscard(b, false);
+            // Groups are adjacent, so a run may continue into the next one
+            if (!extents.empty() && extents.back().first + extents.back().second == b) extents.back().second++;
+            else extents.push_back(make_pair(b, 1));
+        }
+    }
+    if (need > 0) {
+        // Lost a race with another allocator: hand everything back
+        for (auto& e : extents) {
+            for (int i = 0; i < e.second; i++) freeBlock(e.first + i);
+        }
+        extents.clear();
+        return false;
+    }
+    return true;
+}
+
 void BlockManager::freeBlock(int index) {
     if (index < 0 || index >= totalBlocks) return;
-    freeBlockBitmap[index] = true;
-    saveMeta();
+    {
+        // A shared block only loses one owner
+        lock_guard<mutex> lk(refLock);
+        auto it = extraRefs.find(index);
+        if (it != extraRefs.end()) {
+            if (--it->second == 0) extraRefs.erase(it);
+            return;
+        }
+    }
+    if (dedupIdx) dedupIdx->erase(index);
+    bool flush = false;
+    {
+        AllocGroup& g = groupOf(index);
+        lock_guard<mutex> lk(g.lock);
+        if (!g.bitmap[index - g.start]) {
+            g.bitmap[index - g.start] = true;
+            g.freeCount++;
+            freeTotal++;
+            if (discardOn) flush = queueDiscard(index, true) >= (size_t)DISCARD_BATCH;
+        }
+        saveBits(g, index - g.start, index - g.start + 1);
+    }
+    if (flush) flushDiscards();
+}
+
+void BlockManager::freeBlocks(vector<int> blocks) {
+    sort(blocks.begin(), blocks.end());
+    // A block listed twice had two owners; each mention drops one
+    vector<int> release;
+    {
+        lock_guard<mutex> lk(refLock);
+        for (int b : blocks) {
+            if (b < 0 || b >= totalBlocks) continue;
+            auto it = extraRefs.find(b);
+            if (it != extraRefs.end()) {
+                if (--it->second == 0) extraRefs.erase(it);
+                continue;
+            }
+            release.push_back(b);
+        }
+    }
+    if (dedupIdx) for (int b : release) dedupIdx->erase(b);
+
+    bool flush = false;
+    for (size_t i = 0; i < release.size();) {
+        AllocGroup& g = groupOf(release[i]);
+        int end = g.start + (int)g.bitmap.size();
+        int lo = release[i] - g.start, hi = lo;
+        lock_guard<mutex> lk(g.lock);
+        for (; i < release.size() && release[i] < end; i++) {
+            int pos = release[i] - g.start;
+            if (!g.bitmap[pos]) {
+                g.bitmap[pos] = true;
+                g.freeCount++;
+                freeTotal++;
+                if (discardOn) flush = queueDiscard(release[i], true) >= (size_t)DISCARD_BATCH || flush;
+            }
+            hi = pos + 1;
+        }
+        saveBits(g, lo, hi);
+    }
+    if (flush) flushDiscards();
 }
 
 void BlockManager::markBlockUsed(int index) {
     if (index < 0 || index >= totalBlocks) return;
-    freeBlockBitmap[index] = false;
-    saveMeta();
+    AllocGroup& g = groupOf(index);
+    lock_guard<mutex> lk(g.lock);
+    if (g.bitmap[index - g.start]) {
+        g.bitmap[index - g.start] = false;
+        g.freeCount--;
+        freeTotal--;
+        if (discardOn) queueDiscard(index, false);
+    }
+    saveBits(g, index - g.start, index - g.start + 1);
+}
+
+void BlockManager::refBlock(int index) {
+    if (index <= 0 || index >= totalBlocks) return;
+    lock_guard<mutex> lk(refLock);
+    extraRefs[index]++;
+}
+
+int BlockManager::getRefCount(int index) {
+    if (index < 0 || index >= totalBlocks || isBlockFree(index)) return 0;
+    lock_guard<mutex> lk(refLock);
+    auto it = extraRefs.find(index);
+    return 1 + (it == extraRefs.end() ? 0 : it->second);
+}
+
+void BlockManager::setRefCounts(const map<int, int>& refs) {
+    lock_guard<mutex> lk(refLock);
+    extraRefs.clear();
+    for (auto& p : refs) {
+        if (p.second > 1) extraRefs[p.first] = p.second - 1;
+    }
+}
+
+void BlockManager::setDedup(bool on) {
+    if (on && !dedupIdx) dedupIdx.reset(new DedupIndex());
+    if (!on) dedupIdx.reset();
+}
+
+DedupIndex* BlockManager::dedup() {
+    return dedupIdx.get();
+}
+
+void BlockManager::setCompressNewFiles(bool on) {
+    compressDefault = on;
+}
+
+bool BlockManager::compressNewFiles() const {
+    return compressDefault;
 }
 
 bool BlockManager::isBlockFree(int index) {
-    return freeBlockBitmap[index];
+    AllocGroup& g = groupOf(index);
+    lock_guard<mutex> lk(g.lock);
+    return g.bitmap[index - g.start];
+}
+
+int BlockManager::getGroupCount() const {
+    return (int)groups.size();
+}
+
+int BlockManager::getGroupFreeCount(int group) const {
+    return groups[group]->freeCount.load();
+}
+
+int BlockManager::getFreeBlockCount() const {
+    return (int)freeTotal.load();
+}
+
+bool BlockManager::reserveBlocks(long long delta) {
+    long long cur = reservedTotal.load();
+    do {
+        if (delta > 0 && cur + delta > freeTotal.load()) return false;
+    } while (!reservedTotal.compare_exchange_weak(cur, cur + delta));
+    return true;
+}
+
+long long BlockManager::getReservedBlocks() const {
+    return reservedTotal.load();
+}
+
+void BlockManager::adjustUsage(long long files, long long dirs) {
+    fileCount += files;
+    dirCount += dirs;
+}
+
+void BlockManager::setUsage(long long files, long long dirs) {
+    if (fileCount.load() != files || dirCount.load() != dirs) {
+        if (sb.hasCounters() && sb.treeBytes > 0) {
+            FS_LOG(LOG_WARN, "Usage counters were stale (files " << fileCount.load() << " -> " << files
+                 << ", dirs " << dirCount.load() << " -> " << dirs << ") — corrected.");
+        }
+        fileCount = files;
+        dirCount = dirs;
+    }
+}
+
+FsStats BlockManager::statfs() const {
+    FsStats st;
+    st.blockSize = blockSize;
+    st.totalBlocks = totalBlocks;
+    st.freeBlocks = freeTotal.load();
+    st.reservedBlocks = reservedTotal.load();
+    st.files = fileCount.load();
+    st.dirs = dirCount.load();
+    for (auto& g : groups) st.groupFree.push_back(g->freeCount.load());
+    return st;
+}
+
+vector<int> BlockManager::freeRuns() {
+    vector<int> runs;
+    for (auto& gp : groups) {
+        AllocGroup& g = *gp;
+        lock_guard<mutex> lk(g.lock);
+        int run = 0;
+        for (size_t i = 0; i < g.bitmap.size(); i++) {
+            if (g.bitmap[i]) run++;
+            else if (run > 0) { runs.push_back(run); run = 0; }
+        }
+        if (run > 0) runs.push_back(run);
+    }
+    return runs;
+}
+
+int BlockManager::preferredGroup() const {
+    int n = (int)groups.size();
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0) return cpu % n;
+#endif
+    return (int)(hash<thread::id>()(this_thread::get_id()) % n);
+}
+
+int BlockManager::pickDirectoryGroup() const {
+    int best = 0;
+    for (int i = 1; i < (int)groups.size(); i++) {
+        if (groups[i]->freeCount.load() > groups[best]->freeCount.load()) best = i;
+    }
+    return best;
 }
 
 int BlockManager::getBlockSize() const {
@@ -163,3 +951,15 @@ int BlockManager::getBlockSize() const {
 int BlockManager::getTotalBlocks() const {
     return totalBlocks;
 }
+
+void BlockManager::setInlineLimit(int bytes) {
+    inlineLimit = max(0, min(bytes, blockSize / 2));
+}
+
+int BlockManager::getInlineLimit() const {
+    return inlineLimit;
+}
+
+long long BlockManager::getDiskBytes() const {
+    return (long long)blockSize * totalBlocks;
+}
@@ -1,9 +1,38 @@
 #ifndef BLOCK_MANAGER_HPP
 #define BLOCK_MANAGER_HPP
 
+#include "asyncio.hpp"
+#include "dedup.hpp"
+#include "superblock.hpp"
+#include <atomic>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+// Answer to BlockManager::statfs(), built from cached counters only
+struct FsStats {
+    int blockSize;
+    long long totalBlocks;
+    long long freeBlocks;
+    long long reservedBlocks;       // Free blocks held for buffered appends
+    long long files;
+    long long dirs;                 // Including the root directory
+    std::vector<int> groupFree;     // Free blocks per allocation group
+};
+
+// One entry of the snapshot table: a frozen copy of the directory tree text
+struct SnapshotRecord {
+    std::string name;
+    long long createdAt;
+    int treeHead;                   // First block of the chain holding the tree text
+};
+
 class BlockManager {
 private:
     std::string diskPath;
@@ -12,9 +41,69 @@ private:
     int blockSize;
     int totalBlocks;
 
-    std::vector<bool> freeBlockBitmap;
+    // The disk is split into allocation groups, each owning a slice of the
+    // free-block bitmap with its own lock, so threads allocating from
+    // different groups never contend.
+    struct AllocGroup {
+        int start;                  // First block number in the group
+        std::vector<bool> bitmap;   // true = free, one entry per block
+        std::atomic<int> freeCount;
+        int cursor;                 // Next-fit position within the group
+        std::mutex lock;
+    };
+    std::vector<std::unique_ptr<AllocGroup>> groups;
+    int groupSize;
+    std::atomic<long long> freeTotal;  // Sum of every group's freeCount
+    std::atomic<long long> reservedTotal; // Free blocks promised to buffered appends
+
+    // Usage counters mirrored into the superblock on every write of it
+    std::atomic<long long> fileCount;
+    std::atomic<long long> dirCount;
+
+    int inlineLimit;        // Files up to this size live in their directory entry
+
+    // Blocks owned by more than one file slot: block → owners beyond the
+    // first. Rebuilt from the tree at load, so never stored on disk.
+    std::unordered_map<int, int> extraRefs;
+    std::mutex refLock;
+
+    std::unique_ptr<DedupIndex> dedupIdx; // Null unless dedup is enabled
+    bool compressDefault;   // New files are created compressed
+
+    // Freed blocks waiting to be punched out of the image file. Entries are
+    // added and removed under the block's group lock, so an allocated block
+    // is never in the queue when its new data is written.
+    static const int DISCARD_BATCH = 256; // Queue length that triggers a flush
+    std::atomic<bool> discardOn;
+    std::set<int> discardQueue;
+    std::mutex discardLock;
+    std::atomic<long long> discardedBlocks;
+    std::atomic<long long> discardRanges;
+
+    std::atomic<long long> blocksWritten; // Image block writes since mount, sync and async
+
+    Superblock sb;          // Geometry and directory-tree location
+    bool legacyLayout;      // Image predates the superblock: tree text lives in block 0
+    bool listedTree;        // Version 2-4 image not yet saved: raw tree blocks listed in block 0
+    std::mutex treeLock;
+    std::vector<SnapshotRecord> snapshots; // Mirror of the table chain at sb.snapTable; under treeLock
+
+    std::unique_ptr<AsyncIOEngine> io; // Created by init(); null → async calls run synchronously
 
     void loadMeta();
+    void setupGroups();
+    bool readSuperblock();
+    void writeSuperblock();
+    AllocGroup& groupOf(int index);
+    void saveBits(AllocGroup& g, int from, int to); // Persist bitmap entries [from, to) of g; caller holds g.lock
+
+    // Linked block chains for variable-length metadata: each block starts
+    // with int32 next (0 ends the chain) and int32 payload length
+    bool writeChain(const std::string& data, int& head);
+    bool readChain(int head, std::string& data);
+    std::vector<int> chainBlocks(int head);
+    bool saveSnapshotTable();       // Caller holds treeLock
+    size_t queueDiscard(int index, bool freed); // Caller holds the block's group lock; returns queue length
 
 public:
     BlockManager(
@@ -24,17 +113,85 @@ public:
         int totalBlocks
     );
 
-    void init();                   // Create disk if missing
-    int allocateBlock();           // Returns block index
-    void freeBlock(int index);     // Marks block free
+    // blockSize/totalBlocks are the format-time geometry; an existing image's
+    // superblock overrides them in init()
+    static bool validGeometry(int blockSize, long long totalBlocks, std::string& why);
+    void setInlineLimit(int bytes); // Format-time too; 0 disables inline files
+    void setDedup(bool on);         // Mount option; call before init()
+    void setCompressNewFiles(bool on); // Mount option
+    void setDiscard(bool on);       // Mount option: punch freed blocks out of the image
+    ~BlockManager();                // Issues any queued discards
+
+    void init();                   // Create (format) disk if missing, else read its superblock
+    int allocateBlock(int group = -1); // Returns block index; group = preferred group (-1: this CPU's)
+    bool allocateBlocks(int count, int group, std::vector<int>& out); // Prefers one contiguous run
+    // Bulk allocation: claims count blocks as the fewest (first, length)
+    // extents, lowest blocks first, without persisting the bitmap per block;
+    // the caller finishes with saveMeta()
+    bool reserveExtents(long long count, std::vector<std::pair<int, int>>& extents);
+    // Append reservations: free blocks promised to buffered data that has no
+    // blocks yet. The allocators above leave them alone, so the flush that
+    // releases a reservation and then allocates finds its blocks.
+    bool reserveBlocks(long long delta); // delta < 0 releases; false if too few unreserved blocks
+    long long getReservedBlocks() const;
+    void freeBlock(int index);     // Drops one owner; the block is free once none remain
+    void freeBlocks(std::vector<int> blocks); // Bulk freeBlock: one bitmap write per group touched
+    void refBlock(int index);      // Adds an owner to a used block (sharing)
+    int getRefCount(int index);    // 0 for a free block
+    void setRefCounts(const std::map<int, int>& refs); // Owners per block, from a tree walk
+    DedupIndex* dedup();           // Null when dedup is off
+    bool compressNewFiles() const;
     void markBlockUsed(int index); // Mark block as used without allocation
     bool readBlock(int index, std::vector<char>& buffer);
     bool writeBlock(int index, const std::vector<char>& buffer);
+    bool writeBlocks(int first, int count, const char* data); // count adjacent blocks in one write
     bool isBlockFree(int index);
+
+    // Asynchronous block I/O: many requests may be in flight at once.
+    // Buffers must outlive the request; callbacks run on an I/O thread.
+    void submitRead(int index, std::vector<char>& buffer, std::function<void(bool)> done);
+    void submitWrite(int index, const std::vector<char>& buffer, std::function<void(bool)> done);
+    std::future<bool> readBlockAsync(int index, std::vector<char>& buffer);
+    std::future<bool> writeBlockAsync(int index, const std::vector<char>& buffer);
+    void drainIO();                // Wait for all outstanding async requests
+    const char* ioBackend() const; // "io_uring", "threadpool" or "sync"
+
     void saveMeta();               // Save bitmap to meta.bin
+    void flushDiscards();          // Punch queued blocks, coalesced into ranges
+    long long hostBytes() const;   // Space the image file occupies on the host
+    long long getDiscardedBlocks() const;
+    long long getDiscardRanges() const;
+    long long getBlocksWritten() const;
+
+    // Directory tree storage: a chain of blocks listed in the superblock
+    bool writeTree(const std::string& data);
+    bool readTree(std::string& data);
+    std::vector<int> getTreeBlocks();
+
+    // Snapshots: named copies of the tree text. The data blocks they name
+    // are kept alive by reference counts, which the caller manages.
+    std::vector<SnapshotRecord> getSnapshots();
+    bool addSnapshot(const std::string& name, const std::string& tree);
+    bool readSnapshot(const std::string& name, std::string& tree);
+    bool removeSnapshot(const std::string& name);
+    std::vector<int> getSnapshotBlocks(); // Table and tree chains, for fsck
+
+    // Usage counters, adjusted by the Directory mutators
+    void adjustUsage(long long files, long long dirs);
+    void setUsage(long long files, long long dirs); // Reconcile after counting a loaded tree
+    FsStats statfs() const;                         // O(groups), no bitmap or tree scan
+    std::vector<int> freeRuns();                    // Length of every free extent (bitmap scan)
+
     // Accessors
     int getBlockSize() const;
     int getTotalBlocks() const;
+    long long getDiskBytes() const;
+    int getInlineLimit() const;
+    int getGroupCount() const;
+    int getGroupFreeCount(int group) const;
+    int getFreeBlockCount() const;
+    int preferredGroup() const;    // Group for the calling thread's CPU
+    int pickDirectoryGroup() const; // Emptiest group, for spreading new directories
 };
 
 #endif
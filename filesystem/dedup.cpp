@@ -0,0 +1,98 @@
+#include "dedup.hpp"
+#include <cstring>
+#include <fstream>
+using namespace std;
+
+DedupIndex::DedupIndex()
+    : logicalWrites(0), sharedWrites(0), zeroWrites(0), collisions(0) {}
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// 64-bit multiply-rotate hash over 8-byte words, finished with the
+// murmur3 avalanche so nearby blocks spread across the table
+uint64_t DedupIndex::fingerprint(const vector<char>& data) {
+    const uint64_t k1 = 0x87C37B91114253D5ULL;
+    const uint64_t k2 = 0x4CF5AD432745937FULL;
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ data.size();
+    size_t i = 0;
+    for (; i + 8 <= data.size(); i += 8) {
+        uint64_t w;
+        memcpy(&w, data.data() + i, 8);
+        h ^= rotl(w * k1, 31) * k2;
+        h = rotl(h, 27) * 5 + 0x52DCE729;
+    }
+    for (; i < data.size(); i++) h = (h ^ (unsigned char)data[i]) * k1;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int DedupIndex::lookup(uint64_t fp) const {
+    lock_guard<mutex> lk(mu);
+    auto it = byHash.find(fp);
+    return it == byHash.end() ? -1 : it->second;
+}
+
+void DedupIndex::insert(uint64_t fp, int block, bool replace) {
+    lock_guard<mutex> lk(mu);
+    auto cur = byHash.find(fp);
+    if (cur != byHash.end()) {
+        if (!replace) return;
+        byBlock.erase(cur->second);
+    }
+    auto old = byBlock.find(block);
+    if (old != byBlock.end()) {
+        auto h = byHash.find(old->second);
+        if (h != byHash.end() && h->second == block) byHash.erase(h);
+    }
+    byHash[fp] = block;
+    byBlock[block] = fp;
+}
+
+void DedupIndex::erase(int block) {
+    lock_guard<mutex> lk(mu);
+    auto it = byBlock.find(block);
+    if (it == byBlock.end()) return;
+    auto h = byHash.find(it->second);
+    if (h != byHash.end() && h->second == block) byHash.erase(h);
+    byBlock.erase(it);
+}
+
+DedupStats DedupIndex::stats() const {
+    DedupStats st;
+    st.logicalWrites = logicalWrites.load();
+    st.sharedWrites = sharedWrites.load();
+    st.zeroWrites = zeroWrites.load();
+    st.collisions = collisions.load();
+    lock_guard<mutex> lk(mu);
+    st.indexEntries = (long long)byHash.size();
+    return st;
+}
+
+bool DedupIndex::load(const string& path) {
+    ifstream in(path, ios::binary);
+    if (!in.good()) return false;
+    lock_guard<mutex> lk(mu);
+    int32_t block;
+    uint64_t fp;
+    while (in.read((char*)&block, sizeof(block)) && in.read((char*)&fp, sizeof(fp))) {
+        byHash[fp] = block;
+        byBlock[block] = fp;
+    }
+    return true;
+}
+
+void DedupIndex::save(const string& path) const {
+    ofstream out(path, ios::binary | ios::trunc);
+    lock_guard<mutex> lk(mu);
+    for (auto& p : byBlock) {
+        int32_t block = p.first;
+        out.write((const char*)&block, sizeof(block));
+        out.write((const char*)&p.second, sizeof(p.second));
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef DEDUP_HPP
+#define DEDUP_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Counters for the dedup report, since mount
+struct DedupStats {
+    long long logicalWrites;   // Full data blocks handed to the dedup layer
+    long long sharedWrites;    // ...that reused an identical stored block
+    long long zeroWrites;      // ...that were all zeros and became holes
+    long long collisions;      // Fingerprint matched but the contents differed
+    long long indexEntries;    // Fingerprints currently indexed
+};
+
+// Fingerprint index over data blocks: maps a content hash to the physical
+// block holding that content. A hit is only a candidate; callers compare
+// the bytes before sharing, so a stale or colliding entry is harmless.
+class DedupIndex {
+private:
+    std::unordered_map<uint64_t, int> byHash;
+    std::unordered_map<int, uint64_t> byBlock;
+    mutable std::mutex mu;
+
+public:
+    std::atomic<long long> logicalWrites;
+    std::atomic<long long> sharedWrites;
+    std::atomic<long long> zeroWrites;
+    std::atomic<long long> collisions;
+
+    DedupIndex();
+
+    static uint64_t fingerprint(const std::vector<char>& data);
+
+    int lookup(uint64_t fp) const;       // Candidate block, or -1
+    // An existing entry for fp is kept unless replace: callers replace one
+    // they found to be stale, so it cannot keep hiding the new block
+    void insert(uint64_t fp, int block, bool replace = false);
+    void erase(int block);               // Block freed or about to change
+    DedupStats stats() const;
+
+    // Sidecar file: (int32 block, uint64 fingerprint) pairs
+    bool load(const std::string& path);
+    void save(const std::string& path) const;
+};
+
+#endif
@@ -1,9 +1,17 @@
-#include "Directory.hpp"
-#include "Serializer.hpp"
+#include "directory.hpp"
+#include "serializer.hpp"
+#include "log.hpp"
+#include "lz.hpp"
+#include "stats.hpp"
+#include "treewalk.hpp"
+#include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <functional>
+#include <future>
 using namespace std;
 
 // Helper: convert numeric permission to 'rwx' string
@@ -16,81 +24,372 @@ static string permToStr(int perm, bool isDir) {
     return s;
 }
 
+// Helper: the top of the tree, which holds the append-buffer accounting
+static Directory* rootOf(Directory* d) {
+    while (d->parent) d = d->parent;
+    return d;
+}
+
+// Helper: store a full block of file data at slot i. With dedup on, an
+// all-zero block becomes a hole and content already on disk is shared;
+// otherwise the slot's own block is written, copying first if it is shared
+// (copy-on-write) and allocating if it is a hole. Blocks the slot lets go
+// of are added to released for the caller to free once the tree is saved.
+// Returns false if the disk is full.
+static bool storeBlock(BlockManager* bm, int group, FileMeta& fm, int i, const vector<char>& buffer,
+                       vector<int>& released) {
+    int old = fm.blocks[i];
+    DedupIndex* dd = bm->dedup();
+    uint64_t fp = 0;
+    bool stale = false;  // The index points fp at other content
+    if (dd) {
+        dd->logicalWrites++;
+        bool zero = true;
+        for (char c : buffer) if (c != 0) { zero = false; break; }
+        if (zero) {
+            dd->zeroWrites++;
+            if (old != HOLE_BLOCK) released.push_back(old);
+            fm.blocks[i] = HOLE_BLOCK;
+            return true;
+        }
+        fp = DedupIndex::fingerprint(buffer);
+        int dup = dd->lookup(fp);
+        if (dup != -1 && !bm->isBlockFree(dup)) {
+            vector<char> stored;
+            if (bm->readBlock(dup, stored) && stored == buffer) {
+                dd->sharedWrites++;
+                if (dup != old) {
+                    bm->refBlock(dup);
+                    if (old != HOLE_BLOCK) released.push_back(old);
+                    fm.blocks[i] = dup;
+                }
+                return true;
+            }
+            if (dup != old) dd->collisions++;
+        }
+        stale = dup != -1;
+    }
+
+    if (old == HOLE_BLOCK || bm->getRefCount(old) > 1) {
+        int b = bm->allocateBlock(group);
+        if (b == -1) return false;
+        if (old != HOLE_BLOCK) released.push_back(old);  // drop this file's share
+        fm.blocks[i] = b;
+    } else if (dd) {
+        dd->erase(old);  // contents are about to change
+    }
+    bm->writeBlock(fm.blocks[i], buffer);
+    if (dd) dd->insert(fp, fm.blocks[i], stale);
+    return true;
+}
+
+// Helper: blocks a full flush of fm's append buffer may have to allocate
+// once the file reaches size bytes: the unbacked slots the buffer covers,
+// from the start of its first chunk for a compressed file
+static long long appendNeed(const FileMeta& fm, long long size, int blockSize) {
+    long long diskSize = fm.fileSize - (long long)fm.pendingAppend.size();
+    if (size <= diskSize) return 0;
+    long long first = diskSize / blockSize;
+    long long end = (size + blockSize - 1) / blockSize;
+    if (fm.compressed) first -= first % COMPRESS_CHUNK_BLOCKS;
+    long long need = 0;
+    for (long long i = first; i < end; i++) {
+        if (i >= (long long)fm.blocks.size() || fm.blocks[i] < 0) need++;
+    }
+    return need;
+}
+
+// Helper: make fm's reservation `blocks`. Returns false, keeping the old
+// one, if the free blocks nobody has reserved cannot cover the increase.
+static bool setReserve(BlockManager* bm, FileMeta& fm, long long blocks) {
+    if (!bm->reserveBlocks(blocks - fm.reservedBlocks)) return false;
+    fm.reservedBlocks = blocks;
+    return true;
+}
+
+// Helper: give slots [first, first + count) blocks the caller may overwrite
+// whole, as storeBlock does before it writes: holes are allocated, shared
+// blocks copied on write (the old one goes to released) and the dedup entry
+// of a block about to change is dropped. Returns how many slots from first
+// were backed; fewer than count means the disk is full.
+static int backSlots(BlockManager* bm, int group, FileMeta& fm, int first, int count, vector<int>& released) {
+    DedupIndex* dd = bm->dedup();
+    for (int k = 0; k < count; k++) {
+        int old = fm.blocks[first + k];
+        if (old == HOLE_BLOCK || bm->getRefCount(old) > 1) {
+            int b = bm->allocateBlock(group);
+            if (b == -1) return k;
+            if (old != HOLE_BLOCK) released.push_back(old);
+            fm.blocks[first + k] = b;
+        } else if (dd) {
+            dd->erase(old);
+        }
+    }
+    return count;
+}
+
+// A compressed chunk starts with this header, followed by the LZ data:
+//   uint32 compressed length, uint32 raw length
+static const int CHUNK_HEADER = 8;
+
+// Logical slots of chunk c (the last chunk may be short)
+static int chunkSlots(const FileMeta& fm, int c) {
+    int first = c * COMPRESS_CHUNK_BLOCKS;
+    return max(0, min(COMPRESS_CHUNK_BLOCKS, (int)fm.blocks.size() - first));
+}
+
+// Helper: read chunk c of a compressed file as chunkSlots * blockSize
+// logical bytes, decompressing if the chunk is packed
+static bool readChunk(BlockManager* bm, const FileMeta& fm, int c, vector<char>& out) {
+    int blockSize = bm->getBlockSize();
+    int first = c * COMPRESS_CHUNK_BLOCKS;
+    int n = chunkSlots(fm, c);
+    out.assign((size_t)n * blockSize, 0);
+
+    // Stored slots end at the first packed one
+    int k = n;
+    for (int j = 0; j < n; j++) {
+        if (fm.blocks[first + j] == PACKED_BLOCK) { k = j; break; }
+    }
+    vector<char> stored((size_t)k * blockSize, 0);
+    vector<vector<char>> buffers(k, vector<char>(blockSize, 0));
+    vector<future<bool>> pending;
+    for (int j = 0; j < k; j++) {
+        if (fm.blocks[first + j] >= 0) pending.push_back(bm->readBlockAsync(fm.blocks[first + j], buffers[j]));
+    }
+    bool ok = true;
+    for (auto& f : pending) ok = f.get() && ok;
+    if (!ok) return false;
+    for (int j = 0; j < k; j++) memcpy(stored.data() + (size_t)j * blockSize, buffers[j].data(), blockSize);
+    if (k == n) {
+        out.swap(stored);
+        return true;
+    }
+
+    uint32_t compLen, rawLen;
+    memcpy(&compLen, stored.data(), 4);
+    memcpy(&rawLen, stored.data() + 4, 4);
+    if ((size_t)compLen + CHUNK_HEADER > stored.size() || rawLen > (uint32_t)COMPRESS_CHUNK_BLOCKS * blockSize) {
+        return false;
+    }
+    // The chunk may have been trimmed since it was packed; keep what still fits
+    vector<char> raw(max((size_t)rawLen, out.size()), 0);
+    if (Lz::decompress(stored.data() + CHUNK_HEADER, (int)compLen, raw.data(), (int)rawLen) != (int)rawLen) {
+        return false;
+    }
+    memcpy(out.data(), raw.data(), out.size());
+    return true;
+}
+
+// Helper: store chunk c of a compressed file from chunkSlots * blockSize
+// bytes. It is packed when that saves at least one block, else kept raw.
+// Slots it empties go to released, as for storeBlock.
+static bool writeChunk(BlockManager* bm, int group, FileMeta& fm, int c, const vector<char>& data,
+                       vector<int>& released) {
+    int blockSize = bm->getBlockSize();
+    int first = c * COMPRESS_CHUNK_BLOCKS;
+    int n = chunkSlots(fm, c);
+    for (int j = 0; j < n; j++) {
+        if (fm.blocks[first + j] == PACKED_BLOCK) fm.blocks[first + j] = HOLE_BLOCK;
+    }
+
+    if (data.end() == find_if(data.begin(), data.end(), [](char ch) { return ch != 0; })) {
+        // All zeros: the whole chunk becomes holes
+        for (int j = 0; j < n; j++) {
+            if (fm.blocks[first + j] >= 0) released.push_back(fm.blocks[first + j]);
+            fm.blocks[first + j] = HOLE_BLOCK;
+        }
+        return true;
+    }
+
+    vector<char> packed(CHUNK_HEADER + Lz::bound((int)data.size()), 0);
+    int compLen = n > 1 ? Lz::compress(data.data(), (int)data.size(), packed.data() + CHUNK_HEADER,
+                                       (int)packed.size() - CHUNK_HEADER) : 0;
+    int k = (compLen + CHUNK_HEADER + blockSize - 1) / blockSize;
+    if (compLen > 0 && k < n) {
+        uint32_t header[2] = { (uint32_t)compLen, (uint32_t)data.size() };
+        memcpy(packed.data(), header, CHUNK_HEADER);
+        packed.resize(max(packed.size(), (size_t)k * blockSize), 0);
+        for (int j = 0; j < k; j++) {
+            vector<char> buffer(packed.begin() + (size_t)j * blockSize, packed.begin() + (size_t)(j + 1) * blockSize);
+            if (!storeBlock(bm, group, fm, first + j, buffer, released)) return false;
+        }
+        for (int j = k; j < n; j++) {
+            if (fm.blocks[first + j] >= 0) released.push_back(fm.blocks[first + j]);
+            fm.blocks[first + j] = PACKED_BLOCK;
+        }
+        return true;
+    }
+
+    for (int j = 0; j < n; j++) {
+        vector<char> buffer(data.begin() + (size_t)j * blockSize, data.begin() + (size_t)(j + 1) * blockSize);
+        if (!storeBlock(bm, group, fm, first + j, buffer, released)) return false;
+    }
+    return true;
+}
+
 Directory::Directory(const string& name_, Directory* parent_, BlockManager* blockManager) {
     name = name_;
     parent = parent_;
     bm = blockManager;
     permissions = 7; // default to rwx for directories
+    bufferedBytes = 0;
+    batchDepth = 0;
+    treeDirty = false;
+    feed = nullptr;
+    treeBytes = treeFiles = treeDirs = 0;
+    // Spread directories over the emptiest groups; files inside stay together
+    allocGroup = bm ? bm->pickDirectoryGroup() : 0;
 }
 
-bool Directory::createFile(const string& filename, int size) {
+bool Directory::createFile(const string& filename, long long size) {
+    Stats::Timer timer(Stats::OP_CREATE);
     // require write permission on this directory
     if ((permissions & 2) == 0) {
-        cout << "[ERROR] Permission denied: cannot create file in this directory\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot create file in this directory");
         return false;
     }
     if (files.find(filename) != files.end()) {
-        cout << "[ERROR] File already exists!\n";
+        FS_FAIL(FS_EXISTS, "File already exists!");
         return false;
     }
 
     int blockSize = bm->getBlockSize();
-    int numBlocks = (int)ceil((double)size / blockSize);
-
-    int idxBlock = bm->allocateBlock();
-    if (idxBlock == -1) {
-        cout << "[ERROR] No free blocks for index block.\n";
+    long long numBlocks = (size + blockSize - 1) / blockSize;
+    if (numBlocks > Serializer::indexCapacity(*bm)) {
+        FS_FAIL(FS_TOO_LARGE, "File too large: index block holds at most "
+             << Serializer::indexCapacity(*bm) << " blocks");
         return false;
     }
 
     FileMeta fm;
     fm.filename = filename;
     fm.fileSize = size;
-    fm.indexBlock = idxBlock;
     fm.permissions = 6; // default file permissions: rw-
-
-    for (int i = 0; i < numBlocks; i++) {
-        int b = bm->allocateBlock();
-        if (b == -1) {
-            cout << "[ERROR] Not enough free blocks, rolling back...\n";
-            for (int blk : fm.blocks) bm->freeBlock(blk);
-            bm->freeBlock(idxBlock);
+    fm.compressed = bm->compressNewFiles();
+    if (size <= bm->getInlineLimit()) {
+        // Small enough to live in the directory entry: no blocks at all
+        fm.inlineData.assign((size_t)size, '\0');
+    } else {
+        int idxBlock = bm->allocateBlock(allocGroup);
+        if (idxBlock == -1) {
+            FS_FAIL(FS_NO_SPACE, "No free blocks for index block.");
             return false;
         }
-        fm.blocks.push_back(b);
+        fm.indexBlock = idxBlock;
+        // The file starts fully sparse; data blocks are allocated on first write
+        fm.blocks.assign(numBlocks, HOLE_BLOCK);
+        Serializer::writeIndexBlock(*bm, fm);
     }
 
-    Serializer::writeIndexBlock(*bm, fm);
     files[filename] = fm;
-    saveDirectory();  // Auto-save directory after create
-    cout << "[INFO] File created: " << filename << "\n";
+    bm->adjustUsage(1, 0);
+    addToTree(size, 1, 0);
+    if (!saveDirectory()) {  // Auto-save directory after create
+        files.erase(filename);
+        bm->adjustUsage(-1, 0);
+        addToTree(-size, -1, 0);
+        bm->freeBlock(fm.indexBlock);
+        return false;
+    }
+    FS_LOG(LOG_INFO, "File created: " << filename);
+    notify(CHANGE_CREATE, filename);
     return true;
 }
 
 bool Directory::deleteFile(const std::string& filename) {
+    Stats::Timer timer(Stats::OP_DELETE);
     // must have write permission on directory to delete file
     if ((permissions & 2) == 0) {
-        cout << "[ERROR] Permission denied: cannot delete file in this directory\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot delete file in this directory");
         return false;
     }
     auto it = files.find(filename);
-    if (it == files.end()) return false;
-
-    FileMeta& fm = it->second;
+    if (it == files.end()) {
+        setStatus(FS_NOT_FOUND);
+        return false;
+    }
 
-    // Free data blocks
-    for (int blk : fm.blocks) {
-        bm->freeBlock(blk);
+    // Remove from directory; the blocks are freed once the tree without
+    // the entry is saved
+    dropBuffer(it->second);
+    FileMeta gone = std::move(it->second);
+    files.erase(it);
+    addToTree(-gone.fileSize, -1, 0);
+    bm->adjustUsage(-1, 0);
+    if (!saveDirectory()) {
+        addToTree(gone.fileSize, 1, 0);
+        bm->adjustUsage(1, 0);
+        FileMeta& back = files[filename] = std::move(gone);
+        trackBuffer(back, 0);
+        return false;
     }
+    bm->reserveBlocks(-gone.reservedBlocks);
 
-    // Free index block
-    bm->freeBlock(fm.indexBlock);
+    // Free data blocks and the index block
+    vector<int> owned;
+    for (int blk : gone.blocks) if (blk >= 0) owned.push_back(blk);
+    owned.push_back(gone.indexBlock);
+    releaseBlocks(std::move(owned));
+    FS_LOG(LOG_INFO, "File deleted: " << filename);
+    notify(CHANGE_DELETE, filename);
+    return true;
+}
 
-    // Remove from directory
-    files.erase(it);
+bool Directory::cloneFile(const string& src, const string& dst) {
+    if ((permissions & 2) == 0) {
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot create file in this directory");
+        return false;
+    }
+    auto it = files.find(src);
+    if (it == files.end()) {
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
+        return false;
+    }
+    if (files.find(dst) != files.end()) {
+        FS_FAIL(FS_EXISTS, "File already exists!");
+        return false;
+    }
+    FileMeta& from = it->second;
+    if ((from.permissions & 4) == 0) {
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot read file");
+        return false;
+    }
+    // Buffered appends have no blocks to share yet
+    if (!flushAppend(from, true)) return false;
+
+    FileMeta fm = from;
+    fm.filename = dst;
+    fm.reservedBlocks = 0;
+    fm.createdAt = fm.modifiedAt = time(nullptr);
+    if (!fm.isInline()) {
+        // Only the index block is new; each data block gains an owner and
+        // is copied on the first write through either file
+        int idxBlock = bm->allocateBlock(allocGroup);
+        if (idxBlock == -1) {
+            FS_FAIL(FS_NO_SPACE, "No free blocks for index block.");
+            return false;
+        }
+        fm.indexBlock = idxBlock;
+        for (int b : fm.blocks) if (b >= 0) bm->refBlock(b);
+        Serializer::writeIndexBlock(*bm, fm);
+    }
 
-    saveDirectory();
-    cout << "[INFO] File deleted: " << filename << endl;
+    files[dst] = fm;
+    bm->adjustUsage(1, 0);
+    addToTree(fm.fileSize, 1, 0);
+    if (!saveDirectory()) {
+        files.erase(dst);
+        bm->adjustUsage(-1, 0);
+        addToTree(-fm.fileSize, -1, 0);
+        vector<int> owned;
+        for (int b : fm.blocks) if (b >= 0) owned.push_back(b);
+        owned.push_back(fm.indexBlock);
+        bm->freeBlocks(std::move(owned));
+        return false;
+    }
+    FS_LOG(LOG_INFO, "Cloned " << src << " to " << dst);
+    notify(CHANGE_CREATE, dst);
     return true;
 }
 
@@ -107,7 +406,7 @@ bool Directory::hasFile(const string& filename) {
 
 void Directory::listFiles() {
     if ((permissions & 4) == 0) {
-        cout << "[ERROR] Permission denied: cannot list files in this directory\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot list files in this directory");
         return;
     }
     if (files.empty()) {
@@ -120,171 +419,423 @@ void Directory::listFiles() {
 }
 
 Directory* Directory::findSubdir(const string& name) {
-    for (auto& d : subdirs) {
-        if (d->name == name) return d.get();
+    auto it = subdirIndex.find(name);
+    return it == subdirIndex.end() ? nullptr : it->second;
+}
+
+void Directory::attachSubdir(unique_ptr<Directory> d, size_t pos) {
+    d->parent = this;
+    subdirIndex[d->name] = d.get();
+    if (pos > subdirs.size()) pos = subdirs.size();
+    subdirs.insert(subdirs.begin() + pos, std::move(d));
+}
+
+unique_ptr<Directory> Directory::detachSubdir(Directory* d, size_t* pos) {
+    size_t i = 0;
+    while (subdirs[i].get() != d) i++;
+    unique_ptr<Directory> gone = std::move(subdirs[i]);
+    subdirs.erase(subdirs.begin() + i);
+    subdirIndex.erase(d->name);
+    if (pos) *pos = i;
+    return gone;
+}
+
+void Directory::addToTree(long long bytes, long long files, long long dirs) {
+    for (Directory* d = this; d; d = d->parent) {
+        d->treeBytes += bytes;
+        d->treeFiles += files;
+        d->treeDirs += dirs;
+    }
+}
+
+void Directory::setFileSize(FileMeta& fm, long long size) {
+    addToTree(size - fm.fileSize, 0, 0);
+    fm.fileSize = size;
+}
+
+void Directory::trackBuffer(FileMeta& fm, long long oldBytes) {
+    Directory* root = rootOf(this);
+    long long bytes = (long long)fm.pendingAppend.size();
+    root->bufferedBytes += bytes - oldBytes;
+    if (oldBytes > 0) root->buffered.erase(BufferedFile{oldBytes, &fm, this});
+    if (bytes > 0) root->buffered.insert(BufferedFile{bytes, &fm, this});
+}
+
+void Directory::dropBuffer(FileMeta& fm) {
+    Directory* root = rootOf(this);
+    long long bytes = (long long)fm.pendingAppend.size();
+    root->bufferedBytes -= bytes;
+    if (bytes > 0) root->buffered.erase(BufferedFile{bytes, &fm, this});
+}
+
+void Directory::recountTree() {
+    treeBytes = 0;
+    treeFiles = (long long)files.size();
+    treeDirs = (long long)subdirs.size();
+    for (auto& p : files) treeBytes += p.second.fileSize;
+    for (auto& sd : subdirs) {
+        sd->recountTree();
+        treeBytes += sd->treeBytes;
+        treeFiles += sd->treeFiles;
+        treeDirs += sd->treeDirs;
     }
-    return nullptr;
+}
+
+void Directory::notify(ChangeType type, const string& name) {
+    ChangeFeed* f = rootOf(this)->feed;
+    if (!f || !f->active()) return;
+    ChangeEvent e;
+    e.type = type;
+    e.path = "/" + name;
+    for (Directory* d = this; d; d = d->parent) e.path = "/" + d->name + e.path;
+    auto it = files.find(name);
+    e.size = it != files.end() ? it->second.fileSize : -1;
+    f->publish(e);
 }
 
 bool Directory::addSubdir(const string& name) {
+    Stats::Timer timer(Stats::OP_MKDIR);
     if ((permissions & 2) == 0) {
-        cout << "[ERROR] Permission denied: cannot create subdirectory\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot create subdirectory");
+        return false;
+    }
+    if (findSubdir(name) != nullptr) {
+        setStatus(FS_EXISTS);
         return false;
     }
-    if (findSubdir(name) != nullptr) return false;
-    subdirs.emplace_back(new Directory(name, this, bm));
-    saveDirectory();
-    cout << "[INFO] Directory created: " << name << "\n";
+    Directory* made = new Directory(name, this, bm);
+    attachSubdir(unique_ptr<Directory>(made));
+    bm->adjustUsage(0, 1);
+    addToTree(0, 0, 1);
+    if (!saveDirectory()) {
+        detachSubdir(made);
+        bm->adjustUsage(0, -1);
+        addToTree(0, 0, -1);
+        return false;
+    }
+    FS_LOG(LOG_INFO, "Directory created: " << name);
+    notify(CHANGE_MKDIR, name);
     return true;
 }
 
 bool Directory::removeSubdir(const string& name) {
     if ((permissions & 2) == 0) {
-        cout << "[ERROR] Permission denied: cannot remove subdirectory\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot remove subdirectory");
         return false;
     }
-    for (size_t i = 0; i < subdirs.size(); ++i) {
-        if (subdirs[i]->name == name) {
-            // only allow removal if empty
-            if (!subdirs[i]->files.empty() || !subdirs[i]->subdirs.empty()) {
-                cout << "[ERROR] Directory not empty: " << name << "\n";
-                return false;
-            }
-            subdirs.erase(subdirs.begin() + i);
-            saveDirectory();
-            cout << "[INFO] Directory removed: " << name << "\n";
-            return true;
-        }
+    Directory* target = findSubdir(name);
+    if (!target) {
+        setStatus(FS_NOT_FOUND);
+        return false;
     }
-    return false;
-}
-
-// Recursive helper to free blocks and delete contents
-static void removeDirectoryRecursive(Directory* dir, BlockManager& bm) {
-    // Free files
-    for (auto& p : dir->files) {
-        FileMeta& fm = const_cast<FileMeta&>(p.second);
-        // free data blocks
-        for (int blk : fm.blocks) bm.freeBlock(blk);
-        // free index block
-        if (fm.indexBlock != -1) bm.freeBlock(fm.indexBlock);
+    // only allow removal if empty
+    if (!target->files.empty() || !target->subdirs.empty()) {
+        FS_FAIL(FS_NOT_EMPTY, "Directory not empty: " << name);
+        return false;
     }
-    dir->files.clear();
-
-    // Recurse into subdirs
-    for (auto& sd : dir->subdirs) {
-        removeDirectoryRecursive(sd.get(), bm);
+    size_t pos;
+    unique_ptr<Directory> gone = detachSubdir(target, &pos);
+    bm->adjustUsage(0, -1);
+    addToTree(0, 0, -1);
+    if (!saveDirectory()) {
+        attachSubdir(std::move(gone), pos);
+        bm->adjustUsage(0, 1);
+        addToTree(0, 0, 1);
+        return false;
     }
-    // clear subdirs vector (unique_ptr destructors will run)
-    dir->subdirs.clear();
+    FS_LOG(LOG_INFO, "Directory removed: " << name);
+    notify(CHANGE_RMDIR, name);
+    return true;
 }
 
 bool Directory::removeDirectory(const string& name, BlockManager& bm) {
+    Stats::Timer timer(Stats::OP_RMDIR);
     if ((permissions & 2) == 0) {
-        cout << "[ERROR] Permission denied: cannot remove directory\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot remove directory");
         return false;
     }
     Directory* target = findSubdir(name);
-    if (!target) return false;
-
-    // Perform recursive deletion
-    removeDirectoryRecursive(target, bm);
+    if (!target) {
+        setStatus(FS_NOT_FOUND);
+        return false;
+    }
 
-    // remove entry from subdirs
-    for (size_t i = 0; i < subdirs.size(); ++i) {
-        if (subdirs[i]->name == name) {
-            subdirs.erase(subdirs.begin() + i);
-            break;
+    // Gather every block in the subtree in parallel, one list per worker,
+    // then release them all in a single bitmap pass
+    int n = TreeWalk::workers();
+    vector<vector<int>> blocks(n);
+    vector<vector<pair<Directory*, FileMeta*>>> withBuffer(n);
+    vector<long long> reserved(n, 0);
+    TreeWalk::run(target, [&](Directory* d, int w) {
+        for (auto& p : d->files) {
+            FileMeta& fm = p.second;
+            if (!fm.pendingAppend.empty()) withBuffer[w].push_back(make_pair(d, &fm));
+            reserved[w] += fm.reservedBlocks;
+            for (int blk : fm.blocks) if (blk >= 0) blocks[w].push_back(blk);
+            if (fm.indexBlock != -1) blocks[w].push_back(fm.indexBlock);
         }
+    });
+
+    // Detach the subtree; its blocks are freed once the tree without it is saved
+    size_t pos;
+    unique_ptr<Directory> gone = detachSubdir(target, &pos);
+    bm.adjustUsage(-target->treeFiles, -(target->treeDirs + 1));
+    addToTree(-target->treeBytes, -target->treeFiles, -(target->treeDirs + 1));
+    if (!saveDirectory()) {
+        bm.adjustUsage(target->treeFiles, target->treeDirs + 1);
+        addToTree(target->treeBytes, target->treeFiles, target->treeDirs + 1);
+        attachSubdir(std::move(gone), pos);
+        return false;
     }
 
-    // persist changes
-    saveDirectory();
-    cout << "[INFO] Directory recursively removed: " << name << "\n";
+    vector<int> all;
+    for (auto& v : blocks) all.insert(all.end(), v.begin(), v.end());
+    releaseBlocks(std::move(all));
+    for (auto& v : withBuffer) for (auto& p : v) p.first->dropBuffer(*p.second);
+    for (long long r : reserved) bm.reserveBlocks(-r);
+    FS_LOG(LOG_INFO, "Directory recursively removed: " << name);
+    notify(CHANGE_RMDIR, name);
     return true;
 }
 
 void Directory::listContents() {
+    // Page through readdir so even a huge directory is listed in bounded memory
+    DirCursor cursor;
+    vector<DirEntry> page;
+    while (!cursor.done) {
+        if (!readdir(cursor, 256, page)) return;
+        for (auto& e : page) {
+            if (e.isDir) cout << permToStr(e.permissions, true) << "  " << "-" << "  " << e.name << "/\n";
+            else cout << permToStr(e.permissions, false) << "  " << e.size << "B  " << e.name << "\n";
+        }
+    }
+}
+
+bool Directory::readdir(DirCursor& cursor, size_t max, vector<DirEntry>& out) {
+    out.clear();
     if ((permissions & 4) == 0) {
-        cout << "[ERROR] Permission denied: cannot list directory contents\n";
-        return;
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot list directory contents");
+        return false;
     }
-    // List subdirectories first
-    for (auto& d : subdirs) {
-        cout << permToStr(d->permissions, true) << "  " << "-" << "  " << d->name << "/\n";
+    if (cursor.done || max == 0) return true;
+
+    if (!cursor.inFiles) {
+        // Subdirectories are indexed by name too, so this resumes like files
+        auto it = cursor.after.empty() ? subdirIndex.begin() : subdirIndex.upper_bound(cursor.after);
+        for (; it != subdirIndex.end() && out.size() < max; ++it) {
+            const Directory* d = it->second;
+            DirEntry e = { d->name, true, d->treeBytes, d->permissions, 0, 0, false, false };
+            out.push_back(e);
+            cursor.after = it->first;
+        }
+        if (it != subdirIndex.end()) return true;
+        cursor.inFiles = true;
+        cursor.after.clear();
     }
-    // Then files
-    for (auto& p : files) {
-        cout << permToStr(p.second.permissions, false) << "  " << p.second.fileSize << "B  " << p.first << "\n";
+
+    // Files are a sorted map, so resuming is one lookup
+    auto it = cursor.after.empty() ? files.begin() : files.upper_bound(cursor.after);
+    for (; it != files.end() && out.size() < max; ++it) {
+        const FileMeta& fm = it->second;
+        DirEntry e = { it->first, false, fm.fileSize, fm.permissions, fm.createdAt, fm.modifiedAt,
+                       fm.isInline(), fm.compressed };
+        out.push_back(e);
+        cursor.after = it->first;
     }
+    if (it == files.end()) cursor.done = true;
+    return true;
 }
 
 bool Directory::writeFile(const string& filename, const string& content) {
+    Stats::Timer timer(Stats::OP_WRITE);
     if (!hasFile(filename)) {
-        cout << "[ERROR] File not found!\n";
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
         return false;
     }
     FileMeta& fm = files[filename];  // Get reference directly from map
     if ((fm.permissions & 2) == 0) {
-        cout << "[ERROR] Permission denied: cannot write file\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot write file");
         return false;
     }
+    FileMeta before = fm;
+    vector<int> released;
+    // The new content replaces anything still buffered
+    discardAppend(fm);
 
     int blockSize = bm->getBlockSize();
-    int bytesLeft = content.size();
-    int offset = 0;
+    if (fm.isInline()) {
+        if ((long long)content.size() <= bm->getInlineLimit()) {
+            fm.inlineData = content;
+            setFileSize(fm, content.size());
+            fm.modifiedAt = time(nullptr);
+            if (!commitFile(fm, before, released)) return false;
+            FS_LOG(LOG_INFO, "Wrote " << fm.fileSize << " bytes to " << filename);
+            notify(CHANGE_WRITE, filename);
+            return true;
+        }
+        // Outgrew the directory entry: give it enough blocks for the content
+        if (!promoteInline(fm)) return false;
+        before = fm;  // Promotion is saved on its own
+        long long needed = min<long long>((content.size() + blockSize - 1) / blockSize, Serializer::indexCapacity(*bm));
+        if ((long long)fm.blocks.size() < needed) fm.blocks.resize(needed, HOLE_BLOCK);
+    }
+    if (fm.compressed) {
+        // Whole chunks are rebuilt; bytes past the content in the last chunk are zero
+        long long len = min<long long>(content.size(), (long long)fm.blocks.size() * blockSize);
+        long long written = 0;
+        bool full = false;
+        int chunks = (int)((fm.blocks.size() + COMPRESS_CHUNK_BLOCKS - 1) / COMPRESS_CHUNK_BLOCKS);
+        for (int c = 0; c < chunks; c++) {
+            long long start = (long long)c * COMPRESS_CHUNK_BLOCKS * blockSize;
+            if (start >= len && c > 0) break;
+            vector<char> data((size_t)chunkSlots(fm, c) * blockSize, 0);
+            long long count = min<long long>(data.size(), len - start);
+            if (count > 0) memcpy(data.data(), content.data() + start, (size_t)count);
+            if (!writeChunk(bm, allocGroup, fm, c, data, released)) {
+                FS_FAIL(FS_NO_SPACE, "Not enough free blocks to write file!");
+                full = true;
+                break;
+            }
+            written = start + max<long long>(count, 0);
+        }
+        setFileSize(fm, written);
+        fm.modifiedAt = time(nullptr);
+        if (!commitFile(fm, before, released)) return false;
+        FS_LOG(LOG_INFO, "Wrote " << fm.fileSize << " bytes to " << filename);
+        notify(CHANGE_WRITE, filename);
+        return !full;  // A short write keeps the chunks that fit
+    }
 
-    for (int blk : fm.blocks) {
+    long long bytesLeft = content.size();
+    long long offset = 0;
+    bool full = false;
+
+    for (int i = 0; i < (int)fm.blocks.size(); i++) {
         vector<char> buffer(blockSize, 0);
-        int toWrite = min(bytesLeft, blockSize);
-        if (offset < (int)content.size()) {
-            int canCopy = min(toWrite, (int)content.size() - offset);
+        int toWrite = (int)min<long long>(bytesLeft, blockSize);
+        if (offset < (long long)content.size()) {
+            int canCopy = (int)min<long long>(toWrite, (long long)content.size() - offset);
             memcpy(buffer.data(), content.data() + offset, canCopy);
         }
-        bm->writeBlock(blk, buffer);
+        if (!storeBlock(bm, allocGroup, fm, i, buffer, released)) {
+            FS_FAIL(FS_NO_SPACE, "Not enough free blocks to write file!");
+            full = true;
+            break;
+        }
 
         offset += toWrite;
         bytesLeft -= toWrite;
         if (bytesLeft <= 0) break;
     }
 
-    fm.fileSize = content.size();
+    setFileSize(fm, min((long long)content.size(), offset));
     fm.modifiedAt = time(nullptr);  // Update modification time
-    Serializer::writeIndexBlock(*bm, fm);
-    saveDirectory();  // Persist updated file metadata
-    cout << "[INFO] Wrote " << content.size() << " bytes to " << filename << "\n";
-    return true;
+    if (!commitFile(fm, before, released)) return false;  // Persist updated file metadata
+    Stats::add(Stats::LOGICAL_WRITTEN, (long long)content.size());
+    FS_LOG(LOG_INFO, "Wrote " << fm.fileSize << " bytes to " << filename);
+    notify(CHANGE_WRITE, filename);
+    return !full;  // A short write keeps the blocks that fit
 }
 
 string Directory::readFile(const string& filename) {
+    Stats::Timer timer(Stats::OP_READ);
     if (!hasFile(filename)) {
-        cout << "[ERROR] File not found!\n";
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
         return "";
     }
     FileMeta& fm = files[filename];  // Get reference directly from map
     if ((fm.permissions & 4) == 0) {
-        cout << "[ERROR] Permission denied: cannot read file\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot read file");
         return "";
     }
 
+    // Inline files are answered from the directory entry without any I/O
+    if (fm.isInline()) {
+        Stats::add(Stats::LOGICAL_READ, (long long)fm.inlineData.size());
+        return fm.inlineData;
+    }
+
     int blockSize = bm->getBlockSize();
     string result;
-    int bytesLeft = fm.fileSize;
-
-    for (int blk : fm.blocks) {
-        vector<char> buffer;
-        bm->readBlock(blk, buffer);
-        int toRead = min(bytesLeft, (int)buffer.size());
-        if (toRead > 0) {
-            result.append(buffer.begin(), buffer.begin() + toRead);
+    long long diskSize = fm.fileSize - (long long)fm.pendingAppend.size();
+    long long bytesLeft = diskSize;
+
+    int neededBlocks = (int)min<long long>(fm.blocks.size(), (diskSize + blockSize - 1) / blockSize);
+    if (fm.compressed) {
+        // Decompress chunk by chunk
+        vector<char> data;
+        for (int c = 0; c * COMPRESS_CHUNK_BLOCKS < neededBlocks && bytesLeft > 0; c++) {
+            if (!readChunk(bm, fm, c, data)) {
+                FS_FAIL(FS_CORRUPT, "Corrupt compressed chunk " << c << " in " << filename);
+                return "";
+            }
+            long long take = min<long long>(bytesLeft, data.size());
+            result.append(data.begin(), data.begin() + take);
+            bytesLeft -= take;
+        }
+        result += fm.pendingAppend;
+        Stats::add(Stats::LOGICAL_READ, (long long)result.size());
+        return result;
+    }
+
+    // Issue every data block read up front so they are all in flight at once
+    vector<vector<char>> buffers(neededBlocks, vector<char>(blockSize, 0));
+    vector<future<bool>> pending;
+    for (int i = 0; i < neededBlocks; i++) {
+        if (fm.blocks[i] != HOLE_BLOCK) pending.push_back(bm->readBlockAsync(fm.blocks[i], buffers[i]));
+    }
+    // Wait for every request (they write into buffers) before failing
+    bool ok = true;
+    for (auto& f : pending) ok = f.get() && ok;
+    if (!ok) {
+        FS_FAIL(FS_IO_ERROR, "Failed to read data blocks of " << filename);
+        return "";
+    }
+
+    for (int i = 0; i < neededBlocks; i++) {
+        int toRead = (int)min<long long>(bytesLeft, blockSize);
+        if (fm.blocks[i] == HOLE_BLOCK) {
+            // Holes read back as zeros without touching the disk
+            result.append(toRead, '\0');
+        } else if (toRead > 0) {
+            result.append(buffers[i].begin(), buffers[i].begin() + toRead);
         }
         bytesLeft -= toRead;
         if (bytesLeft <= 0) break;
     }
 
+    // Buffered appends not yet flushed
+    result += fm.pendingAppend;
+    Stats::add(Stats::LOGICAL_READ, (long long)result.size());
     return result;
 }
 
+bool Directory::readBlocks(const FileMeta& fm, int first, int count, vector<char>& out) {
+    int blockSize = bm->getBlockSize();
+    count = max(0, min(count, (int)fm.blocks.size() - first));
+    out.assign((size_t)count * blockSize, 0);
+    if (fm.compressed) {
+        if (first % COMPRESS_CHUNK_BLOCKS != 0) return false;
+        vector<char> data;
+        for (int done = 0; done < count; done += COMPRESS_CHUNK_BLOCKS) {
+            if (!readChunk(bm, fm, (first + done) / COMPRESS_CHUNK_BLOCKS, data)) return false;
+            size_t take = min(data.size(), out.size() - (size_t)done * blockSize);
+            memcpy(out.data() + (size_t)done * blockSize, data.data(), take);
+        }
+        return true;
+    }
+
+    vector<vector<char>> buffers(count, vector<char>(blockSize, 0));
+    vector<future<bool>> pending;
+    for (int i = 0; i < count; i++) {
+        if (fm.blocks[first + i] >= 0) pending.push_back(bm->readBlockAsync(fm.blocks[first + i], buffers[i]));
+    }
+    bool ok = true;
+    for (auto& f : pending) ok = f.get() && ok;
+    for (int i = 0; i < count; i++) memcpy(out.data() + (size_t)i * blockSize, buffers[i].data(), blockSize);
+    return ok;
+}
+
 // Helper function to format timestamp
 static string formatTimestamp(long timestamp) {
     if (timestamp == 0) return "Not set";
@@ -297,236 +848,656 @@ static string formatTimestamp(long timestamp) {
 
 void Directory::infoFile(const string& filename) {
     if (!hasFile(filename)) {
-        cout << "[ERROR] File not found!\n";
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
         return;
     }
     FileMeta fm = getFile(filename);
     cout << "\n=== File Information ===\n";
     cout << "Name:             " << fm.filename << "\n";
     cout << "Size:             " << fm.fileSize << " bytes\n";
-    cout << "Index Block:      " << fm.indexBlock << "\n";
+    if (fm.isInline()) cout << "Index Block:      none (data stored inline in directory entry)\n";
+    else cout << "Index Block:      " << fm.indexBlock << "\n";
     cout << "Data Blocks:      ";
     for (int i = 0; i < (int)fm.blocks.size(); i++) {
         if (i > 0) cout << ", ";
-        cout << fm.blocks[i];
+        if (fm.blocks[i] == HOLE_BLOCK) cout << "hole";
+        else if (fm.blocks[i] == PACKED_BLOCK) cout << "packed";
+        else cout << fm.blocks[i];
     }
     cout << "\n";
     cout << "Created:          " << formatTimestamp(fm.createdAt) << "\n";
     cout << "Modified:         " << formatTimestamp(fm.modifiedAt) << "\n";
     cout << "Permissions:      " << permToStr(fm.permissions, false) << " (" << fm.permissions << ")\n";
+    if (fm.compressed) cout << "Compressed:       yes (" << COMPRESS_CHUNK_BLOCKS << "-block chunks)\n";
+    if (!fm.pendingAppend.empty()) {
+        cout << "Buffered:         " << fm.pendingAppend.size() << " bytes (not yet on disk)\n";
+    }
     cout << "========================\n\n";
 }
 
 bool Directory::appendFile(const string& filename, const string& data) {
+    Stats::Timer timer(Stats::OP_APPEND);
     if (!hasFile(filename)) {
-        cout << "[ERROR] File not found!\n";
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
         return false;
     }
     
     if (data.empty()) {
-        cout << "[ERROR] Cannot append empty data!\n";
+        FS_FAIL(FS_INVALID, "Cannot append empty data!");
         return false;
     }
     
     FileMeta& fm = files[filename];
     if ((fm.permissions & 2) == 0) {
-        cout << "[ERROR] Permission denied: cannot append file\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot append file");
         return false;
     }
     int blockSize = bm->getBlockSize();
-    int currentSize = fm.fileSize;
-    int newSize = currentSize + data.size();
-    int currentBlocks = (int)ceil((double)currentSize / blockSize);
-    int requiredBlocks = (int)ceil((double)newSize / blockSize);
-    int additionalBlocks = requiredBlocks - currentBlocks;
+    long long newSize = fm.fileSize + (long long)data.size();
+    if (fm.isInline()) {
+        if (newSize <= bm->getInlineLimit()) {
+            FileMeta before = fm;
+            vector<int> released;
+            fm.inlineData += data;
+            setFileSize(fm, newSize);
+            fm.modifiedAt = time(nullptr);
+            if (!commitFile(fm, before, released)) return false;
+            Stats::add(Stats::LOGICAL_WRITTEN, (long long)data.size());
+            FS_LOG(LOG_INFO, "Appended " << data.size() << " bytes to " << filename
+                 << " (total size: " << newSize << " bytes)");
+            notify(CHANGE_APPEND, filename);
+            return true;
+        }
+        if (!promoteInline(fm)) return false;
+    }
+    long long requiredBlocks = (newSize + blockSize - 1) / blockSize;
+    if (requiredBlocks > Serializer::indexCapacity(*bm)) {
+        FS_FAIL(FS_TOO_LARGE, "File too large: index block holds at most "
+             << Serializer::indexCapacity(*bm) << " blocks");
+        return false;
+    }
+    // Blocks are only allocated at flush time; reserve the ones the buffer
+    // will need, so other appends and writes cannot take them first
+    if (!setReserve(bm, fm, appendNeed(fm, newSize, blockSize))) {
+        FS_FAIL(FS_NO_SPACE, "Not enough free blocks for append operation!");
+        return false;
+    }
     
-    // Allocate additional blocks if needed
-    vector<int> newBlocks;
-    if (additionalBlocks > 0) {
-        for (int i = 0; i < additionalBlocks; i++) {
-            int b = bm->allocateBlock();
-            if (b == -1) {
-                cout << "[ERROR] Not enough free blocks for append operation!\n";
-                // Free any blocks we allocated
-                for (int blk : newBlocks) bm->freeBlock(blk);
+    long long held = (long long)fm.pendingAppend.size();
+    fm.pendingAppend += data;
+    setFileSize(fm, newSize);
+    fm.modifiedAt = time(nullptr);
+    trackBuffer(fm, held);
+
+    // A full buffer goes out as whole blocks; the partial tail stays buffered
+    if ((int)fm.pendingAppend.size() >= APPEND_BUFFER_BLOCKS * blockSize && !flushAppend(fm, false)) {
+        // The flush put the buffer back as it was; take this append out of it
+        held = (long long)fm.pendingAppend.size();
+        fm.pendingAppend.resize(fm.pendingAppend.size() - data.size());
+        setFileSize(fm, newSize - (long long)data.size());
+        trackBuffer(fm, held);
+        setReserve(bm, fm, appendNeed(fm, fm.fileSize, blockSize));
+        return false;
+    }
+    Stats::add(Stats::LOGICAL_WRITTEN, (long long)data.size());
+
+    // Over the tree-wide budget: evict the largest buffers until at half.
+    // This append has succeeded either way; a victim that cannot be
+    // flushed keeps its buffer.
+    Directory* root = rootOf(this);
+    long long budget = (long long)APPEND_BUDGET_BLOCKS * blockSize;
+    while (root->bufferedBytes > budget && !root->buffered.empty()) {
+        BufferedFile victim = *root->buffered.rbegin();
+        if (!victim.dir->flushAppend(*victim.fm, true)) break;
+        if (root->bufferedBytes <= budget / 2) break;
+    }
+
+    FS_LOG(LOG_INFO, "Appended " << data.size() << " bytes to " << filename 
+         << " (total size: " << newSize << " bytes)");
+    notify(CHANGE_APPEND, filename);
+    return true;
+}
+
+bool Directory::flushAppend(FileMeta& fm, bool all) {
+    if (fm.pendingAppend.empty()) return true;
+
+    int blockSize = bm->getBlockSize();
+    long long diskSize = fm.fileSize - (long long)fm.pendingAppend.size();
+    int n = (int)fm.pendingAppend.size();
+    if (!all) {
+        // Only write up to the last block boundary
+        n = (int)(((diskSize + n) / blockSize) * blockSize - diskSize);
+        if (n <= 0) return true;
+    }
+    FileMeta before = fm;
+    vector<int> released;
+    setReserve(bm, fm, 0);  // the allocations below draw on it
+    int firstBlock = (int)(diskSize / blockSize);
+    int requiredBlocks = (int)((diskSize + n + blockSize - 1) / blockSize);
+    if ((int)fm.blocks.size() < requiredBlocks) fm.blocks.resize(requiredBlocks, HOLE_BLOCK);
+
+    if (fm.compressed) {
+        // Rebuild each chunk the buffered bytes land in
+        long long end = diskSize + n;
+        vector<char> data;
+        for (int c = firstBlock / COMPRESS_CHUNK_BLOCKS; c <= (requiredBlocks - 1) / COMPRESS_CHUNK_BLOCKS; c++) {
+            long long chunkStart = (long long)c * COMPRESS_CHUNK_BLOCKS * blockSize;
+            if (!readChunk(bm, fm, c, data)) {
+                undoFile(fm, before, released);
+                return false;
+            }
+            long long from = max(diskSize, chunkStart);
+            long long to = min(end, chunkStart + (long long)data.size());
+            memcpy(data.data() + (from - chunkStart), fm.pendingAppend.data() + (from - diskSize), (size_t)(to - from));
+            if (!writeChunk(bm, allocGroup, fm, c, data, released)) {
+                FS_FAIL(FS_NO_SPACE, "Not enough free blocks to flush appended data for " << fm.filename);
+                undoFile(fm, before, released);
                 return false;
             }
-            newBlocks.push_back(b);
-            fm.blocks.push_back(b);
         }
+        fm.pendingAppend.erase(0, n);
+        trackBuffer(fm, (long long)before.pendingAppend.size());
+        if (!commitFile(fm, before, released)) return false;
+        setReserve(bm, fm, appendNeed(fm, fm.fileSize, blockSize));
+        return true;
     }
-    
-    // Write data to the file
-    int bytesWritten = 0;
-    int dataOffset = 0;
-    int blockIndex = currentBlocks - 1;  // Start from last existing block
-    
-    // Find the offset within the last existing block
-    int offsetInLastBlock = currentSize % blockSize;
-    if (offsetInLastBlock == 0 && currentSize > 0) {
-        blockIndex++;
-        offsetInLastBlock = 0;
+
+    // Back every hole in the range with one allocation so the run is contiguous
+    vector<int> holes;
+    for (int i = firstBlock; i < requiredBlocks; i++) {
+        if (fm.blocks[i] == HOLE_BLOCK) holes.push_back(i);
     }
-    
-    while (dataOffset < (int)data.size()) {
+    vector<int> run;
+    if (!bm->allocateBlocks((int)holes.size(), allocGroup, run)) {
+        FS_FAIL(FS_NO_SPACE, "Not enough free blocks to flush appended data for " << fm.filename);
+        undoFile(fm, before, released);
+        return false;
+    }
+    for (size_t i = 0; i < holes.size(); i++) fm.blocks[holes[i]] = run[i];
+    bool firstWasHole = !holes.empty() && holes[0] == firstBlock;
+
+    int dataOffset = 0;
+    int blockIndex = firstBlock;
+    int offsetInBlock = (int)(diskSize % blockSize);
+    while (dataOffset < n) {
         vector<char> buffer(blockSize, 0);
-        
-        // Read existing block if we're appending to a partially filled block
-        if (blockIndex < currentBlocks && offsetInLastBlock > 0) {
+        // Read-modify-write only for the on-disk partial tail block
+        if (offsetInBlock > 0 && !firstWasHole) {
             bm->readBlock(fm.blocks[blockIndex], buffer);
         }
-        
-        int bytesToWrite = min((int)data.size() - dataOffset, blockSize - offsetInLastBlock);
-        memcpy(buffer.data() + offsetInLastBlock, data.data() + dataOffset, bytesToWrite);
-        
-        bm->writeBlock(fm.blocks[blockIndex], buffer);
-        
+        int bytesToWrite = min(n - dataOffset, blockSize - offsetInBlock);
+        memcpy(buffer.data() + offsetInBlock, fm.pendingAppend.data() + dataOffset, bytesToWrite);
+        if (!storeBlock(bm, allocGroup, fm, blockIndex, buffer, released)) {
+            FS_FAIL(FS_NO_SPACE, "Not enough free blocks to flush appended data for " << fm.filename);
+            undoFile(fm, before, released);
+            return false;
+        }
         dataOffset += bytesToWrite;
-        bytesWritten += bytesToWrite;
-        offsetInLastBlock = 0;
+        offsetInBlock = 0;
         blockIndex++;
     }
-    
-    fm.fileSize = newSize;
-    fm.modifiedAt = time(nullptr);
-    Serializer::writeIndexBlock(*bm, fm);
-    saveDirectory();
-    cout << "[INFO] Appended " << data.size() << " bytes to " << filename 
-         << " (total size: " << newSize << " bytes)\n";
+
+    fm.pendingAppend.erase(0, n);
+    trackBuffer(fm, (long long)before.pendingAppend.size());
+    if (!commitFile(fm, before, released)) return false;
+    setReserve(bm, fm, appendNeed(fm, fm.fileSize, blockSize));  // the partial tail left buffered
+    return true;
+}
+
+void Directory::discardAppend(FileMeta& fm) {
+    long long held = (long long)fm.pendingAppend.size();
+    setReserve(bm, fm, 0);
+    setFileSize(fm, fm.fileSize - held);
+    fm.pendingAppend.clear();
+    trackBuffer(fm, held);
+}
+
+bool Directory::fsyncFile(const string& filename) {
+    Stats::Timer timer(Stats::OP_FSYNC);
+    auto it = files.find(filename);
+    if (it == files.end()) {
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
+        return false;
+    }
+    size_t pending = it->second.pendingAppend.size();
+    if (!flushAppend(it->second, true)) return false;
+    FS_LOG(LOG_INFO, "Synced " << filename << " (" << pending << " buffered bytes written)");
     return true;
 }
 
-bool Directory::resizeFile(const string& filename, int newSize) {
+void Directory::fsyncTree() {
+    for (auto& p : files) flushAppend(p.second, true);
+    for (auto& sd : subdirs) sd->fsyncTree();
+}
+
+bool Directory::promoteInline(FileMeta& fm) {
+    if (!fm.isInline()) return true;
+    int idxBlock = bm->allocateBlock(allocGroup);
+    if (idxBlock == -1) {
+        FS_FAIL(FS_NO_SPACE, "No free blocks for index block.");
+        return false;
+    }
+    // The inline bytes become an append buffer over an empty block list,
+    // so the normal flush path places them as one contiguous run
+    fm.indexBlock = idxBlock;
+    fm.blocks.clear();
+    if (fm.inlineData.find_first_not_of('\0') == string::npos) {
+        // Never written: stays sparse
+        int blockSize = bm->getBlockSize();
+        fm.blocks.assign((fm.inlineData.size() + blockSize - 1) / blockSize, HOLE_BLOCK);
+        fm.inlineData.clear();
+    }
+    fm.pendingAppend.insert(0, fm.inlineData);
+    trackBuffer(fm, 0);
+    fm.inlineData.clear();
+    fm.inlineData.shrink_to_fit();
+    if (fm.pendingAppend.empty()) {
+        Serializer::writeIndexBlock(*bm, fm);
+        return true;
+    }
+    return flushAppend(fm, true);
+}
+
+bool Directory::setCompression(const string& filename, bool on) {
     if (!hasFile(filename)) {
-        cout << "[ERROR] File not found!\n";
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
         return false;
     }
     FileMeta& fm = files[filename];
     if ((fm.permissions & 2) == 0) {
-        cout << "[ERROR] Permission denied: cannot resize file\n";
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot write file");
+        return false;
+    }
+    bool repack = fm.compressed != on && !fm.isInline();
+    if (repack && !flushAppend(fm, true)) return false;
+    FileMeta before = fm;
+    vector<int> released;
+    if (repack) {
+        // readChunk reads raw and packed chunks alike, so each chunk is
+        // read in the old layout and stored back in the new one
+        int blockSize = bm->getBlockSize();
+        int chunks = (int)((fm.blocks.size() + COMPRESS_CHUNK_BLOCKS - 1) / COMPRESS_CHUNK_BLOCKS);
+        vector<char> data;
+        for (int c = 0; c < chunks; c++) {
+            if (!readChunk(bm, fm, c, data)) {
+                FS_FAIL(FS_CORRUPT, "Corrupt compressed chunk " << c << " in " << filename);
+                fm.compressed = true;  // Chunks already repacked stay so
+                commitFile(fm, before, released);
+                return false;
+            }
+            bool ok = true;
+            if (on) {
+                ok = writeChunk(bm, allocGroup, fm, c, data, released);
+            } else {
+                int first = c * COMPRESS_CHUNK_BLOCKS;
+                for (int j = 0; j < chunkSlots(fm, c) && ok; j++) {
+                    vector<char> buffer(data.begin() + (size_t)j * blockSize, data.begin() + (size_t)(j + 1) * blockSize);
+                    if (fm.blocks[first + j] == PACKED_BLOCK) fm.blocks[first + j] = HOLE_BLOCK;
+                    bool zero = buffer.end() == find_if(buffer.begin(), buffer.end(), [](char ch) { return ch != 0; });
+                    if (fm.blocks[first + j] == HOLE_BLOCK && zero) continue;
+                    ok = storeBlock(bm, allocGroup, fm, first + j, buffer, released);
+                }
+            }
+            if (!ok) {
+                FS_FAIL(FS_NO_SPACE, "Not enough free blocks to repack " << filename);
+                // Chunks may be in either layout now, which only the compressed path reads
+                fm.compressed = true;
+                commitFile(fm, before, released);
+                return false;
+            }
+        }
+    }
+    fm.compressed = on;
+    if (!commitFile(fm, before, released)) return false;
+    FS_LOG(LOG_INFO, "Compression " << (on ? "enabled" : "disabled") << " for " << filename);
+    return true;
+}
+
+bool Directory::resizeFile(const string& filename, long long newSize) {
+    Stats::Timer timer(Stats::OP_RESIZE);
+    if (!hasFile(filename)) {
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
+        return false;
+    }
+    FileMeta& fm = files[filename];
+    if ((fm.permissions & 2) == 0) {
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot resize file");
         return false;
     }
     
     if (newSize < 0) {
-        cout << "[ERROR] Invalid size (must be >= 0)!\n";
+        FS_FAIL(FS_INVALID, "Invalid size (must be >= 0)!");
         return false;
     }
+    if (!flushAppend(fm, true)) return false;
+    FileMeta before = fm;
+    vector<int> released;
+    if (fm.isInline()) {
+        if (newSize <= bm->getInlineLimit()) {
+            fm.inlineData.resize((size_t)newSize, '\0');
+            setFileSize(fm, newSize);
+            fm.modifiedAt = time(nullptr);
+            if (!commitFile(fm, before, released)) return false;
+            FS_LOG(LOG_INFO, "File resized to " << newSize << " bytes.");
+            notify(CHANGE_RESIZE, filename);
+            return true;
+        }
+        if (!promoteInline(fm)) return false;
+        before = fm;  // Promotion is saved on its own
+    }
     
     int blockSize = bm->getBlockSize();
-    int currentSize = fm.fileSize;
+    long long currentSize = fm.fileSize;
     
     if (newSize == currentSize) {
-        cout << "[INFO] File size unchanged.\n";
+        FS_LOG(LOG_INFO, "File size unchanged.");
         return true;
     }
     
     if (newSize > currentSize) {
-        // EXPAND: Allocate additional blocks and zero-fill
-        int currentBlocks = (int)ceil((double)currentSize / blockSize);
-        int requiredBlocks = (int)ceil((double)newSize / blockSize);
-        int additionalBlocks = requiredBlocks - currentBlocks;
-        
-        // Allocate new blocks
-        for (int i = 0; i < additionalBlocks; i++) {
-            int b = bm->allocateBlock();
-            if (b == -1) {
-                cout << "[ERROR] Not enough free blocks to expand file!\n";
-                // Free any blocks we allocated in this operation
-                int blocksToFree = i;
-                for (int j = 0; j < blocksToFree; j++) {
-                    bm->freeBlock(fm.blocks[currentBlocks + j]);
-                }
-                fm.blocks.erase(fm.blocks.begin() + currentBlocks, fm.blocks.end());
-                return false;
-            }
-            fm.blocks.push_back(b);
-        }
-        
-        // Zero-fill the last block if necessary
-        int offsetInLastBlock = newSize % blockSize;
-        if (offsetInLastBlock != 0) {
-            vector<char> buffer(blockSize, 0);
-            int lastBlockIdx = fm.blocks.size() - 1;
-            // If this isn't the first time we're writing to this block, read it first
-            if (currentSize % blockSize != 0 && 
-                lastBlockIdx == (int)ceil((double)currentSize / blockSize) - 1) {
-                bm->readBlock(fm.blocks[lastBlockIdx], buffer);
-            }
-            bm->writeBlock(fm.blocks[lastBlockIdx], buffer);
+        // EXPAND: Extend the block list with holes; nothing is allocated or
+        // written until the new range is first written (bytes past the old
+        // EOF in the last block are already zero)
+        long long requiredBlocks = (newSize + blockSize - 1) / blockSize;
+        if (requiredBlocks > Serializer::indexCapacity(*bm)) {
+            FS_FAIL(FS_TOO_LARGE, "File too large: index block holds at most "
+                 << Serializer::indexCapacity(*bm) << " blocks");
+            return false;
         }
+        if ((long long)fm.blocks.size() < requiredBlocks) fm.blocks.resize(requiredBlocks, HOLE_BLOCK);
         
-        fm.fileSize = newSize;
+        setFileSize(fm, newSize);
         fm.modifiedAt = time(nullptr);
-        Serializer::writeIndexBlock(*bm, fm);
-        saveDirectory();
-        cout << "[INFO] File expanded to " << newSize << " bytes.\n";
+        if (!commitFile(fm, before, released)) return false;
+        FS_LOG(LOG_INFO, "File expanded to " << newSize << " bytes.");
+        notify(CHANGE_RESIZE, filename);
         return true;
         
     } else {
         // SHRINK: Free blocks beyond the new size
-        int currentBlocks = (int)ceil((double)currentSize / blockSize);
-        int requiredBlocks = (int)ceil((double)newSize / blockSize);
+        int requiredBlocks = (int)((newSize + blockSize - 1) / blockSize);
         
+        // A compressed tail chunk is read back before any of its slots go away
+        vector<char> tailChunk;
+        int tail = (requiredBlocks - 1) / COMPRESS_CHUNK_BLOCKS;
+        if (fm.compressed && newSize > 0 && !readChunk(bm, fm, tail, tailChunk)) return false;
+
         if (newSize == 0) {
             // Free all data blocks
             for (int blk : fm.blocks) {
-                bm->freeBlock(blk);
+                if (blk >= 0) released.push_back(blk);
             }
             fm.blocks.clear();
         } else {
             // Free only the blocks we don't need anymore
-            for (int i = requiredBlocks; i < currentBlocks; i++) {
-                bm->freeBlock(fm.blocks[i]);
+            for (int i = requiredBlocks; i < (int)fm.blocks.size(); i++) {
+                if (fm.blocks[i] >= 0) released.push_back(fm.blocks[i]);
             }
             fm.blocks.erase(fm.blocks.begin() + requiredBlocks, fm.blocks.end());
             
             // Truncate the last block if necessary
-            int offsetInLastBlock = newSize % blockSize;
-            if (offsetInLastBlock != 0) {
+            int offsetInLastBlock = (int)(newSize % blockSize);
+            if (fm.compressed) {
+                long long tailStart = (long long)tail * COMPRESS_CHUNK_BLOCKS * blockSize;
+                tailChunk.resize((size_t)chunkSlots(fm, tail) * blockSize);
+                fill(tailChunk.begin() + (newSize - tailStart), tailChunk.end(), 0);
+                if (!writeChunk(bm, allocGroup, fm, tail, tailChunk, released)) {
+                    FS_FAIL(FS_NO_SPACE, "Not enough free blocks to rewrite the tail of " << filename);
+                    undoFile(fm, before, released);
+                    return false;
+                }
+            } else if (offsetInLastBlock != 0 && fm.blocks[requiredBlocks - 1] != HOLE_BLOCK) {
                 vector<char> buffer(blockSize, 0);
-                bm->readBlock(fm.blocks[requiredBlocks - 1], buffer);
+                if (!bm->readBlock(fm.blocks[requiredBlocks - 1], buffer)) {
+                    FS_FAIL(FS_IO_ERROR, "Failed to read the tail block of " << filename);
+                    undoFile(fm, before, released);
+                    return false;
+                }
                 // Zero-fill the rest of the block after newSize
                 for (int i = offsetInLastBlock; i < blockSize; i++) {
                     buffer[i] = 0;
                 }
-                bm->writeBlock(fm.blocks[requiredBlocks - 1], buffer);
+                // A shared tail is copied first, which needs a free block
+                if (!storeBlock(bm, allocGroup, fm, requiredBlocks - 1, buffer, released)) {
+                    FS_FAIL(FS_NO_SPACE, "Not enough free blocks to rewrite the tail of " << filename);
+                    undoFile(fm, before, released);
+                    return false;
+                }
             }
         }
         
-        fm.fileSize = newSize;
+        setFileSize(fm, newSize);
         fm.modifiedAt = time(nullptr);
-        Serializer::writeIndexBlock(*bm, fm);
-        Serializer::saveDirectory(*bm, files);
-        cout << "[INFO] File shrunk to " << newSize << " bytes.\n";
+        if (!commitFile(fm, before, released)) return false;
+        FS_LOG(LOG_INFO, "File shrunk to " << newSize << " bytes.");
+        notify(CHANGE_RESIZE, filename);
         return true;
     }
 }
 
-void Directory::saveDirectory() {
+bool Directory::prepareWrite(const string& filename, const string& content, WritePlan& plan) {
+    auto it = files.find(filename);
+    if (it == files.end()) {
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
+        return false;
+    }
+    FileMeta& fm = it->second;
+    if ((fm.permissions & 2) == 0) {
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot write file");
+        return false;
+    }
+    plan.blocks.clear();
+    if (fm.compressed || (fm.isInline() && (long long)content.size() <= bm->getInlineLimit())) {
+        // Chunks are rebuilt whole and inline data has no blocks: no I/O to hand out
+        return writeFile(filename, content);
+    }
+
+    int blockSize = bm->getBlockSize();
+    plan.filename = filename;
+    plan.change = CHANGE_WRITE;
+    plan.logical = (long long)content.size();
+    plan.before = fm;
+    plan.released.clear();
+    plan.full = false;
+    discardAppend(fm);  // The new content replaces anything still buffered
+    if (fm.isInline()) {
+        // Outgrew the directory entry: give it enough blocks for the content
+        if (!promoteInline(fm)) return false;
+        plan.before = fm;  // Promotion is saved on its own
+        long long needed = min<long long>((content.size() + blockSize - 1) / blockSize, Serializer::indexCapacity(*bm));
+        if ((long long)fm.blocks.size() < needed) fm.blocks.resize(needed, HOLE_BLOCK);
+    }
+
+    // Same truncation rule as writeFile: the content fills the file's slots
+    int needed = min((int)fm.blocks.size(), max(1, (int)((content.size() + blockSize - 1) / blockSize)));
+    int backed = backSlots(bm, allocGroup, fm, 0, needed, plan.released);
+    if (backed < needed) {
+        FS_FAIL(FS_NO_SPACE, "Not enough free blocks to write file!");
+        plan.full = true;
+    }
+    plan.blocks.assign(fm.blocks.begin(), fm.blocks.begin() + backed);
+    plan.first = 0;
+    plan.offset = 0;
+    plan.tailFrom = -1;
+    plan.size = min<long long>(content.size(), (long long)backed * blockSize);
+    if (plan.blocks.empty()) return finishWrite(plan, vector<vector<char>>(), true);
+    return true;
+}
+
+bool Directory::prepareAppend(const string& filename, const string& data, WritePlan& plan) {
+    if (data.empty()) {
+        FS_FAIL(FS_INVALID, "Cannot append empty data!");
+        return false;
+    }
+    auto it = files.find(filename);
+    if (it == files.end()) {
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
+        return false;
+    }
+    FileMeta& fm = it->second;
+    if ((fm.permissions & 2) == 0) {
+        FS_FAIL(FS_PERMISSION, "Permission denied: cannot append file");
+        return false;
+    }
+    plan.blocks.clear();
+    long long newSize = fm.fileSize + (long long)data.size();
+    if (fm.compressed || (fm.isInline() && newSize <= bm->getInlineLimit())) {
+        return appendFile(filename, data);
+    }
+    // Appends buffered by the synchronous API must land first
+    if (!flushAppend(fm, true)) return false;
+    if (fm.isInline() && !promoteInline(fm)) return false;
+
+    int blockSize = bm->getBlockSize();
+    long long required = (newSize + blockSize - 1) / blockSize;
+    if (required > Serializer::indexCapacity(*bm)) {
+        FS_FAIL(FS_TOO_LARGE, "File too large: index block holds at most "
+             << Serializer::indexCapacity(*bm) << " blocks");
+        return false;
+    }
+    plan.filename = filename;
+    plan.change = CHANGE_APPEND;
+    plan.logical = (long long)data.size();
+    plan.before = fm;
+    plan.released.clear();
+    plan.full = false;
+    plan.first = (int)(fm.fileSize / blockSize);
+    plan.offset = (int)(fm.fileSize % blockSize);
+    int count = (int)required - plan.first;
+    if ((long long)fm.blocks.size() < required) fm.blocks.resize(required, HOLE_BLOCK);
+    // The bytes already in the first block are read from where they are
+    // now, which copy-on-write may leave in released
+    plan.tailFrom = plan.offset > 0 && fm.blocks[plan.first] >= 0 ? fm.blocks[plan.first] : -1;
+    if (backSlots(bm, allocGroup, fm, plan.first, count, plan.released) < count) {
+        FS_FAIL(FS_NO_SPACE, "Not enough free blocks for append operation!");
+        undoFile(fm, plan.before, plan.released);
+        return false;
+    }
+    plan.blocks.assign(fm.blocks.begin() + plan.first, fm.blocks.begin() + required);
+    plan.size = newSize;
+    return true;
+}
+
+bool Directory::finishWrite(WritePlan& plan, const vector<vector<char>>& buffers, bool ioOk) {
+    auto it = files.find(plan.filename);
+    if (it == files.end()) {
+        FS_FAIL(FS_NOT_FOUND, "File not found!");
+        return false;
+    }
+    FileMeta& fm = it->second;
+    if (!ioOk) {
+        FS_FAIL(FS_IO_ERROR, "Failed to write data blocks of " << plan.filename);
+        undoFile(fm, plan.before, plan.released);
+        return false;
+    }
+    DedupIndex* dd = bm->dedup();
+    for (size_t i = 0; dd && i < plan.blocks.size(); i++) {
+        dd->insert(DedupIndex::fingerprint(buffers[i]), plan.blocks[i]);
+    }
+    setFileSize(fm, plan.size);
+    fm.modifiedAt = time(nullptr);
+    if (!commitFile(fm, plan.before, plan.released)) return false;
+    Stats::add(Stats::LOGICAL_WRITTEN, plan.logical);
+    FS_LOG(LOG_INFO, (plan.change == CHANGE_APPEND ? "Appended " : "Wrote ") << plan.logical << " bytes to "
+         << plan.filename << " (total size: " << fm.fileSize << " bytes)");
+    notify(plan.change, plan.filename);
+    if (plan.full) setStatus(FS_NO_SPACE);  // May finish on another thread than prepare
+    return !plan.full;
+}
+
+bool Directory::saveDirectory() {
     // Always persist the entire tree starting from the root directory.
     Directory* top = this;
     while (top->parent) top = top->parent;
-    Serializer::saveDirectory(*bm, top);
+    if (top->batchDepth > 0) {
+        top->treeDirty = true;  // written once when the batch commits
+        return true;
+    }
+    return top->writeTree();
+}
+
+bool Directory::writeTree() {
+    if (!Serializer::saveDirectory(*bm, this)) return false;
+    treeDirty = false;
+    if (!batchFreed.empty()) {
+        bm->freeBlocks(std::move(batchFreed));
+        batchFreed.clear();
+    }
+    return true;
+}
+
+void Directory::releaseBlocks(vector<int> blocks) {
+    Directory* top = this;
+    while (top->parent) top = top->parent;
+    if (top->batchDepth > 0) top->batchFreed.insert(top->batchFreed.end(), blocks.begin(), blocks.end());
+    else bm->freeBlocks(std::move(blocks));
+}
+
+bool Directory::commitFile(FileMeta& fm, const FileMeta& before, vector<int>& released) {
+    Serializer::writeIndexBlock(*bm, fm);
+    if (!saveDirectory()) {
+        undoFile(fm, before, released);
+        return false;
+    }
+    releaseBlocks(std::move(released));
+    released.clear();
+    return true;
+}
+
+void Directory::undoFile(FileMeta& fm, const FileMeta& before, vector<int>& released) {
+    // The file holds one owner of every block in its list and of every
+    // released block; whatever before does not list was gained and goes.
+    // Blocks rewritten in place keep their new bytes, as after a remount.
+    // The reservation is taken again once the gained blocks are free.
+    map<int, int> owners;
+    for (int b : fm.blocks) if (b >= 0) owners[b]++;
+    for (int b : released) owners[b]++;
+    if (fm.indexBlock >= 0) owners[fm.indexBlock]++;
+    for (int b : before.blocks) if (b >= 0) owners[b]--;
+    if (before.indexBlock >= 0) owners[before.indexBlock]--;
+    vector<int> gained;
+    for (auto& p : owners) for (int k = 0; k < p.second; k++) gained.push_back(p.first);
+
+    setFileSize(fm, before.fileSize);
+    long long buffered = (long long)fm.pendingAppend.size();
+    long long held = fm.reservedBlocks;
+    fm = before;
+    fm.reservedBlocks = held;
+    trackBuffer(fm, buffered);
+    Serializer::writeIndexBlock(*bm, fm);
+    bm->freeBlocks(std::move(gained));
+    released.clear();
+    setReserve(bm, fm, before.reservedBlocks);
 }
 
 bool Directory::chmodEntry(const std::string& name, int mode) {
     // Change permission of subdir
     Directory* sd = findSubdir(name);
     if (sd) {
+        int old = sd->permissions;
         sd->permissions = mode & 7;
-        saveDirectory();
-        cout << "[INFO] Directory permissions updated: " << name << " -> " << sd->permissions << "\n";
+        if (!saveDirectory()) {
+            sd->permissions = old;
+            return false;
+        }
+        FS_LOG(LOG_INFO, "Directory permissions updated: " << name << " -> " << sd->permissions);
+        notify(CHANGE_CHMOD, name);
         return true;
     }
     // Change permission of file
     auto it = files.find(name);
     if (it != files.end()) {
+        int old = it->second.permissions;
         it->second.permissions = mode & 7;
-        saveDirectory();
-        cout << "[INFO] File permissions updated: " << name << " -> " << it->second.permissions << "\n";
+        if (!saveDirectory()) {
+            it->second.permissions = old;
+            return false;
+        }
+        FS_LOG(LOG_INFO, "File permissions updated: " << name << " -> " << it->second.permissions);
+        notify(CHANGE_CHMOD, name);
         return true;
     }
-    cout << "[ERROR] Entry not found: " << name << "\n";
+    FS_FAIL(FS_NOT_FOUND, "Entry not found: " << name);
     return false;
 }
 
@@ -1,46 +1,168 @@
 #ifndef DIRECTORY_HPP
 #define DIRECTORY_HPP
 
-#include "FileMeta.hpp"
-#include "BlockManager.hpp"
+#include "filemeta.hpp"
+#include "blockmanager.hpp"
+#include "notify.hpp"
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <memory>
 
+// One entry of a readdir page: what ls shows, without the block lists
+struct DirEntry {
+    std::string name;
+    bool isDir;
+    long long size;          // File size; for a directory, the bytes in its subtree
+    int permissions;
+    long createdAt;          // 0 for directories, which keep no times
+    long modifiedAt;
+    bool isInline;
+    bool compressed;
+};
+
+// A write or append whose data blocks the caller submits itself; filled by
+// Directory::prepareWrite / prepareAppend, completed by finishWrite
+struct WritePlan {
+    std::string filename;
+    ChangeType change;           // CHANGE_WRITE or CHANGE_APPEND
+    FileMeta before;             // The entry before the change, for undo
+    std::vector<int> released;   // Blocks to free once the change is saved
+    std::vector<int> blocks;     // Blocks to write whole, for slots first, first + 1, ...
+    int first;
+    int offset;                  // Bytes of blocks[0] that precede the data
+    int tailFrom;                // Block to read those bytes from, or -1 (zeros)
+    long long size;              // File size once the blocks are written
+    long long logical;           // Bytes the caller asked to write
+    bool full;                   // The disk filled: only a prefix was backed
+
+    WritePlan() : change(CHANGE_WRITE), first(0), offset(0), tailFrom(-1), size(0), logical(0), full(false) {}
+};
+
+// Where a readdir listing resumes. It holds a name rather than a position,
+// so entries added or removed between pages never cause skips or repeats
+// of the others.
+struct DirCursor {
+    bool inFiles;            // Subdirectories come first, then files, each by name
+    std::string after;       // Last name returned in the current phase
+    bool done;
+
+    DirCursor() : inFiles(false), done(false) {}
+};
+
 class Directory {
 public:
     std::string name;
     Directory* parent;
     std::map<std::string, FileMeta> files;
-    std::vector<std::unique_ptr<Directory>> subdirs;
+    std::vector<std::unique_ptr<Directory>> subdirs;      // Creation order, as saved
+    std::map<std::string, Directory*> subdirIndex;         // The same, by name
     BlockManager* bm;
     int permissions; // Unix-style permissions for the directory (0-7)
+    int allocGroup;  // Preferred allocation group for this directory's files
+    long long bufferedBytes; // Root only: bytes held in append buffers across the tree
+    // Root only: every file with buffered appends, ordered by buffer size,
+    // so eviction takes the largest without walking the tree
+    struct BufferedFile {
+        long long bytes;
+        FileMeta* fm;
+        Directory* dir;
+        bool operator<(const BufferedFile& o) const {
+            return bytes != o.bytes ? bytes < o.bytes : std::less<FileMeta*>()(fm, o.fm);
+        }
+    };
+    std::set<BufferedFile> buffered;
+    int batchDepth;          // Root only: open batches; tree saves wait while > 0
+    bool treeDirty;          // Root only: a save was deferred by a batch
+    std::vector<int> batchFreed;  // Root only: released in a batch; the saved tree still names them
+    ChangeFeed* feed;        // Root only: where changes are published; null → nowhere
+
+    // Totals over everything below this directory, kept current by each
+    // mutation (O(depth) to propagate) so du never walks the tree
+    long long treeBytes;     // Sum of file sizes
+    long long treeFiles;
+    long long treeDirs;      // Subdirectories at any depth
+
+    // Delayed allocation: appends are buffered per file and reach the disk
+    // (blocks allocated as one run) when a buffer fills, on fsync, or when
+    // the tree-wide budget forces eviction.
+    static const int APPEND_BUFFER_BLOCKS = 8;   // Per-file flush threshold
+    static const int APPEND_BUDGET_BLOCKS = 64;  // Tree-wide cap before eviction
 
     Directory(const std::string& name_, Directory* parent_, BlockManager* blockManager);
 
     Directory* findSubdir(const std::string& name);
+    void addToTree(long long bytes, long long files, long long dirs); // This directory and its ancestors
+    void setFileSize(FileMeta& fm, long long size); // For an entry of files; updates the totals
+    // Keep root's buffered byte count and set in step with an entry of files:
+    // trackBuffer after its buffer changed from oldBytes, dropBuffer before
+    // the entry leaves this directory (or is destroyed)
+    void trackBuffer(FileMeta& fm, long long oldBytes);
+    void dropBuffer(FileMeta& fm);
+    void recountTree();      // Rebuild the totals of this subtree from its entries
+    void notify(ChangeType type, const std::string& name); // Publish a change to entry name
+    // Add d to subdirs (at pos, or the end) / take it out again, keeping
+    // subdirIndex in step; detachSubdir reports where d was
+    void attachSubdir(std::unique_ptr<Directory> d, size_t pos = (size_t)-1);
+    std::unique_ptr<Directory> detachSubdir(Directory* d, size_t* pos = nullptr);
     bool addSubdir(const std::string& name);
     bool removeSubdir(const std::string& name); // remove only if empty
     bool removeDirectory(const std::string& name, BlockManager& bm); // recursive delete
     void listContents();
+    // Up to max entries following cursor into out, advancing cursor; sets
+    // cursor.done after the last one. False without read permission.
+    bool readdir(DirCursor& cursor, size_t max, std::vector<DirEntry>& out);
     bool chmodEntry(const std::string& name, int mode);
 
     // File operations (operate within this directory)
-    bool createFile(const std::string& filename, int size);
+    bool createFile(const std::string& filename, long long size);
     bool deleteFile(const std::string& filename);
+    bool cloneFile(const std::string& src, const std::string& dst); // Shares src's blocks
     void listFiles();
     FileMeta getFile(const std::string& filename);  // Return by value to avoid dangling pointers
     bool hasFile(const std::string& filename);
-    bool writeFile(const std::string& filename, const std::string& content);
+    bool writeFile(const std::string& filename, const std::string& content); // False on a short write (FS_NO_SPACE)
     std::string readFile(const std::string& filename);
+    // Logical blocks [first, first + count) of fm's on-disk data as
+    // count * blockSize bytes, holes as zeros; no permission check. For a
+    // compressed file, first must start a chunk.
+    bool readBlocks(const FileMeta& fm, int first, int count, std::vector<char>& out);
     void infoFile(const std::string& filename);
     bool appendFile(const std::string& filename, const std::string& data);
-    bool resizeFile(const std::string& filename, int newSize);
+    bool resizeFile(const std::string& filename, long long newSize);
+    bool fsyncFile(const std::string& filename);
+    bool flushAppend(FileMeta& fm, bool all);  // all=false keeps a trailing partial block buffered
+    void discardAppend(FileMeta& fm);
+    void fsyncTree();                          // Flush every buffer in this subtree
+    bool promoteInline(FileMeta& fm);          // Move an inline file's data out to blocks
+    // Finish a content change to fm by saving the tree. Blocks in released
+    // were let go of by the change and are freed only once the save works;
+    // if it fails, fm gets back the metadata in before and the blocks it
+    // gained since are freed instead.
+    bool commitFile(FileMeta& fm, const FileMeta& before, std::vector<int>& released);
+    void undoFile(FileMeta& fm, const FileMeta& before, std::vector<int>& released);
+    bool setCompression(const std::string& filename, bool on); // Repacks the existing data
+
+    // writeFile / appendFile split around the data I/O, for callers that
+    // submit it themselves (AsyncFileSystem). prepare* runs the checks and
+    // metadata steps and backs the slots the data covers as storeBlock does
+    // (no content sharing); inline-sized and compressed files are handled
+    // there completely, leaving plan.blocks empty. finishWrite commits once
+    // the blocks are written, or undoes the change if the I/O failed.
+    bool prepareWrite(const std::string& filename, const std::string& content, WritePlan& plan);
+    bool prepareAppend(const std::string& filename, const std::string& data, WritePlan& plan);
+    bool finishWrite(WritePlan& plan, const std::vector<std::vector<char>>& buffers, bool ioOk);
 
-    // Persistence helpers will call Serializer directly
-    void saveDirectory();
+    // Persistence helpers will call Serializer directly. False if the tree
+    // could not be written; inside a batch the save is deferred and true.
+    bool saveDirectory();
     void loadDirectory();
+    // Writes the tree now, batch or not, then frees what the batch released
+    bool writeTree();
+    // Frees blocks the tree no longer names, or queues them until the open
+    // batch is saved so a crash never leaves the saved tree naming reused blocks
+    void releaseBlocks(std::vector<int> blocks);
 };
 
 #endif
@@ -5,16 +5,35 @@
 #include <vector>
 #include <ctime>
 
+// Sentinel stored in FileMeta::blocks for a hole: no physical block is
+// allocated yet and the range reads back as zeros.
+const int HOLE_BLOCK = -1;
+
+// Compressed files are stored in chunks of COMPRESS_CHUNK_BLOCKS logical
+// blocks. A chunk that compresses into fewer blocks keeps its data in its
+// first slots; the slots it no longer needs hold PACKED_BLOCK.
+const int PACKED_BLOCK = -2;
+const int COMPRESS_CHUNK_BLOCKS = 8;
+
 struct FileMeta {
     std::string filename;    // File name
-    int fileSize;            // Size in bytes
+    long long fileSize;      // Size in bytes (64-bit for large images)
     int indexBlock;          // Block number storing the index
-    std::vector<int> blocks; // List of data blocks (filled via index block)
+    std::vector<int> blocks; // List of data blocks (HOLE_BLOCK for unallocated)
     long createdAt;          // Creation timestamp
     long modifiedAt;         // Last modification timestamp
     int permissions;         // Unix-style permission bits (0-7)
+    std::string pendingAppend; // Appended bytes buffered in memory, not yet on disk
+                               // (counted in fileSize, never serialized)
+    long long reservedBlocks;  // Free blocks held in BlockManager for pendingAppend
+    std::string inlineData;    // Whole contents of a small file stored in its
+                               // directory entry; such files have no index block
+    bool compressed;           // Data stored as compressed chunks
+
+    bool isInline() const { return indexBlock == -1; }
 
-    FileMeta() : fileSize(0), indexBlock(-1), createdAt(0), modifiedAt(0), permissions(6) {
+    FileMeta() : fileSize(0), indexBlock(-1), createdAt(0), modifiedAt(0), permissions(6), reservedBlocks(0),
+                 compressed(false) {
         createdAt = time(nullptr);
         modifiedAt = createdAt;
     }
@@ -0,0 +1,153 @@
+#include "log.hpp"
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+using namespace std;
+
+static const size_t MAX_QUEUED = 8192;  // Beyond this, new messages are dropped
+
+static thread_local FsStatus threadStatus = FS_OK;
+
+FsStatus lastStatus() {
+    return threadStatus;
+}
+
+void setStatus(FsStatus status) {
+    threadStatus = status;
+}
+
+const char* statusText(FsStatus status) {
+    switch (status) {
+        case FS_OK: return "ok";
+        case FS_NOT_FOUND: return "not found";
+        case FS_EXISTS: return "already exists";
+        case FS_PERMISSION: return "permission denied";
+        case FS_NO_SPACE: return "no space left";
+        case FS_TOO_LARGE: return "too large";
+        case FS_INVALID: return "invalid argument";
+        case FS_NOT_EMPTY: return "directory not empty";
+        case FS_CORRUPT: return "corrupt data";
+        case FS_IO_ERROR: return "I/O error";
+    }
+    return "unknown";
+}
+
+atomic<int> Log::minLevel(LOG_WARN);
+
+// The queue and its writer thread, started on the first message
+class LogWorker {
+public:
+    mutex mu;
+    condition_variable wake;
+    condition_variable drained;
+    deque<pair<LogLevel, string>> queue;
+    Log::Sink sink;
+    long long accepted = 0;
+    long long delivered = 0;
+    long long droppedCount = 0;
+    long long droppedReported = 0;
+    bool stopping = false;
+    thread worker;
+
+    ~LogWorker() {
+        {
+            lock_guard<mutex> lk(mu);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+
+    void start() {
+        if (!worker.joinable()) worker = thread(&LogWorker::run, this);
+    }
+
+    void run() {
+        unique_lock<mutex> lk(mu);
+        while (true) {
+            wake.wait(lk, [this] { return stopping || !queue.empty(); });
+            if (queue.empty() && stopping) return;
+            deque<pair<LogLevel, string>> batch;
+            batch.swap(queue);
+            long long lost = droppedCount - droppedReported;
+            droppedReported = droppedCount;
+            Log::Sink out = sink;
+            lk.unlock();
+
+            if (lost > 0) deliver(out, LOG_WARN, to_string(lost) + " log message(s) dropped");
+            for (auto& m : batch) deliver(out, m.first, m.second);
+            if (!out) cout.flush();
+
+            lk.lock();
+            delivered += batch.size();
+            drained.notify_all();
+        }
+    }
+
+    static void deliver(const Log::Sink& out, LogLevel level, const string& message) {
+        if (out) out(level, message);
+        else cout << "[" << Log::levelName(level) << "] " << message << "\n";
+    }
+};
+
+static LogWorker& logWorker() {
+    static LogWorker w;
+    return w;
+}
+
+void Log::setLevel(LogLevel level) {
+    minLevel.store(level, memory_order_relaxed);
+}
+
+LogLevel Log::level() {
+    return (LogLevel)minLevel.load(memory_order_relaxed);
+}
+
+void Log::setSink(Sink sink) {
+    LogWorker& w = logWorker();
+    lock_guard<mutex> lk(w.mu);
+    w.sink = sink;
+}
+
+void Log::write(LogLevel level, const string& message) {
+    if (!enabled(level)) return;
+    LogWorker& w = logWorker();
+    {
+        lock_guard<mutex> lk(w.mu);
+        if (w.queue.size() >= MAX_QUEUED) {
+            w.droppedCount++;
+            return;
+        }
+        w.start();
+        w.queue.push_back(make_pair(level, message));
+        w.accepted++;
+    }
+    w.wake.notify_one();
+}
+
+void Log::flush() {
+    LogWorker& w = logWorker();
+    unique_lock<mutex> lk(w.mu);
+    long long target = w.accepted;
+    w.drained.wait(lk, [&] { return w.delivered >= target || !w.worker.joinable(); });
+}
+
+long long Log::dropped() {
+    LogWorker& w = logWorker();
+    lock_guard<mutex> lk(w.mu);
+    return w.droppedCount;
+}
+
+const char* Log::levelName(LogLevel level) {
+    switch (level) {
+        case LOG_DEBUG: return "DEBUG";
+        case LOG_INFO: return "INFO";
+        case LOG_WARN: return "WARN";
+        case LOG_ERROR: return "ERROR";
+        case LOG_OFF: break;
+    }
+    return "OFF";
+}
@@ -0,0 +1,69 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <string>
+
+enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_OFF };
+
+// Why the last failing library call on this thread failed. The API keeps
+// its bool / empty-string results; this is the errno-style detail behind them.
+enum FsStatus {
+    FS_OK,
+    FS_NOT_FOUND,
+    FS_EXISTS,
+    FS_PERMISSION,
+    FS_NO_SPACE,
+    FS_TOO_LARGE,
+    FS_INVALID,
+    FS_NOT_EMPTY,
+    FS_CORRUPT,
+    FS_IO_ERROR
+};
+
+FsStatus lastStatus();
+void setStatus(FsStatus status);
+const char* statusText(FsStatus status);
+
+// Diagnostics from the library. Messages below the level are dropped before
+// they are formatted; the rest are queued and handed to the sink by a
+// background thread, so callers never wait on console I/O.
+class Log {
+public:
+    typedef std::function<void(LogLevel, const std::string&)> Sink;
+
+    static void setLevel(LogLevel level);  // Default LOG_WARN; LOG_OFF silences the library
+    static LogLevel level();
+    static bool enabled(LogLevel level) {
+        return level >= minLevel.load(std::memory_order_relaxed);
+    }
+    static void setSink(Sink sink);        // Runs on the logger thread; empty → stdout as "[INFO] ..."
+    static void write(LogLevel level, const std::string& message);
+    static void flush();                   // Returns once everything queued so far reached the sink
+    static long long dropped();            // Messages lost to a full queue
+    static const char* levelName(LogLevel level);
+
+private:
+    static std::atomic<int> minLevel;
+};
+
+// FS_LOG(LOG_INFO, "Wrote " << n << " bytes"): formats only when enabled
+#define FS_LOG(level, expr) \
+    do { \
+        if (Log::enabled(level)) { \
+            std::ostringstream fsLogStream_; \
+            fsLogStream_ << expr; \
+            Log::write(level, fsLogStream_.str()); \
+        } \
+    } while (0)
+
+// Records status for lastStatus() and logs the message as an error
+#define FS_FAIL(status, expr) \
+    do { \
+        setStatus(status); \
+        FS_LOG(LOG_ERROR, expr); \
+    } while (0)
+
+#endif
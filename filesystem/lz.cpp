@@ -0,0 +1,132 @@
+#include "lz.hpp"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+static const int MIN_MATCH = 4;
+static const int HASH_LOG = 12;
+static const int MAX_OFFSET = 65535;
+static const int LAST_LITERALS = 5;   // The final bytes are always literals
+static const int MATCH_LIMIT = 12;    // No match may start this close to the end
+
+static inline uint32_t read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline int hashOf(uint32_t seq) {
+    return (int)((seq * 2654435761u) >> (32 - HASH_LOG));
+}
+
+// Length fields above 15 continue in bytes of 255 plus a remainder
+static bool putLength(char*& op, const char* end, int len) {
+    while (len >= 255) {
+        if (op >= end) return false;
+        *op++ = (char)255;
+        len -= 255;
+    }
+    if (op >= end) return false;
+    *op++ = (char)len;
+    return true;
+}
+
+static bool emit(char*& op, const char* end, const char* lit, int litLen, int offset, int matchLen) {
+    if (op >= end) return false;
+    char* token = op++;
+    int litCode = litLen < 15 ? litLen : 15;
+    int matchCode = 0;
+    if (litLen >= 15 && !putLength(op, end, litLen - 15)) return false;
+    if (end - op < litLen) return false;
+    memcpy(op, lit, litLen);
+    op += litLen;
+    if (matchLen > 0) {
+        if (end - op < 2) return false;
+        *op++ = (char)(offset & 0xFF);
+        *op++ = (char)(offset >> 8);
+        int m = matchLen - MIN_MATCH;
+        matchCode = m < 15 ? m : 15;
+        if (m >= 15 && !putLength(op, end, m - 15)) return false;
+    }
+    *token = (char)((litCode << 4) | matchCode);
+    return true;
+}
+
+int Lz::bound(int n) {
+    return n + n / 255 + 16;
+}
+
+int Lz::compress(const char* src, int n, char* dst, int cap) {
+    char* op = dst;
+    const char* end = dst + cap;
+    int anchor = 0;
+
+    if (n > MATCH_LIMIT) {
+        vector<int> table(1 << HASH_LOG, -1);
+        int limit = n - MATCH_LIMIT;
+        int ip = 0;
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            int h = hashOf(seq);
+            int ref = table[h];
+            table[h] = ip;
+            if (ref < 0 || ip - ref > MAX_OFFSET || read32(src + ref) != seq) {
+                ip++;
+                continue;
+            }
+            int len = MIN_MATCH;
+            while (ip + len < n - LAST_LITERALS && src[ref + len] == src[ip + len]) len++;
+            if (!emit(op, end, src + anchor, ip - anchor, ip - ref, len)) return 0;
+            ip += len;
+            anchor = ip;
+        }
+    }
+    if (!emit(op, end, src + anchor, n - anchor, 0, 0)) return 0;
+    return (int)(op - dst);
+}
+
+int Lz::decompress(const char* src, int n, char* dst, int cap) {
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* iend = ip + n;
+    char* op = dst;
+    char* oend = dst + cap;
+
+    while (ip < iend) {
+        int token = *ip++;
+        int litLen = token >> 4;
+        if (litLen == 15) {
+            int b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                litLen += b;
+            } while (b == 255);
+        }
+        if (iend - ip < litLen || oend - op < litLen) return -1;
+        memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == iend) break;  // last sequence carries literals only
+
+        if (iend - ip < 2) return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        int matchLen = token & 15;
+        if (matchLen == 15) {
+            int b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += MIN_MATCH;
+        if (offset == 0 || offset > op - dst || oend - op < matchLen) return -1;
+        // Byte copy: the match may overlap the bytes it produces
+        const char* from = op - offset;
+        for (int i = 0; i < matchLen; i++) op[i] = from[i];
+        op += matchLen;
+    }
+    return (int)(op - dst);
+}
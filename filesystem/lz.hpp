@@ -0,0 +1,18 @@
+#ifndef LZ_HPP
+#define LZ_HPP
+
+// Self-contained LZ77 block codec in the LZ4 block format: each sequence is
+// a token (literal length, match length), the literals, a 2-byte offset and
+// length extension bytes. No dependencies, so it builds offline.
+class Lz {
+public:
+    static int bound(int n);  // Worst-case compressed size for n input bytes
+
+    // Returns the compressed size, or 0 if it does not fit in cap
+    static int compress(const char* src, int n, char* dst, int cap);
+
+    // Returns the decompressed size, or -1 on malformed input or overflow
+    static int decompress(const char* src, int n, char* dst, int cap);
+};
+
+#endif
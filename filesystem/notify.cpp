@@ -0,0 +1,50 @@
+#include "notify.hpp"
+using namespace std;
+
+ChangeFeed::ChangeFeed() : count(0), subs(make_shared<List>()), nextId(1), seq(0) {}
+
+int ChangeFeed::subscribe(Callback cb) {
+    lock_guard<recursive_mutex> g(lock);
+    shared_ptr<List> next = make_shared<List>(*subs);
+    int id = nextId++;
+    next->push_back(make_pair(id, std::move(cb)));
+    subs = next;
+    count.store((int)subs->size(), memory_order_relaxed);
+    return id;
+}
+
+bool ChangeFeed::unsubscribe(int id) {
+    lock_guard<recursive_mutex> g(lock);
+    shared_ptr<List> next = make_shared<List>(*subs);
+    for (size_t i = 0; i < next->size(); i++) {
+        if ((*next)[i].first != id) continue;
+        next->erase(next->begin() + i);
+        subs = next;
+        count.store((int)subs->size(), memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ChangeFeed::publish(ChangeEvent& e) {
+    lock_guard<recursive_mutex> g(lock);
+    shared_ptr<const List> current = subs;  // Stays valid if a callback unsubscribes
+    if (current->empty()) return;
+    e.seq = ++seq;
+    for (const auto& s : *current) s.second(e);
+}
+
+const char* ChangeFeed::typeName(ChangeType t) {
+    switch (t) {
+        case CHANGE_CREATE: return "create";
+        case CHANGE_WRITE:  return "write";
+        case CHANGE_APPEND: return "append";
+        case CHANGE_RESIZE: return "resize";
+        case CHANGE_DELETE: return "delete";
+        case CHANGE_CHMOD:  return "chmod";
+        case CHANGE_MKDIR:  return "mkdir";
+        case CHANGE_RMDIR:  return "rmdir";
+        case CHANGE_RENAME: return "rename";
+    }
+    return "?";
+}
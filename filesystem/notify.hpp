@@ -0,0 +1,57 @@
+#ifndef NOTIFY_HPP
+#define NOTIFY_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum ChangeType {
+    CHANGE_CREATE,
+    CHANGE_WRITE,
+    CHANGE_APPEND,
+    CHANGE_RESIZE,
+    CHANGE_DELETE,
+    CHANGE_CHMOD,
+    CHANGE_MKDIR,
+    CHANGE_RMDIR,
+    CHANGE_RENAME
+};
+
+// One namespace or content change, as delivered to subscribers
+struct ChangeEvent {
+    unsigned long long seq;  // 1, 2, 3... in delivery order since mount
+    ChangeType type;
+    std::string path;        // Absolute, e.g. /root/docs/a.txt
+    std::string newPath;     // CHANGE_RENAME only
+    long long size;          // File size after the change; -1 for directories and deletes
+};
+
+// Change notification feed. Mutators publish after they succeed; callbacks
+// run on the mutating thread, in seq order, one at a time. They should be
+// quick and must not modify the filesystem, but may unsubscribe.
+// With no subscribers, active() is one atomic load and no event is built.
+class ChangeFeed {
+public:
+    typedef std::function<void(const ChangeEvent&)> Callback;
+
+    ChangeFeed();
+    int subscribe(Callback cb);    // Returns an id for unsubscribe
+    bool unsubscribe(int id);
+    bool active() const { return count.load(std::memory_order_relaxed) > 0; }
+    void publish(ChangeEvent& e);  // Fills in seq
+    static const char* typeName(ChangeType t);
+
+private:
+    typedef std::vector<std::pair<int, Callback>> List;
+    std::atomic<int> count;
+    std::recursive_mutex lock;     // Held during delivery; callbacks may unsubscribe
+    std::shared_ptr<const List> subs; // Replaced, never edited, so delivery needs no copy
+    int nextId;
+    unsigned long long seq;
+};
+
+#endif
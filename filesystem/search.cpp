@@ -0,0 +1,60 @@
+#include "search.hpp"
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+const size_t Search::npos;
+
+// Helper: memchr on the first byte, memcmp on the rest
+static size_t findScalar(const char* hay, size_t n, const char* needle, size_t m, size_t from) {
+    while (from + m <= n) {
+        const void* hit = memchr(hay + from, needle[0], n - m + 1 - from);
+        if (!hit) return Search::npos;
+        size_t pos = (const char*)hit - hay;
+        if (memcmp(hay + pos + 1, needle + 1, m - 1) == 0) return pos;
+        from = pos + 1;
+    }
+    return Search::npos;
+}
+
+size_t Search::find(const char* hay, size_t n, const string& needle, size_t from) {
+    size_t m = needle.size();
+    if (m == 0) return from <= n ? from : npos;
+    if (from >= n || n - from < m) return npos;
+    const char* nd = needle.data();
+    if (m == 1) {
+        const void* hit = memchr(hay + from, nd[0], n - from);
+        return hit ? (size_t)((const char*)hit - hay) : npos;
+    }
+
+#ifdef __SSE2__
+    // Lane j of a step is position i + j: it is a candidate when hay[i + j]
+    // equals the first needle byte and hay[i + j + m - 1] the last one
+    const __m128i first = _mm_set1_epi8(nd[0]);
+    const __m128i last = _mm_set1_epi8(nd[m - 1]);
+    size_t i = from;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(hay + i + m - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (m == 2 || memcmp(hay + i + bit + 1, nd + 1, m - 2) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return findScalar(hay, n, nd, m, i);
+#else
+    return findScalar(hay, n, nd, m, from);
+#endif
+}
+
+const char* Search::backend() {
+#ifdef __SSE2__
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,19 @@
+#ifndef SEARCH_HPP
+#define SEARCH_HPP
+
+#include <cstddef>
+#include <string>
+
+// Substring search over raw buffers. On x86-64 it compares 16 candidate
+// positions per step with SSE2, testing the needle's first and last byte
+// together before confirming with memcmp; elsewhere it falls back to memchr.
+class Search {
+public:
+    static const size_t npos = (size_t)-1;
+
+    // First occurrence of needle in hay[from, n), or npos
+    static size_t find(const char* hay, size_t n, const std::string& needle, size_t from = 0);
+    static const char* backend();  // "sse2" or "scalar"
+};
+
+#endif
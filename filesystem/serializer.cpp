@@ -1,10 +1,12 @@
 #include "serializer.hpp"
-#include <iostream>
+#include "log.hpp"
+#include "stats.hpp"
 #include <sstream>
 #include <cstring>
 #include <ctime>
 #include <cstdio>
 #include <iomanip>
+#include <functional>
 
 using namespace std;
 
@@ -41,40 +43,79 @@ static long parseTimestampFromString(const string& timestampStr) {
     return (long)mktime(&timeinfo);
 }
 
-// Write index block for a file
-void Serializer::writeIndexBlock(BlockManager& bm, FileMeta& fm) {
+// Write the block list, collapsing runs of holes into a single "h<count>"
+// token and runs of packed slots into "p<count>"
+static void writeBlockList(ostream& os, const vector<int>& blocks) {
+    for (size_t i = 0; i < blocks.size(); ) {
+        int b = blocks[i];
+        if (b != HOLE_BLOCK && b != PACKED_BLOCK) {
+            os << blocks[i++] << " ";
+            continue;
+        }
+        size_t run = 0;
+        while (i < blocks.size() && blocks[i] == b) { ++run; ++i; }
+        os << (b == HOLE_BLOCK ? "h" : "p") << run << " ";
+    }
+}
+
+// Inline file contents are stored as hex so the record stays one text line
+static void writeInlineData(ostream& os, const FileMeta& fm) {
+    // All-zero contents are implied by the size, as for holes
+    if (!fm.isInline() || fm.inlineData.find_first_not_of('\0') == string::npos) return;
+    static const char digits[] = "0123456789abcdef";
+    os << " inline ";
+    for (unsigned char c : fm.inlineData) os << digits[c >> 4] << digits[c & 15];
+}
+
+static string parseHex(const string& hex) {
+    string out;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) out += (char)stoi(hex.substr(i, 2), nullptr, 16);
+    return out;
+}
+
+int Serializer::indexCapacity(const BlockManager& bm) {
+    return (bm.getBlockSize() - (int)sizeof(int)) / (int)sizeof(int);
+}
+
+// Encode the on-disk index block for a file: entry count, then block numbers
+vector<char> Serializer::buildIndexBlock(const BlockManager& bm, const FileMeta& fm) {
     vector<char> buffer(bm.getBlockSize(), 0);
-    int count = (int)fm.blocks.size();
+    int count = min((int)fm.blocks.size(), indexCapacity(bm));
     memcpy(buffer.data(), &count, sizeof(int));
     memcpy(buffer.data() + sizeof(int), fm.blocks.data(), count * sizeof(int));
-    bm.writeBlock(fm.indexBlock, buffer);
+    return buffer;
+}
+
+// Write index block for a file
+void Serializer::writeIndexBlock(BlockManager& bm, FileMeta& fm) {
+    if (fm.isInline()) return;  // inline files have no index block
+    bm.writeBlock(fm.indexBlock, buildIndexBlock(bm, fm));
 }
 
 // Save directory to meta.bin (simple serialization)
-void Serializer::saveDirectory(BlockManager& bm, map<string, FileMeta>& files) {
+bool Serializer::saveDirectory(BlockManager& bm, map<string, FileMeta>& files) {
     // Maintain backwards compatibility: flatten map format
-    vector<char> buffer(bm.getBlockSize(), 0);
     stringstream ss;
 
     for (auto& pair : files) {
         FileMeta& fm = pair.second;
-            ss << fm.filename << " " << fm.fileSize << " " << fm.indexBlock << " ";
-            for (int blk : fm.blocks) ss << blk << " ";
+            // Buffered appends are not on disk yet, so persist the on-disk size
+            ss << fm.filename << " " << fm.fileSize - fm.pendingAppend.size() << " " << fm.indexBlock << " ";
+            writeBlockList(ss, fm.blocks);
             ss << "| " << formatTimestampToString(fm.createdAt) << " " 
                << formatTimestampToString(fm.modifiedAt);
             // append optional permission token for backward compatibility
-            ss << " perm " << fm.permissions << "\n";
+            ss << " perm " << fm.permissions;
+            if (fm.compressed) ss << " compressed";
+            writeInlineData(ss, fm);
+            ss << "\n";
     }
 
-    string data = ss.str();
-    for (size_t i = 0; i < data.size() && i < buffer.size(); i++)
-        buffer[i] = data[i];
-
-    bm.writeBlock(0, buffer); // store directory at block 0
+    return bm.writeTree(ss.str()); // store directory in the superblock's tree chain
 }
 
-// Save a Directory tree recursively
-void Serializer::saveDirectory(BlockManager& bm, Directory* dir) {
+// Serialize a Directory tree recursively
+string Serializer::treeText(Directory* dir) {
     stringstream ss;
 
     // Recursive lambda
@@ -83,46 +124,41 @@ void Serializer::saveDirectory(BlockManager& bm, Directory* dir) {
         for (auto& sd : d->subdirs) writeDir(sd.get(), indent + 2);
         for (auto& p : d->files) {
             FileMeta& fm = p.second;
-            ss << string(indent + 2, ' ') << "FILE " << fm.filename << " " << fm.fileSize << " " << fm.indexBlock << " ";
-            for (int blk : fm.blocks) ss << blk << " ";
+            // Buffered appends are not on disk yet, so persist the on-disk size
+            ss << string(indent + 2, ' ') << "FILE " << fm.filename << " " << fm.fileSize - fm.pendingAppend.size() << " " << fm.indexBlock << " ";
+            writeBlockList(ss, fm.blocks);
                 ss << "| " << formatTimestampToString(fm.createdAt) << " " << formatTimestampToString(fm.modifiedAt);
-                ss << " perm " << fm.permissions << "\n";
-            // ensure index block on disk matches fm.blocks
-            writeIndexBlock(bm, fm);
+                ss << " perm " << fm.permissions;
+            if (fm.compressed) ss << " compressed";
+            writeInlineData(ss, fm);
+            ss << "\n";
         }
         ss << string(indent, ' ') << "END_DIR\n";
     };
 
     writeDir(dir, 0);
-
-    string data = ss.str();
-    vector<char> buffer(bm.getBlockSize(), 0);
-    for (size_t i = 0; i < data.size() && i < buffer.size(); i++) buffer[i] = data[i];
-    bm.writeBlock(0, buffer);
+    return ss.str();
 }
 
-// Load directory from meta.bin
-Directory* Serializer::loadDirectory(BlockManager& bm) {
-    vector<char> buffer;
-    if (!bm.readBlock(0, buffer)) return nullptr;
-
-    // Check if block 0 is all zeros (uninitialized disk)
-    bool allZeros = true;
-    for (char c : buffer) {
-        if (c != 0) {
-            allZeros = false;
-            break;
-        }
-    }
-    if (allZeros) return nullptr;
+// Write every index block in a subtree from its in-memory block list
+static void writeIndexBlocks(BlockManager& bm, Directory* d) {
+    for (auto& p : d->files) Serializer::writeIndexBlock(bm, p.second);
+    for (auto& sd : d->subdirs) writeIndexBlocks(bm, sd.get());
+}
 
-    // Find the end of actual data (before padding nulls)
-    size_t dataEnd = 0;
-    for (size_t i = 0; i < buffer.size(); i++) {
-        if (buffer[i] != 0) dataEnd = i + 1;
-    }
+// Save a Directory tree recursively
+bool Serializer::saveDirectory(BlockManager& bm, Directory* dir) {
+    Stats::Timer timer(Stats::OP_SAVE_TREE);
+    string text = treeText(dir);
+    Stats::add(Stats::TREE_SAVES);
+    Stats::add(Stats::TREE_BYTES, (long long)text.size());
+    // ensure index blocks on disk match fm.blocks
+    writeIndexBlocks(bm, dir);
+    return bm.writeTree(text);
+}
 
-    string data(buffer.begin(), buffer.begin() + dataEnd);
+Directory* Serializer::parseTree(BlockManager& bm, const string& data, map<int, int>& owners,
+                                 long long& fileCount, long long& dirCount) {
     stringstream ss(data);
 
     // Parser stack
@@ -151,9 +187,10 @@ Directory* Serializer::loadDirectory(BlockManager& bm) {
             Directory* parent = stack.empty() ? nullptr : stack.back();
             Directory* dir = new Directory(name, parent, &bm);
             dir->permissions = perm;
-            if (parent) parent->subdirs.emplace_back(dir);
+            if (parent) parent->attachSubdir(unique_ptr<Directory>(dir));
             else root = dir;
             stack.push_back(dir);
+            dirCount++;
         } else if (token == "END_DIR") {
             if (!stack.empty()) stack.pop_back();
         } else if (token == "FILE") {
@@ -162,7 +199,9 @@ Directory* Serializer::loadDirectory(BlockManager& bm) {
             string tk;
             while (ls >> tk) {
                 if (tk == "|") break;
-                fm.blocks.push_back(stoi(tk));
+                if (tk[0] == 'h') fm.blocks.insert(fm.blocks.end(), stoi(tk.substr(1)), HOLE_BLOCK);
+                else if (tk[0] == 'p') fm.blocks.insert(fm.blocks.end(), stoi(tk.substr(1)), PACKED_BLOCK);
+                else fm.blocks.push_back(stoi(tk));
             }
             string createdStr, modifiedStr;
             if (ls >> createdStr >> modifiedStr) {
@@ -183,15 +222,53 @@ Directory* Serializer::loadDirectory(BlockManager& bm) {
                 } else {
                     fm.permissions = 6; // default file perm if not present
                 }
+            // optional flags; small files carry their contents in the record
+            string tag, hex;
+            while (ls >> tag) {
+                if (tag == "compressed") fm.compressed = true;
+                else if (tag == "inline" && ls >> hex) fm.inlineData = parseHex(hex);
+            }
+            if (fm.isInline()) fm.inlineData.resize((size_t)fm.fileSize, '\0');
             if (!stack.empty()) {
                 Directory* cur = stack.back();
                 cur->files[fm.filename] = fm;
-                // ensure index block contents are on disk (write index block
-                // based on fm.blocks)
-                writeIndexBlock(bm, cur->files[fm.filename]);
+                fileCount++;
+                for (int b : fm.blocks) if (b >= 0) owners[b]++;
             }
         }
     }
+    if (root) root->recountTree();
+    return root;
+}
+
+// Load directory from meta.bin
+Directory* Serializer::loadDirectory(BlockManager& bm) {
+    Stats::Timer timer(Stats::OP_LOAD_TREE);
+    Stats::add(Stats::TREE_LOADS);
+    string data;
+    if (!bm.readTree(data)) return nullptr;
 
+    // No tree saved yet (freshly formatted disk)
+    if (data.empty()) return nullptr;
+
+    long long fileCount = 0, dirCount = 0;
+    map<int, int> owners;  // data block → file slots referencing it
+    Directory* root = parseTree(bm, data, owners, fileCount, dirCount);
+    if (!root) return nullptr;
+    // ensure index block contents are on disk (written from fm.blocks)
+    writeIndexBlocks(bm, root);
+
+    // Snapshots hold their own references on the blocks they name
+    for (auto& snap : bm.getSnapshots()) {
+        string tree;
+        long long files = 0, dirs = 0;
+        if (!bm.readSnapshot(snap.name, tree)) {
+            FS_LOG(LOG_WARN, "Snapshot " << snap.name << " is unreadable");
+            continue;
+        }
+        delete parseTree(bm, tree, owners, files, dirs);
+    }
+    bm.setUsage(fileCount, dirCount);
+    bm.setRefCounts(owners);
     return root;
 }
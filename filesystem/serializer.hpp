@@ -12,14 +12,23 @@
 class Serializer {
 public:
     // Backwards-compatible (not used) signature
-    static void saveDirectory(BlockManager& bm, std::map<std::string, FileMeta>& files);
+    static bool saveDirectory(BlockManager& bm, std::map<std::string, FileMeta>& files);
     static void loadDirectory(BlockManager& bm, std::map<std::string, FileMeta>& files);
 
-    // New recursive directory tree serialization
-    static void saveDirectory(BlockManager& bm, Directory* dir);
+    // New recursive directory tree serialization; false if the tree could
+    // not be written (status set)
+    static bool saveDirectory(BlockManager& bm, Directory* dir);
     static Directory* loadDirectory(BlockManager& bm);
 
+    // Tree text without touching the disk; snapshots store and reopen it
+    static std::string treeText(Directory* dir);
+    // Counts each data block slot in owners; nullptr if data holds no tree
+    static Directory* parseTree(BlockManager& bm, const std::string& data, std::map<int, int>& owners,
+                                long long& fileCount, long long& dirCount);
+
     static void writeIndexBlock(BlockManager& bm, FileMeta& fm);
+    static std::vector<char> buildIndexBlock(const BlockManager& bm, const FileMeta& fm);
+    static int indexCapacity(const BlockManager& bm); // max entries in one index block
 };
 
 #endif
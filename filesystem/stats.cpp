@@ -0,0 +1,121 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+using namespace std;
+
+// Each counter and histogram on its own cache line, so threads updating
+// different ones never share a line
+struct alignas(64) CounterCell {
+    atomic<long long> value;
+};
+
+struct alignas(64) HistogramCell {
+    atomic<long long> count;
+    atomic<long long> totalUs;
+    atomic<long long> maxUs;
+    atomic<long long> buckets[Stats::BUCKETS];
+};
+
+static CounterCell counters[Stats::COUNTER_COUNT];
+static HistogramCell histograms[Stats::OP_COUNT];
+
+static const char* counterNames[Stats::COUNTER_COUNT] = {
+    "block_reads", "block_writes", "bytes_read", "bytes_written", "logical_read", "logical_written",
+    "meta_saves", "bitmap_updates", "tree_saves", "tree_bytes", "tree_loads"
+};
+
+static const char* opNames[Stats::OP_COUNT] = {
+    "create", "delete", "read", "write", "append", "fsync", "resize", "mkdir", "rmdir",
+    "block_read", "block_write", "save_meta", "save_tree", "load_tree"
+};
+
+static int bucketOf(long long micros) {
+    int b = 0;
+    while (micros > 0 && b < Stats::BUCKETS - 1) {
+        micros >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void Stats::add(Counter c, long long n) {
+    counters[c].value.fetch_add(n, memory_order_relaxed);
+}
+
+long long Stats::get(Counter c) {
+    return counters[c].value.load(memory_order_relaxed);
+}
+
+void Stats::record(Op op, long long micros) {
+    HistogramCell& h = histograms[op];
+    h.count.fetch_add(1, memory_order_relaxed);
+    h.totalUs.fetch_add(micros, memory_order_relaxed);
+    h.buckets[bucketOf(micros)].fetch_add(1, memory_order_relaxed);
+    long long seen = h.maxUs.load(memory_order_relaxed);
+    while (micros > seen && !h.maxUs.compare_exchange_weak(seen, micros, memory_order_relaxed)) {}
+}
+
+Stats::Histogram Stats::histogram(Op op) {
+    HistogramCell& h = histograms[op];
+    Histogram out;
+    out.count = h.count.load(memory_order_relaxed);
+    out.totalUs = h.totalUs.load(memory_order_relaxed);
+    out.maxUs = h.maxUs.load(memory_order_relaxed);
+    for (int i = 0; i < BUCKETS; i++) out.buckets[i] = h.buckets[i].load(memory_order_relaxed);
+    return out;
+}
+
+long long Stats::Histogram::percentile(double p) const {
+    long long total = 0;
+    for (int i = 0; i < BUCKETS; i++) total += buckets[i];
+    if (total == 0) return 0;
+    long long rank = (long long)(p * total);
+    if (rank >= total) rank = total - 1;
+    long long seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > rank) return min(i == 0 ? 1 : (1LL << i), maxUs);
+    }
+    return maxUs;
+}
+
+void Stats::reset() {
+    for (auto& c : counters) c.value.store(0, memory_order_relaxed);
+    for (auto& h : histograms) {
+        h.count.store(0, memory_order_relaxed);
+        h.totalUs.store(0, memory_order_relaxed);
+        h.maxUs.store(0, memory_order_relaxed);
+        for (auto& b : h.buckets) b.store(0, memory_order_relaxed);
+    }
+}
+
+const char* Stats::name(Counter c) {
+    return counterNames[c];
+}
+
+const char* Stats::name(Op op) {
+    return opNames[op];
+}
+
+void Stats::print(ostream& out) {
+    // Format in a private stream so the caller's flags are left alone
+    ostringstream ss;
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        ss << left << setw(17) << counterNames[c] << get((Counter)c) << "\n";
+    }
+    long long logical = get(LOGICAL_WRITTEN);
+    ss << left << setw(17) << "write_amp";
+    if (logical) ss << fixed << setprecision(2) << (double)get(BYTES_WRITTEN) / logical << "\n";
+    else ss << "-\n";
+
+    ss << "\n" << left << setw(13) << "operation" << right << setw(10) << "count" << setw(10) << "avg_us"
+       << setw(10) << "p50_us" << setw(10) << "p99_us" << setw(10) << "max_us" << "\n";
+    for (int op = 0; op < OP_COUNT; op++) {
+        Histogram h = histogram((Op)op);
+        if (h.count == 0) continue;
+        ss << left << setw(13) << opNames[op] << right << setw(10) << h.count << setw(10) << h.totalUs / h.count
+           << setw(10) << h.percentile(0.50) << setw(10) << h.percentile(0.99) << setw(10) << h.maxUs << "\n";
+    }
+    out << ss.str();
+}
@@ -0,0 +1,71 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+// Process-wide I/O and operation statistics. Every update is a relaxed
+// atomic add on its own cache line, so instrumentation stays on always.
+class Stats {
+public:
+    enum Counter {
+        BLOCK_READS,        // Image blocks read, sync and async
+        BLOCK_WRITES,       // Image blocks written, sync and async
+        BYTES_READ,         // Device bytes behind BLOCK_READS
+        BYTES_WRITTEN,      // Device bytes behind BLOCK_WRITES
+        LOGICAL_READ,       // File data returned to callers
+        LOGICAL_WRITTEN,    // File data handed in by callers
+        META_SAVES,         // Full bitmap saves (saveMeta)
+        BITMAP_UPDATES,     // Partial bitmap rewrites after allocate/free
+        TREE_SAVES,         // Directory tree serializations
+        TREE_BYTES,         // Size of the serialized trees
+        TREE_LOADS,
+        COUNTER_COUNT
+    };
+
+    // Operations with a latency histogram
+    enum Op {
+        OP_CREATE, OP_DELETE, OP_READ, OP_WRITE, OP_APPEND, OP_FSYNC, OP_RESIZE,
+        OP_MKDIR, OP_RMDIR,
+        OP_BLOCK_READ, OP_BLOCK_WRITE, OP_SAVE_META, OP_SAVE_TREE, OP_LOAD_TREE,
+        OP_COUNT
+    };
+
+    // Bucket 0 counts latencies under 1 us, bucket i those in [2^(i-1), 2^i) us
+    static const int BUCKETS = 32;
+
+    struct Histogram {
+        long long count;
+        long long totalUs;
+        long long maxUs;
+        long long buckets[BUCKETS];
+        long long percentile(double p) const; // Upper bound of the bucket holding p (capped at maxUs), in us
+    };
+
+    static void add(Counter c, long long n = 1);
+    static long long get(Counter c);
+    static void record(Op op, long long micros);
+    static Histogram histogram(Op op);
+    static void reset();
+
+    static const char* name(Counter c);
+    static const char* name(Op op);
+    static void print(std::ostream& out); // Counters, write amplification, per-op latency
+
+    // Records the lifetime of the enclosing scope under op
+    class Timer {
+    public:
+        explicit Timer(Op op) : op(op), start(std::chrono::steady_clock::now()) {}
+        ~Timer() {
+            record(op, std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+
+    private:
+        Op op;
+        std::chrono::steady_clock::time_point start;
+    };
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "superblock.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+static const char MAGIC[8] = { 'V', 'I', 'R', 'T', 'F', 'S', '0', '1' };
+
+// Helpers: fixed-width little-endian fields
+template <typename T>
+static void put(vector<char>& b, size_t off, T v) {
+    for (size_t i = 0; i < sizeof(T); i++) b[off + i] = (char)((uint64_t)v >> (8 * i));
+}
+
+template <typename T>
+static T get(const vector<char>& b, size_t off) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < sizeof(T); i++) v |= (uint64_t)(unsigned char)b[off + i] << (8 * i);
+    return (T)v;
+}
+
+void Superblock::encode(vector<char>& block) const {
+    fill(block.begin(), block.end(), 0);
+    memcpy(block.data(), MAGIC, sizeof(MAGIC));
+    put<uint32_t>(block, 8, version);
+    put<uint32_t>(block, 12, (uint32_t)blockSize);
+    put<int64_t>(block, 16, totalBlocks);
+    put<int64_t>(block, 24, treeBytes);
+    put<uint32_t>(block, 32, (uint32_t)treeBlocks.size());
+    put<int64_t>(block, 40, freeBlocks);
+    put<int64_t>(block, 48, fileCount);
+    put<int64_t>(block, 56, dirCount);
+    put<uint32_t>(block, 64, (uint32_t)inlineLimit);
+    put<int32_t>(block, 68, snapTable);
+    if (hasTreeChain()) {
+        put<int32_t>(block, 72, treeHead);
+        return;
+    }
+    for (size_t i = 0; i < treeBlocks.size() && SUPERBLOCK_HEADER + 4 * (i + 1) <= block.size(); i++) {
+        put<int32_t>(block, SUPERBLOCK_HEADER + 4 * i, treeBlocks[i]);
+    }
+}
+
+bool Superblock::decode(const vector<char>& block) {
+    if (block.size() < (size_t)SUPERBLOCK_HEADER) return false;
+    if (memcmp(block.data(), MAGIC, sizeof(MAGIC)) != 0) return false;
+    version = get<uint32_t>(block, 8);
+    blockSize = (int)get<uint32_t>(block, 12);
+    totalBlocks = get<int64_t>(block, 16);
+    treeBytes = get<int64_t>(block, 24);
+    size_t count = get<uint32_t>(block, 32);
+    if (hasCounters()) {
+        freeBlocks = get<int64_t>(block, 40);
+        fileCount = get<int64_t>(block, 48);
+        dirCount = get<int64_t>(block, 56);
+    }
+    if (hasInlineLimit()) inlineLimit = (int)get<uint32_t>(block, 64);
+    snapTable = hasSnapshots() ? get<int32_t>(block, 68) : 0;
+    treeHead = hasTreeChain() ? get<int32_t>(block, 72) : 0;
+    treeBlocks.clear();
+    if (hasTreeChain()) return true;  // The caller walks the chain
+    for (size_t i = 0; i < count && SUPERBLOCK_HEADER + 4 * (i + 1) <= block.size(); i++) {
+        treeBlocks.push_back(get<int32_t>(block, SUPERBLOCK_HEADER + 4 * i));
+    }
+    return true;
+}
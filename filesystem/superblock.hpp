@@ -0,0 +1,65 @@
+#ifndef SUPERBLOCK_HPP
+#define SUPERBLOCK_HPP
+
+#include <string>
+#include <vector>
+
+// On-disk superblock, stored in block 0 of the disk image.
+//
+// Layout (little-endian, byte offsets):
+//   0   magic "VIRTFS01"
+//   8   uint32 version
+//   12  uint32 blockSize
+//   16  int64  totalBlocks
+//   24  int64  treeBytes       length of the serialized directory tree
+//   32  uint32 treeBlockCount  blocks holding the tree text
+//   36  reserved
+//   40  int64  freeBlocks      usage counters (version 2+), kept current by
+//   48  int64  fileCount       BlockManager and the Directory mutators
+//   56  int64  dirCount
+//   64  uint32 inlineLimit     largest file kept in its directory entry (version 3+)
+//   68  int32  snapTable       first block of the snapshot table chain, 0 if
+//                              there are no snapshots (version 4+)
+//   72  int32  treeHead        first block of the chain holding the tree text
+//                              (version 5+)
+//   76  reserved up to SUPERBLOCK_HEADER
+//
+// The tree chain uses the same block format as the snapshot chains, so its
+// size is bounded only by free space. Version 2-4 images list the tree
+// blocks from offset 128 of block 0 instead, and images written before the
+// superblock existed keep the tree text directly in block 0; both are
+// upgraded on the next save.
+const int SUPERBLOCK_HEADER = 128;
+const unsigned SUPERBLOCK_VERSION = 5;
+const int MIN_BLOCK_SIZE = 512;
+const int MAX_BLOCK_SIZE = 1024 * 1024;
+const int DEFAULT_INLINE_LIMIT = 64;
+
+struct Superblock {
+    unsigned version;
+    int blockSize;
+    long long totalBlocks;
+    long long treeBytes;
+    std::vector<int> treeBlocks;  // In memory; on disk as a chain from treeHead (version 5+)
+    int treeHead;
+    long long freeBlocks;
+    long long fileCount;
+    long long dirCount;
+    int inlineLimit;
+    int snapTable;
+
+    Superblock() : version(SUPERBLOCK_VERSION), blockSize(0), totalBlocks(0), treeBytes(0), treeHead(0),
+                   freeBlocks(0), fileCount(0), dirCount(0), inlineLimit(DEFAULT_INLINE_LIMIT),
+                   snapTable(0) {}
+
+    bool hasCounters() const { return version >= 2; }
+    bool hasInlineLimit() const { return version >= 3; }
+    bool hasSnapshots() const { return version >= 4; }
+    bool hasTreeChain() const { return version >= 5; }
+
+    void encode(std::vector<char>& block) const;       // block must be blockSize long
+    bool decode(const std::vector<char>& block);       // false if the magic is missing;
+                                                       // version 5+ leaves treeBlocks empty
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "treewalk.hpp"
+#include "directory.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+struct WalkQueue {
+    mutex lock;
+    deque<Directory*> dirs;
+};
+
+int TreeWalk::workers() {
+    return (int)min<unsigned>(16, max<unsigned>(1, thread::hardware_concurrency()));
+}
+
+void TreeWalk::run(Directory* top, const Visitor& visit) {
+    if (!top) return;
+    if (top->subdirs.empty()) {
+        visit(top, 0);  // Nothing to share out
+        return;
+    }
+
+    int n = workers();
+    vector<unique_ptr<WalkQueue>> queues;
+    for (int i = 0; i < n; i++) queues.emplace_back(new WalkQueue);
+    queues[0]->dirs.push_back(top);
+    // Directories queued or being visited; children are counted before
+    // their parent is retired, so zero means the walk is over
+    atomic<long long> pending(1);
+
+    auto work = [&](int id) {
+        WalkQueue& own = *queues[id];
+        while (pending.load() > 0) {
+            Directory* d = nullptr;
+            {
+                lock_guard<mutex> lk(own.lock);
+                if (!own.dirs.empty()) {
+                    d = own.dirs.back();
+                    own.dirs.pop_back();
+                }
+            }
+            for (int k = 1; !d && k < n; k++) {
+                WalkQueue& victim = *queues[(id + k) % n];
+                lock_guard<mutex> lk(victim.lock);
+                if (!victim.dirs.empty()) {
+                    d = victim.dirs.front();
+                    victim.dirs.pop_front();
+                }
+            }
+            if (!d) {
+                this_thread::yield();
+                continue;
+            }
+            visit(d, id);
+            if (!d->subdirs.empty()) {
+                pending += (long long)d->subdirs.size();
+                lock_guard<mutex> lk(own.lock);
+                for (auto& sd : d->subdirs) own.dirs.push_back(sd.get());
+            }
+            pending--;
+        }
+    };
+
+    vector<thread> pool;
+    for (int i = 1; i < n; i++) pool.emplace_back(work, i);
+    work(0);
+    for (auto& t : pool) t.join();
+}
@@ -0,0 +1,24 @@
+#ifndef TREEWALK_HPP
+#define TREEWALK_HPP
+
+#include <functional>
+
+class Directory;
+
+// Parallel traversal of a directory subtree on a work-stealing pool. Each
+// worker keeps its own deque of directories, takes its newest entry and,
+// when empty, steals the oldest from another worker, so wide and deep trees
+// alike keep every thread busy.
+class TreeWalk {
+public:
+    // Called once per directory with the worker's index, so results can be
+    // gathered per worker without locking
+    typedef std::function<void(Directory*, int)> Visitor;
+
+    static int workers();   // Pool size: hardware threads, at most 16
+    // Visits top and every directory below it. The tree's shape must not
+    // change until run returns; visitors may read or edit file entries.
+    static void run(Directory* top, const Visitor& visit);
+};
+
+#endif
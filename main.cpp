@@ -1,181 +1,525 @@
-#include "filesystem/BlockManager.hpp"
+#include "filesystem/blockmanager.hpp"
 #include "filesystem/FileSystem.hpp"
+#include "filesystem/log.hpp"
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <sstream>
 using namespace std;
 
-int main() {
-    BlockManager bm("disc/virtualdisc.bin", "disc/meta.bin", 512, 100);
-    bm.init();
+static const char* DISK_PATH = "disc/virtualdisc.bin";
+static const char* META_PATH = "disc/meta.bin";
 
-    // FileSystem manages the directory tree and current working directory
-    FileSystem fs(&bm);
-    fs.load();
+// Parse a byte count with an optional K/M/G/T suffix; -1 on error
+static long long parseSize(const string& text) {
+    char* end = nullptr;
+    long long value = strtoll(text.c_str(), &end, 10);
+    if (end == text.c_str() || value < 0) return -1;
+    string suffix(end);
+    long long unit = 1;
+    if (suffix == "K" || suffix == "k") unit = 1LL << 10;
+    else if (suffix == "M" || suffix == "m") unit = 1LL << 20;
+    else if (suffix == "G" || suffix == "g") unit = 1LL << 30;
+    else if (suffix == "T" || suffix == "t") unit = 1LL << 40;
+    else if (!suffix.empty()) return -1;
+    return value * unit;
+}
 
-    cout << "=== File System Emulator CLI ===\n";
-    cout << "Commands: create, write, read, delete, list, info, append, resize, mkdir, cd, pwd, ls, chmod, diskview, fsck, rmdir, exit\n";
+// Runs one command line, writing its own output to out; false once the user
+// asks to exit. Reports the library prints itself (ls, df, ...) still go
+// straight to cout.
+static bool dispatchCommand(FileSystem& fs, BlockManager& bm, const string& line, ostream& out) {
+    stringstream ss(line);
+    string cmd;
+    ss >> cmd;
 
-    string line;
-    while (true) {
-        cout << "fs> ";
-        getline(cin, line);
-        stringstream ss(line);
-        string cmd;
-        ss >> cmd;
+    if (cmd == "exit") return false;
 
-        if (cmd == "exit") break;
-
-        else if (cmd == "create") {
-            string filename;
-            int size;
-            ss >> filename >> size;
-            if (filename.empty() || size <= 0) {
-                cout << "[ERROR] Usage: create filename size\n";
-                continue;
-            }
-            fs.createFile(filename, size);
+    else if (cmd == "create") {
+        string filename;
+        long long size = 0;
+        ss >> filename >> size;
+        if (filename.empty() || size <= 0) {
+            out << "[ERROR] Usage: create filename size\n";
+            return true;
         }
+        fs.createFile(filename, size);
+    }
 
-        else if (cmd == "write") {
-            string filename;
-            ss >> filename;
-            string content;
-            getline(ss, content); // rest of line
-            if (filename.empty() || content.empty()) {
-                cout << "[ERROR] Usage: write filename \"content\"\n";
-                continue;
-            }
-            // remove leading space from content
-            if (content[0] == ' ') content = content.substr(1);
-            fs.writeFile(filename, content);
+    else if (cmd == "write") {
+        string filename;
+        ss >> filename;
+        string content;
+        getline(ss, content); // rest of line
+        if (filename.empty() || content.empty()) {
+            out << "[ERROR] Usage: write filename \"content\"\n";
+            return true;
         }
+        // remove leading space from content
+        if (content[0] == ' ') content = content.substr(1);
+        fs.writeFile(filename, content);
+    }
 
-        else if (cmd == "read") {
-            string filename;
-            ss >> filename;
-            if (filename.empty()) {
-                cout << "[ERROR] Usage: read filename\n";
-                continue;
-            }
-            string content = fs.readFile(filename);
-            cout << content << endl;
+    else if (cmd == "read") {
+        string filename;
+        ss >> filename;
+        if (filename.empty()) {
+            out << "[ERROR] Usage: read filename\n";
+            return true;
         }
+        string content = fs.readFile(filename);
+        out << content << "\n";
+    }
 
-        else if (cmd == "delete") {
-            string filename;
-            ss >> filename;
-            if (filename.empty()) {
-                cout << "[ERROR] Usage: delete filename\n";
-                continue;
-            }
-            fs.deleteFile(filename);
+    else if (cmd == "delete") {
+        string filename;
+        ss >> filename;
+        if (filename.empty()) {
+            out << "[ERROR] Usage: delete filename\n";
+            return true;
         }
+        fs.deleteFile(filename);
+    }
 
-        else if (cmd == "list") {
-            fs.listFiles();
+    else if (cmd == "rename" || cmd == "mv") {
+        string src, dst;
+        ss >> src >> dst;
+        if (src.empty() || dst.empty()) {
+            out << "[ERROR] Usage: rename source destination\n";
+            return true;
         }
+        fs.rename(src, dst);
+    }
 
-        else if (cmd == "info") {
-            string filename;
-            ss >> filename;
-            if (filename.empty()) {
-                cout << "[ERROR] Usage: info filename\n";
-                continue;
-            }
-            fs.infoFile(filename);
+    else if (cmd == "clone") {
+        string src, dst;
+        ss >> src >> dst;
+        if (src.empty() || dst.empty()) {
+            out << "[ERROR] Usage: clone source destination\n";
+            return true;
         }
+        fs.cloneFile(src, dst);
+    }
 
-        else if (cmd == "append") {
-            string filename;
-            ss >> filename;
-            string data;
-            getline(ss, data); 
-            if (filename.empty() || data.empty()) {
-                cout << "[ERROR] Usage: append filename \"data\"\n";
-                continue;
-            }
-            // remove leading space from data
-            if (data[0] == ' ') data = data.substr(1);
-            fs.appendFile(filename, data);
-        }
-
-        else if (cmd == "resize") {
-            string filename;
-            int newSize;
-            ss >> filename >> newSize;
-            if (filename.empty() || newSize < 0) {
-                cout << "[ERROR] Usage: resize filename newsize\n";
-                continue;
-            }
-            fs.resizeFile(filename, newSize);
+    else if (cmd == "list") {
+        fs.listFiles();
+    }
+
+    else if (cmd == "info") {
+        string filename;
+        ss >> filename;
+        if (filename.empty()) {
+            out << "[ERROR] Usage: info filename\n";
+            return true;
         }
+        fs.infoFile(filename);
+    }
 
-        else if (cmd == "mkdir") {
-            string name; ss >> name;
-            if (name.empty()) { cout << "[ERROR] Usage: mkdir name\n"; continue; }
-            fs.mkdir(name);
+    else if (cmd == "append") {
+        string filename;
+        ss >> filename;
+        string data;
+        getline(ss, data); 
+        if (filename.empty() || data.empty()) {
+            out << "[ERROR] Usage: append filename \"data\"\n";
+            return true;
         }
+        // remove leading space from data
+        if (data[0] == ' ') data = data.substr(1);
+        fs.appendFile(filename, data);
+    }
 
-        else if (cmd == "cd") {
-            string name; ss >> name;
-            if (name.empty()) { cout << "[ERROR] Usage: cd name\n"; continue; }
-            if (!fs.cd(name)) cout << "[ERROR] Directory not found or cannot move up\n";
-            else {
-                fs.ls();
-            }
+    else if (cmd == "resize") {
+        string filename;
+        long long newSize = -1;
+        ss >> filename >> newSize;
+        if (filename.empty() || newSize < 0) {
+            out << "[ERROR] Usage: resize filename newsize\n";
+            return true;
         }
+        fs.resizeFile(filename, newSize);
+    }
 
-        else if (cmd == "pwd") {
-            cout << fs.pwd() << "\n";
+    else if (cmd == "compress") {
+        string filename, mode = "on";
+        ss >> filename >> mode;
+        if (filename.empty() || (mode != "on" && mode != "off")) {
+            out << "[ERROR] Usage: compress filename [on|off]\n";
+            return true;
         }
+        fs.compress(filename, mode == "on");
+    }
+
+    else if (cmd == "fsync") {
+        string filename;
+        ss >> filename;  // optional: no name syncs every file
+        fs.fsync(filename);
+    }
+
+    else if (cmd == "mkdir") {
+        string name; ss >> name;
+        if (name.empty()) { out << "[ERROR] Usage: mkdir name\n"; return true; }
+        fs.mkdir(name);
+    }
 
-        else if (cmd == "ls") {
+    else if (cmd == "cd") {
+        string name; ss >> name;
+        if (name.empty()) { out << "[ERROR] Usage: cd name\n"; return true; }
+        if (!fs.cd(name)) {
+            out << "[ERROR] Directory not found or cannot move up\n";
+        }
+        else {
             fs.ls();
         }
+    }
+
+    else if (cmd == "pwd") {
+        out << fs.pwd() << "\n";
+    }
+
+    else if (cmd == "ls") {
+        fs.ls();
+    }
+
+    else if (cmd == "diskview") {
+        // Print the geometry from the superblock and the stored directory tree
+        out << "[diskview] " << bm.getTotalBlocks() << " blocks x " << bm.getBlockSize()
+             << " bytes = " << bm.getDiskBytes() << " bytes; tree in blocks:";
+        for (int b : bm.getTreeBlocks()) out << " " << b;
+        out << "\n";
+        string s;
+        if (!bm.readTree(s)) { out << "[ERROR] Failed to read directory tree\n"; return true; }
+        if (s.empty()) { out << "[diskview] (empty)\n"; return true; }
+        out << s << "\n";
+    }
+
+    else if (cmd == "df") {
+        fs.df();
+    }
+
+    else if (cmd == "stats") {
+        string arg;
+        ss >> arg;
+        if (arg == "reset") fs.resetStats();
+        else fs.stats();
+    }
+
+    else if (cmd == "du") {
+        string path; ss >> path;  // optional: current directory
+        fs.du(path);
+    }
+
+    else if (cmd == "find") {
+        string path, pattern;
+        ss >> path >> pattern;
+        fs.find(path, pattern);
+    }
+
+    else if (cmd == "grep") {
+        // A pattern with spaces goes in double quotes
+        string pattern, path;
+        ss >> ws;
+        if (ss.peek() == '"') {
+            ss.get();
+            getline(ss, pattern, '"');
+        } else ss >> pattern;
+        ss >> path;
+        if (pattern.empty()) { out << "[ERROR] Usage: grep pattern|\"some text\" [dir]\n"; return true; }
+        fs.grep(pattern, path);
+    }
+
+    else if (cmd == "dedup") {
+        fs.dedupReport();
+    }
 
-        else if (cmd == "diskview") {
-            // Print the metadata block (block 0) which stores directory tree
-            std::vector<char> buf;
-            if (!bm.readBlock(0, buf)) { cout << "[ERROR] Failed to read disk block 0\n"; continue; }
-            // Find last non-zero char to avoid printing trailing garbage
-            int last = (int)buf.size() - 1;
-            while (last >= 0 && buf[last] == 0) --last;
-            if (last < 0) { cout << "[diskview] (empty)\n"; continue; }
-            string s(buf.begin(), buf.begin() + last + 1);
-            cout << "[diskview]\n" << s << "\n";
+    else if (cmd == "frag") {
+        fs.fragReport();
+    }
+
+    else if (cmd == "defrag") {
+        int maxMBps = 0;
+        ss >> maxMBps;  // optional: copy-rate cap in MB/s
+        fs.defrag(maxMBps);
+    }
+
+    else if (cmd == "import") {
+        string host, dest;
+        ss >> host >> dest;  // dest optional: current directory
+        if (host.empty()) { out << "[ERROR] Usage: import hostdir [dest]\n"; return true; }
+        fs.importTree(host, dest);
+    }
+
+    else if (cmd == "export") {
+        string target, src;
+        ss >> target >> src;  // src optional: the whole tree
+        if (target.empty()) { out << "[ERROR] Usage: export hostdir|archive.tar [dir]\n"; return true; }
+        fs.exportTree(target, src);
+    }
+
+    else if (cmd == "snapshot") {
+        string sub, name, path;
+        ss >> sub >> name >> path;
+        if (sub == "list") fs.listSnapshots();
+        else if (sub == "create" && !name.empty()) fs.createSnapshot(name);
+        else if (sub == "delete" && !name.empty()) fs.deleteSnapshot(name);
+        else if (sub == "ls" && !name.empty()) fs.snapshotLs(name, path);
+        else if (sub == "cat" && !path.empty()) fs.snapshotCat(name, path);
+        else out << "[ERROR] Usage: snapshot create|delete name, snapshot list, snapshot ls name [dir], snapshot cat name path\n";
+    }
+
+    else if (cmd == "rmdir") {
+        string name; ss >> name;
+        if (name.empty()) { out << "[ERROR] Usage: rmdir name\n"; return true; }
+        fs.removeDirectory(name);
+    }
+
+    else if (cmd == "fsck") {
+        string arg; ss >> arg;
+        bool repair = false;
+        if (arg == "repair") repair = true;
+        fs.checkMeta(repair);
+    }
+
+    // (restoremeta removed)
+
+    else if (cmd == "watch") {
+        // Print each change as it happens until "watch off"
+        static int watchId = 0;
+        string arg; ss >> arg;
+        if (arg == "on" && !watchId) {
+            watchId = fs.subscribe([](const ChangeEvent& e) {
+                cout << "[watch] #" << e.seq << " " << ChangeFeed::typeName(e.type) << " " << e.path;
+                if (e.type == CHANGE_RENAME) cout << " -> " << e.newPath;
+                if (e.size >= 0) cout << " (" << e.size << " bytes)";
+                cout << "\n";
+            });
+        } else if (arg == "off" && watchId) {
+            fs.unsubscribe(watchId);
+            watchId = 0;
+        } else if (arg != "on" && arg != "off") {
+            out << "[ERROR] Usage: watch on|off\n";
         }
+    }
 
-        else if (cmd == "rmdir") {
-            string name; ss >> name;
-            if (name.empty()) { cout << "[ERROR] Usage: rmdir name\n"; continue; }
-            fs.removeDirectory(name);
+    else if (cmd == "chmod") {
+        int mode; string name; ss >> mode >> name;
+        if (name.empty()) { out << "[ERROR] Usage: chmod <mode> <name>\n"; return true; }
+        if (mode < 0 || mode > 7) { out << "[ERROR] Mode must be in 0-7\n"; return true; }
+        if (!fs.chmodEntry(mode, name)) {
+            out << "[ERROR] chmod failed: " << statusText(lastStatus()) << "\n";
         }
+    }
+
+    else {
+        out << "[ERROR] Unknown command\n";
+    }
+    return true;
+}
+
+// Runs one command line; false once the user asks to exit. The command's
+// output is held back until the library messages it caused have been
+// printed, so the two never interleave.
+static bool runCommand(FileSystem& fs, BlockManager& bm, const string& line) {
+    ostringstream out;
+    bool more = dispatchCommand(fs, bm, line, out);
+    Log::flush();
+    cout << out.str();
+    return more;
+}
 
-        else if (cmd == "fsck") {
-            string arg; ss >> arg;
-            bool repair = false;
-            if (arg == "repair") repair = true;
-            fs.checkMeta(repair);
+// Runs a command script without prompts. Tree saves are deferred and
+// committed every batchSize commands; a timing summary per command goes to
+// stderr, plus one line per command with timing on. Stops at the first batch
+// whose tree save fails and returns false.
+static bool runBatch(FileSystem& fs, BlockManager& bm, istream& in, int batchSize, bool timing) {
+    struct CommandTime {
+        long long count;
+        double totalUs;
+        double maxUs;
+    };
+    map<string, CommandTime> times;
+    long long lineNo = 0, commands = 0, batches = 0;
+    long long batchStart = 0;   // Line of the first command in the open batch
+    int inBatch = 0;
+    bool saved = true;
+    auto start = chrono::steady_clock::now();
+
+    fs.beginBatch();
+    string line;
+    while (getline(in, line)) {
+        lineNo++;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos || line[first] == '#') continue;  // blank or comment
+        string cmd;
+        stringstream(line) >> cmd;
+
+        auto t0 = chrono::steady_clock::now();
+        bool more = runCommand(fs, bm, line);
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count();
+        if (!more) break;
+        if (inBatch == 0) batchStart = lineNo;
+
+        CommandTime& t = times[cmd];
+        t.count++;
+        t.totalUs += us;
+        if (us > t.maxUs) t.maxUs = us;
+        commands++;
+        if (timing) cerr << "[TIME] line " << lineNo << ": " << cmd << " " << (long long)us << " us\n";
+        if (++inBatch >= batchSize) {
+            saved = fs.commitBatch();
+            batches++;
+            inBatch = 0;
+            if (!saved) break;
+            fs.beginBatch();
         }
+    }
+    if (saved) {
+        saved = fs.commitBatch();
+        if (inBatch > 0) batches++;
+    }
+    Log::flush();
+    if (!saved) {
+        cout << "[ERROR] Batch at lines " << batchStart << "-" << lineNo << " could not be saved: "
+             << statusText(lastStatus()) << "\n";
+    }
 
-        // (restoremeta removed)
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    ostringstream out;
+    out << fixed << setprecision(1);
+    out << "[BATCH] " << commands << " commands in " << secs * 1000 << " ms ("
+        << (secs > 0 ? commands / secs : 0.0) << " commands/s), " << batches << " batches\n";
+    out << "  " << left << setw(10) << "command" << right << setw(10) << "count" << setw(12) << "avg_us"
+        << setw(12) << "max_us" << setw(12) << "total_ms" << "\n";
+    for (auto& p : times) {
+        out << "  " << left << setw(10) << p.first << right << setw(10) << p.second.count
+            << setw(12) << p.second.totalUs / p.second.count << setw(12) << p.second.maxUs
+            << setw(12) << p.second.totalUs / 1000 << "\n";
+    }
+    cerr << out.str();
+    return saved;
+}
 
-        else if (cmd == "chmod") {
-            int mode; string name; ss >> mode >> name;
-            if (name.empty()) { cout << "[ERROR] Usage: chmod <mode> <name>\n"; continue; }
-            if (mode < 0 || mode > 7) { cout << "[ERROR] Mode must be in 0-7\n"; continue; }
-            if (!fs.chmodEntry(mode, name)) {
-                cout << "[ERROR] chmod failed\n";
+int main(int argc, char** argv) {
+    // Geometry only applies when formatting; existing images keep their own
+    int blockSize = 512;
+    long long totalBlocks = 100;
+    long long imageBytes = -1;
+    long long inlineMax = DEFAULT_INLINE_LIMIT;
+    bool format = false;
+    bool dedup = false;
+    bool compress = false;
+    bool discard = false;
+    LogLevel logLevel = LOG_INFO;  // The library alone defaults to LOG_WARN
+    string importDir;           // Host tree copied into the root after mount
+    string batchScript;         // Empty: interactive; "-": stdin
+    long long batchSize = 1000;
+    bool timing = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--block-size" && hasValue) blockSize = (int)parseSize(argv[++i]);
+        else if (arg == "--blocks" && hasValue) totalBlocks = parseSize(argv[++i]);
+        else if (arg == "--size" && hasValue) imageBytes = parseSize(argv[++i]);
+        else if (arg == "--inline-max" && hasValue) inlineMax = parseSize(argv[++i]);
+        else if (arg == "--format") format = true;
+        else if (arg == "--dedup") dedup = true;
+        else if (arg == "--compress") compress = true;
+        else if (arg == "--discard") discard = true;
+        else if (arg == "--import" && hasValue) importDir = argv[++i];
+        else if (arg == "--batch" && hasValue) batchScript = argv[++i];
+        else if (arg == "--batch-size" && hasValue) batchSize = parseSize(argv[++i]);
+        else if (arg == "--timing") timing = true;
+        else if (arg == "--log-level" && hasValue) {
+            string name = argv[++i];
+            if (name == "debug") logLevel = LOG_DEBUG;
+            else if (name == "info") logLevel = LOG_INFO;
+            else if (name == "warn") logLevel = LOG_WARN;
+            else if (name == "error") logLevel = LOG_ERROR;
+            else if (name == "off") logLevel = LOG_OFF;
+            else {
+                cout << "[ERROR] --log-level must be debug, info, warn, error or off\n";
+                return 1;
             }
         }
-
         else {
-            cout << "[ERROR] Unknown command\n";
+            cout << "Usage: " << argv[0] << " [--format] [--block-size N] [--blocks N | --size N[K|M|G|T]]"
+                 << " [--inline-max N] [--dedup] [--compress] [--discard]"
+                 << " [--log-level debug|info|warn|error|off] [--import HOSTDIR]"
+                 << " [--batch FILE|- [--batch-size N] [--timing]]\n";
+            return 1;
+        }
+    }
+    Log::setLevel(logLevel);
+    if (imageBytes >= 0 && blockSize > 0) totalBlocks = imageBytes / blockSize;
+    string why;
+    if (!BlockManager::validGeometry(blockSize, totalBlocks, why)) {
+        cout << "[ERROR] Invalid geometry: " << why << "\n";
+        return 1;
+    }
+    if (batchSize < 1 || batchSize > INT_MAX) {
+        cout << "[ERROR] --batch-size must be at least 1\n";
+        return 1;
+    }
+    if (inlineMax < 0 || inlineMax > blockSize / 2) {
+        cout << "[ERROR] --inline-max must be between 0 and half the block size\n";
+        return 1;
+    }
+    if (format) {
+        remove(DISK_PATH);
+        remove(META_PATH);
+    }
+
+    BlockManager bm(DISK_PATH, META_PATH, blockSize, (int)totalBlocks);
+    bm.setInlineLimit((int)inlineMax);
+    bm.setDedup(dedup);
+    bm.setCompressNewFiles(compress);
+    bm.setDiscard(discard);
+    bm.init();
+
+    // FileSystem manages the directory tree and current working directory
+    FileSystem fs(&bm);
+    fs.load();
+
+    if (!importDir.empty() && !fs.importTree(importDir, "/")) {
+        Log::flush();
+        return 1;
+    }
+
+    if (!batchScript.empty()) {
+        ifstream script;
+        if (batchScript != "-") {
+            script.open(batchScript);
+            if (!script.good()) {
+                cout << "[ERROR] Cannot open script: " << batchScript << "\n";
+                return 1;
+            }
         }
+        bool ran = runBatch(fs, bm, batchScript == "-" ? cin : script, (int)batchSize, timing);
+        bool saved = fs.save();
+        bm.saveMeta();
+        Log::flush();
+        return ran && saved ? 0 : 1;
+    }
+
+    Log::flush();
+    cout << "=== File System Emulator CLI ===\n";
+    cout << "Commands: create, write, read, delete, clone, rename, list, info, append, resize, compress, fsync, mkdir, cd, pwd, ls, chmod, diskview, df, du, find, grep, stats, dedup, frag, defrag, import, export, snapshot, fsck, rmdir, exit\n";
+
+    string line;
+    while (true) {
+        cout << "fs> ";
+        if (!getline(cin, line)) break;
+        if (!runCommand(fs, bm, line)) break;
     }
 
-    fs.save();
+    bool saved = fs.save();
     bm.saveMeta();
+    Log::flush();
     cout << "Exiting File System Emulator.\n";
-    return 0;
+    return saved ? 0 : 1;
 }
@@ -0,0 +1,59 @@
+// Delayed allocation: buffered appends reach the disk on fsync or at exit,
+// and the blocks they will need are reserved while they wait.
+//
+// Usage: append_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+using namespace std;
+
+static void testBufferedPersist() {
+    Image img("append_persist", 512, 256, 0);
+    FileSystem& fs = *img.fs;
+    string tail = pattern(900, 2);
+    CHECK(fs.createFile("log", 1) && fs.writeFile("log", "L"));
+    int free0 = img.freeBlocks();
+    for (int i = 0; i < 9; i++) CHECK(fs.appendFile("log", tail.substr(i * 100, 100)));
+    CHECK(img.freeBlocks() == free0);  // Nothing allocated yet
+    CHECK(fs.readFile("log") == string("L") + tail);
+
+    CHECK(img.remount());  // Exit flushes the buffer
+    CHECK(img.fs->readFile("log") == string("L") + tail);
+    CHECK(img.freeBlocks() == free0 - 1);
+}
+
+static void testReservation() {
+    Image img("append_reserve", 512, 64, 0);
+    FileSystem& fs = *img.fs;
+
+    // Leave a few blocks free, then buffer an append: its blocks are
+    // reserved, so a write elsewhere cannot take them before the flush
+    CHECK(fs.createFile("log", 1) && fs.writeFile("log", "L"));
+    long long fill = 512LL * (img.freeBlocks() - 8);
+    CHECK(fs.createFile("fill", fill) && fs.writeFile("fill", pattern(fill, 8)));
+    string tail = pattern(512 * 3, 9);
+    CHECK(fs.appendFile("log", tail));
+    CHECK(img.bm->getReservedBlocks() == 3);
+    CHECK(fs.createFile("other", 512 * 16));
+    CHECK(!fs.writeFile("other", pattern(512 * 16, 10)));
+    CHECK(lastStatus() == FS_NO_SPACE);
+    CHECK(fs.fsync("log"));
+    CHECK(img.bm->getReservedBlocks() == 0);
+    CHECK(fs.readFile("log") == string("L") + tail);
+
+    // An append that cannot be reserved is refused and leaves no trace
+    CHECK(!fs.appendFile("log", pattern(512 * 4, 11)));
+    CHECK(lastStatus() == FS_NO_SPACE);
+    CHECK(fs.readFile("log") == string("L") + tail);
+
+    CHECK(img.remount());
+    CHECK(img.fs->readFile("log") == string("L") + tail);
+    CHECK(img.bm->getReservedBlocks() == 0);
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testBufferedPersist();
+    testReservation();
+    return finish();
+}
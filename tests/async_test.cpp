@@ -0,0 +1,147 @@
+// Regression tests for the coroutine API (C++20): files written through
+// AsyncFileSystem persist, share blocks copy-on-write like synchronous
+// ones, report a short write when the disk fills, and keep their contents
+// whole when many coroutines use the same files at once.
+//
+// Usage: async_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+#include "../filesystem/asyncfs.hpp"
+#include <algorithm>
+#include <thread>
+using namespace std;
+
+static void testPersistence() {
+    Image img("async_persist", 512, 256, 0);
+    string body = pattern(1500, 1), tail = pattern(700, 2);
+    {
+        AsyncFileSystem afs(*img.fs);
+        for (int i = 0; i < 8; i++) {
+            string name = "f" + to_string(i);
+            CHECK(syncWait(afs.createFile(name, 1500)));
+            CHECK(syncWait(afs.writeFile(name, body)));
+            CHECK(syncWait(afs.appendFile(name, tail)));
+        }
+        CHECK(syncWait(afs.readFile("f3")) == body + tail);
+        CHECK(afs.flush());
+    }
+    CHECK(img.remount());
+    for (int i = 0; i < 8; i++) CHECK(img.fs->readFile("f" + to_string(i)) == body + tail);
+}
+
+static void testCloneCow() {
+    Image img("async_clone", 512, 256, 0);
+    string body = pattern(1000, 3);
+    CHECK(img.fs->createFile("a", 1000) && img.fs->writeFile("a", body));
+    CHECK(img.fs->cloneFile("a", "b"));
+    {
+        AsyncFileSystem afs(*img.fs);
+        CHECK(syncWait(afs.writeFile("b", pattern(1000, 4))));
+        CHECK(syncWait(afs.appendFile("a", "xyz")));
+        CHECK(afs.flush());
+    }
+    CHECK(img.fs->readFile("a") == body + "xyz");
+    CHECK(img.fs->readFile("b") == pattern(1000, 4));
+    FileMeta a = img.fs->root->getFile("a"), b = img.fs->root->getFile("b");
+    CHECK(a.blocks[0] != b.blocks[0] && a.blocks[1] != b.blocks[1]);
+    CHECK(img.remount());
+    CHECK(img.fs->readFile("a") == body + "xyz");
+}
+
+static void testNoSpace() {
+    Image img("async_nospace", 512, 32, 0);
+    CHECK(img.fs->save());  // The tree gets its block while there is room
+    {
+        AsyncFileSystem afs(*img.fs);
+        CHECK(syncWait(afs.createFile("big", 512 * 64)));
+        CHECK(!syncWait(afs.writeFile("big", pattern(512 * 64, 5))));
+        CHECK(!syncWait(afs.appendFile("big", pattern(512 * 4, 6))));
+        CHECK(afs.flush());
+    }
+    // What was written is a prefix of the data, and it survives
+    string kept = img.fs->readFile("big");
+    CHECK(!kept.empty() && kept.size() < 512 * 64);
+    CHECK(kept == pattern(512 * 64, 5).substr(0, kept.size()));
+    CHECK(img.remount());
+    CHECK(img.fs->readFile("big") == kept);
+}
+
+const int WORKERS = 8, ROUNDS = 12, RECORD = 100, SWAP_SIZE = 1500;
+
+// A read of "swap" must return exactly one writer's version
+static bool isVersion(const string& s) {
+    for (int id = 0; id < WORKERS; id++)
+        if (s == pattern(SWAP_SIZE, 100 + id)) return true;
+    return false;
+}
+
+// A read of "shared" must hold whole records, each from a single writer
+static bool isLog(const string& s) {
+    if (s.size() % RECORD != 0) return false;
+    for (size_t i = 0; i < s.size(); i += RECORD)
+        if (s.compare(i, RECORD, string(RECORD, s[i])) != 0) return false;
+    return true;
+}
+
+// One coroutine's share of the work; returns the number of failed checks
+static Task<int> worker(AsyncFileSystem& afs, int id) {
+    int bad = 0;
+    string own = "own" + to_string(id);
+    string expect = pattern(1200 + id * 100, id);
+    if (!co_await afs.createFile(own, (long long)expect.size())) bad++;
+    if (!co_await afs.writeFile(own, expect)) bad++;
+    for (int k = 0; k < ROUNDS; k++) {
+        string tail = pattern(37 + k, id + k);
+        if (!co_await afs.appendFile(own, tail)) bad++;
+        expect += tail;
+        if (!co_await afs.appendFile("shared", string(RECORD, (char)('A' + id)))) bad++;
+        if (!co_await afs.writeFile("swap", pattern(SWAP_SIZE, 100 + id))) bad++;
+        if (!isVersion(co_await afs.readFile("swap"))) bad++;
+        if (!isLog(co_await afs.readFile("shared"))) bad++;
+    }
+    if (co_await afs.readFile(own) != expect) bad++;
+    co_return bad;
+}
+
+static void checkConcurrent(FileSystem& fs) {
+    for (int id = 0; id < WORKERS; id++) {
+        string own = "own" + to_string(id);
+        string expect = pattern(1200 + id * 100, id);
+        for (int k = 0; k < ROUNDS; k++) expect += pattern(37 + k, id + k);
+        CHECK(fs.readFile(own) == expect);
+    }
+    CHECK(isVersion(fs.readFile("swap")));
+    string log = fs.readFile("shared");
+    CHECK(isLog(log) && log.size() == (size_t)WORKERS * ROUNDS * RECORD);
+    for (int id = 0; id < WORKERS; id++)
+        CHECK(count(log.begin(), log.end(), (char)('A' + id)) == ROUNDS * RECORD);
+}
+
+static void testConcurrent() {
+    Image img("async_concurrent", 512, 2048, 0);
+    CHECK(img.fs->createFile("shared", 0));
+    CHECK(img.fs->createFile("swap", SWAP_SIZE) && img.fs->writeFile("swap", pattern(SWAP_SIZE, 100)));
+    {
+        AsyncFileSystem afs(*img.fs, 4);
+        vector<int> bad(WORKERS, 0);
+        vector<thread> threads;
+        for (int id = 0; id < WORKERS; id++)
+            threads.emplace_back([&afs, &bad, id] { bad[id] = syncWait(worker(afs, id)); });
+        for (auto& t : threads) t.join();
+        for (int id = 0; id < WORKERS; id++) CHECK(bad[id] == 0);
+        CHECK(afs.flush());
+    }
+    checkConcurrent(*img.fs);
+    CHECK(img.remount());
+    checkConcurrent(*img.fs);
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testPersistence();
+    testCloneCow();
+    testNoSpace();
+    testConcurrent();
+    return finish();
+}
@@ -0,0 +1,58 @@
+// Batches: blocks a delete or rmdir releases inside a batch stay allocated
+// until the batch's tree is written, so a crash before commitBatch leaves a
+// tree whose blocks still hold its files.
+//
+// Usage: batch_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+using namespace std;
+
+static void testDeferredFree() {
+    Image img("batch_free", 512, 64, 0);
+    FileSystem& fs = *img.fs;
+    string body = pattern(512 * 4, 1);
+    CHECK(fs.createFile("a", body.size()) && fs.writeFile("a", body));
+    CHECK(fs.mkdir("d") && fs.cd("d"));
+    CHECK(fs.createFile("inner", body.size()) && fs.writeFile("inner", body));
+    CHECK(fs.cd(".."));
+    int free0 = img.freeBlocks();
+
+    fs.beginBatch();
+    CHECK(fs.deleteFile("a"));
+    CHECK(fs.removeDirectory("d"));
+    CHECK(img.freeBlocks() == free0);  // Still named by the saved tree
+    CHECK(fs.commitBatch());
+    CHECK(img.freeBlocks() == free0 + 10);
+    CHECK(img.remount());
+    CHECK(!img.fs->root->hasFile("a") && !img.fs->root->findSubdir("d"));
+}
+
+static void testCrashInBatch() {
+    Image img("batch_crash", 512, 64, 0);
+    string body = pattern(512 * 4, 2);
+    CHECK(img.fs->createFile("a", body.size()) && img.fs->writeFile("a", body));
+    // Leave two blocks free, so new data could only fit in a's blocks
+    long long fill = 512LL * (img.freeBlocks() - 3);
+    CHECK(img.fs->createFile("fill", fill) && img.fs->writeFile("fill", pattern(fill, 3)));
+    CHECK(img.fs->save());
+    vector<int> blocks = img.fs->root->getFile("a").blocks;
+
+    img.fs->beginBatch();
+    CHECK(img.fs->deleteFile("a"));
+    CHECK(img.fs->createFile("b", body.size()));
+    CHECK(!img.fs->writeFile("b", pattern(body.size(), 4)));
+    for (int blk : img.fs->root->getFile("b").blocks)
+        for (int old : blocks) CHECK(blk != old);
+
+    img.crash();
+    CHECK(img.fs->root->hasFile("a") && !img.fs->root->hasFile("b"));
+    CHECK(img.fs->readFile("a") == body);
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testDeferredFree();
+    testCrashInBatch();
+    return finish();
+}
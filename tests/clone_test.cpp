@@ -0,0 +1,41 @@
+// Clones: a clone shares every block of its source, and a write or append
+// to either copies only the blocks it touches.
+//
+// Usage: clone_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+using namespace std;
+
+static void testCloneCow() {
+    Image img("clone", 512, 256, 0);
+    FileSystem& fs = *img.fs;
+    string body = pattern(1000, 5);  // Ends in a partial block, shared by the clone
+    CHECK(fs.createFile("a", 1000) && fs.writeFile("a", body));
+    int free0 = img.freeBlocks();
+    CHECK(fs.cloneFile("a", "b"));
+    CHECK(img.freeBlocks() == free0 - 1);  // Only b's index block
+    CHECK(fs.root->getFile("a").blocks == fs.root->getFile("b").blocks);
+
+    CHECK(fs.appendFile("b", "xyz") && fs.fsync("b"));
+    CHECK(fs.readFile("a") == body);
+    CHECK(fs.readFile("b") == body + "xyz");
+    CHECK(fs.root->getFile("a").blocks[1] != fs.root->getFile("b").blocks[1]);
+    CHECK(fs.root->getFile("a").blocks[0] == fs.root->getFile("b").blocks[0]);
+
+    string other = pattern(512, 6);
+    CHECK(fs.writeFile("a", other));
+    CHECK(img.remount());
+    CHECK(img.fs->readFile("a") == other);
+    CHECK(img.fs->readFile("b") == body + "xyz");
+
+    // Deleting both gives back every block the pair held
+    CHECK(img.fs->deleteFile("a") && img.fs->deleteFile("b"));
+    CHECK(img.freeBlocks() == free0 + 3);
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testCloneCow();
+    return finish();
+}
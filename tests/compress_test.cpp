@@ -0,0 +1,30 @@
+// Compression: a compressed file reads back exactly, takes fewer blocks
+// than its size, and survives a remount.
+//
+// Usage: compress_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+using namespace std;
+
+static void testCompressed() {
+    Image img("compress", 512, 256, 0);
+    FileSystem& fs = *img.fs;
+    string packed(8192, 'z');
+    CHECK(fs.createFile("packed", 8192) && fs.compress("packed", true));
+    int free0 = img.freeBlocks();
+    CHECK(fs.writeFile("packed", packed));
+    CHECK(free0 - img.freeBlocks() < 16);
+    CHECK(fs.readFile("packed") == packed);
+
+    CHECK(img.remount());
+    CHECK(img.fs->readFile("packed") == packed);
+    CHECK(img.fs->resizeFile("packed", 1000));
+    CHECK(img.fs->readFile("packed") == packed.substr(0, 1000));
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testCompressed();
+    return finish();
+}
@@ -0,0 +1,58 @@
+// Defrag: fragmented files end up in one extent with the same contents,
+// and with dedup on, the moved blocks can still be shared.
+//
+// Usage: defrag_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+using namespace std;
+
+// Appends one block to each file in turn, so their blocks interleave
+static void fragment(FileSystem& fs, int files, int blocks, string* contents) {
+    for (int i = 0; i < files; i++) CHECK(fs.createFile("f" + to_string(i), 1));
+    for (int b = 0; b < blocks; b++) {
+        for (int i = 0; i < files; i++) {
+            string name = "f" + to_string(i), block = pattern(512, i * 100 + b);
+            block[0] = (char)i;  // Distinct from every other file's blocks
+            block[1] = (char)b;
+            if (b == 0) CHECK(fs.writeFile(name, block));
+            else CHECK(fs.appendFile(name, block) && fs.fsync(name));
+            contents[i] += block;
+        }
+    }
+}
+
+static bool oneExtent(const FileMeta& fm) {
+    for (size_t i = 1; i < fm.blocks.size(); i++) if (fm.blocks[i] != fm.blocks[0] + (int)i) return false;
+    return true;
+}
+
+static void testDefragDedup() {
+    Image img("defrag", 512, 512, 0, true);
+    FileSystem& fs = *img.fs;
+    string contents[4];
+    fragment(fs, 4, 8, contents);
+    CHECK(!oneExtent(fs.root->getFile("f0")));
+    CHECK(fs.defrag(0));
+    for (int i = 0; i < 4; i++) {
+        CHECK(oneExtent(fs.root->getFile("f" + to_string(i))));
+        CHECK(fs.readFile("f" + to_string(i)) == contents[i]);
+    }
+
+    // A copy of a moved file shares all its blocks: only the index is new
+    int free0 = img.freeBlocks();
+    long long shared0 = img.bm->dedup()->stats().sharedWrites;
+    CHECK(fs.createFile("copy", (long long)contents[2].size()) && fs.writeFile("copy", contents[2]));
+    CHECK(img.bm->dedup()->stats().sharedWrites - shared0 == 8);
+    CHECK(img.freeBlocks() == free0 - 1);
+
+    CHECK(img.remount());
+    for (int i = 0; i < 4; i++) CHECK(img.fs->readFile("f" + to_string(i)) == contents[i]);
+    CHECK(img.fs->readFile("copy") == contents[2]);
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testDefragDedup();
+    return finish();
+}
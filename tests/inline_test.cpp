@@ -0,0 +1,35 @@
+// Inline files: small contents live in the directory entry, move out to
+// blocks once they outgrow it, and both survive a remount.
+//
+// Usage: inline_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+using namespace std;
+
+static void testInline() {
+    Image img("inline", 512, 256, 64);
+    FileSystem& fs = *img.fs;
+    int free0 = img.freeBlocks();
+    CHECK(fs.createFile("small", 5) && fs.writeFile("small", "tiny!"));
+    CHECK(fs.root->getFile("small").isInline());
+    CHECK(fs.createFile("grown", 5) && fs.writeFile("grown", "short"));
+    string big = pattern(3000, 1);
+    CHECK(fs.createFile("big", 1) && fs.writeFile("big", big));  // Promoted on write
+    CHECK(!fs.root->getFile("big").isInline());
+    CHECK(fs.appendFile("grown", pattern(100, 2)) && fs.fsync("grown"));
+    CHECK(!fs.root->getFile("grown").isInline());
+
+    CHECK(img.remount());
+    CHECK(img.fs->readFile("small") == "tiny!");
+    CHECK(img.fs->readFile("big") == big);
+    CHECK(img.fs->readFile("grown") == string("short") + pattern(100, 2));
+    CHECK(img.fs->deleteFile("big") && img.fs->deleteFile("grown"));
+    CHECK(img.freeBlocks() == free0 - 1);  // The tree's block
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testInline();
+    return finish();
+}
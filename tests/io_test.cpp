@@ -0,0 +1,38 @@
+// Block I/O: reads issued in parallel come back in order, and a block the
+// image cannot supply fails the read instead of reading as zeros.
+//
+// Usage: io_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+#include <unistd.h>
+using namespace std;
+
+static void testParallelRead() {
+    Image img("io_parallel", 512, 512, 0);
+    FileSystem& fs = *img.fs;
+    string data = pattern(512 * 100 + 17, 1);
+    CHECK(fs.createFile("f", (long long)data.size()) && fs.writeFile("f", data));
+    CHECK(fs.readFile("f") == data);
+    CHECK(img.remount());
+    CHECK(img.fs->readFile("f") == data);
+}
+
+static void testReadError() {
+    Image img("io_error", 512, 512, 0);
+    FileSystem& fs = *img.fs;
+    string data = pattern(512 * 8, 2);
+    CHECK(fs.createFile("f", (long long)data.size()) && fs.writeFile("f", data));
+    // Cut the image short under the mounted file system
+    int last = fs.root->getFile("f").blocks.back();
+    CHECK(truncate(img.disk.c_str(), (off_t)last * 512) == 0);
+    CHECK(fs.readFile("f").empty());
+    CHECK(lastStatus() == FS_IO_ERROR);
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testParallelRead();
+    testReadError();
+    return finish();
+}
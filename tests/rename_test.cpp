@@ -0,0 +1,40 @@
+// Rename: files and whole directories move between directories without
+// copying any data, and the new names survive a remount.
+//
+// Usage: rename_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+using namespace std;
+
+static void testRename() {
+    Image img("rename", 512, 256, 0);
+    FileSystem& fs = *img.fs;
+    string big = pattern(3000, 1);
+    CHECK(fs.createFile("big", 3000) && fs.writeFile("big", big));
+    CHECK(fs.mkdir("docs") && fs.cd("docs"));
+    CHECK(fs.createFile("inner", 3) && fs.writeFile("inner", "abc"));
+    CHECK(fs.cd(".."));
+    CHECK(fs.mkdir("archive"));
+    vector<int> blocks = fs.root->getFile("big").blocks;
+    int free0 = img.freeBlocks();
+
+    CHECK(fs.rename("big", "docs/big2"));
+    CHECK(fs.rename("docs", "archive/docs"));
+    CHECK(!fs.rename("archive", "archive/docs/loop"));
+    CHECK(img.freeBlocks() == free0);
+
+    CHECK(img.remount());
+    FileSystem& again = *img.fs;
+    CHECK(!again.root->hasFile("big") && !again.root->findSubdir("docs"));
+    CHECK(again.cd("archive") && again.cd("docs"));
+    CHECK(again.readFile("inner") == "abc");
+    CHECK(again.readFile("big2") == big);
+    CHECK(again.currentDir->getFile("big2").blocks == blocks);
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testRename();
+    return finish();
+}
@@ -0,0 +1,43 @@
+// Sparse files: growing a file adds holes that read as zeros and take no
+// blocks, and a write larger than the free space stores a prefix and fails.
+//
+// Usage: sparse_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+using namespace std;
+
+static void testHoles() {
+    Image img("sparse_holes", 512, 256, 0);
+    FileSystem& fs = *img.fs;
+    CHECK(fs.createFile("sparse", 1) && fs.writeFile("sparse", "x"));
+    int free0 = img.freeBlocks();
+    CHECK(fs.resizeFile("sparse", 5000));
+    CHECK(img.freeBlocks() == free0);
+    CHECK(fs.readFile("sparse") == string("x") + string(4999, '\0'));
+
+    CHECK(img.remount());
+    CHECK(img.fs->readFile("sparse") == string("x") + string(4999, '\0'));
+    CHECK(img.freeBlocks() == free0);
+}
+
+static void testShortWrite() {
+    Image img("sparse_short", 512, 64, 0);
+    FileSystem& fs = *img.fs;
+    CHECK(fs.createFile("big", 512 * 100));
+    int free0 = img.freeBlocks();
+    string data = pattern(512 * 100, 7);
+    CHECK(!fs.writeFile("big", data));
+    CHECK(lastStatus() == FS_NO_SPACE);
+    string kept = fs.readFile("big");
+    CHECK(!kept.empty() && kept.size() < data.size() && kept == data.substr(0, kept.size()));
+    CHECK(fs.deleteFile("big"));
+    CHECK(img.freeBlocks() == free0 + 1);  // Its index block too
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testHoles();
+    testShortWrite();
+    return finish();
+}
@@ -0,0 +1,88 @@
+// Shared by the test programs: a CHECK macro that counts failures, and a
+// disk image in the working directory that can be remounted
+#ifndef TESTUTIL_HPP
+#define TESTUTIL_HPP
+
+#include "../filesystem/blockmanager.hpp"
+#include "../filesystem/FileSystem.hpp"
+#include "../filesystem/log.hpp"
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                     \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n";  \
+            failures++;                                                                 \
+        }                                                                               \
+    } while (0)
+
+// An image that can be unmounted and mounted again
+struct Image {
+    std::string disk, meta;
+    int blockSize, blocks, inlineLimit;
+    bool dedup;
+    std::unique_ptr<BlockManager> bm;
+    std::unique_ptr<FileSystem> fs;
+
+    Image(const std::string& name, int blockSize_, int blocks_, int inlineLimit_, bool dedup_ = false)
+        : disk(name + "_disk.bin"), meta(name + "_meta.bin"),
+          blockSize(blockSize_), blocks(blocks_), inlineLimit(inlineLimit_), dedup(dedup_) {
+        remove(disk.c_str());
+        remove(meta.c_str());
+        remove((meta + ".ddt").c_str());
+        mount();
+    }
+    ~Image() {
+        fs.reset();
+        bm.reset();
+        remove(disk.c_str());
+        remove(meta.c_str());
+        remove((meta + ".ddt").c_str());
+    }
+    void mount() {
+        bm.reset(new BlockManager(disk, meta, blockSize, blocks));
+        bm->setInlineLimit(inlineLimit);
+        bm->setDedup(dedup);
+        bm->init();
+        fs.reset(new FileSystem(bm.get()));
+        fs->load();
+    }
+    // What a clean exit does, then a fresh mount of the same files
+    bool remount() {
+        bool saved = fs->save();
+        fs.reset();
+        bm.reset();
+        mount();
+        return saved;
+    }
+    // Drops the mount without the save a clean exit does, then mounts again
+    void crash() {
+        fs.reset();
+        bm.reset();
+        mount();
+    }
+    int freeBlocks() { return bm->getFreeBlockCount(); }
+};
+
+static inline std::string pattern(size_t n, int seed) {
+    std::string s(n, 0);
+    for (size_t i = 0; i < n; i++) s[i] = (char)('a' + (i * 7 + seed) % 26);
+    return s;
+}
+
+// Reports the result; the return value is the exit code
+static inline int finish() {
+    if (failures) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}
+
+#endif
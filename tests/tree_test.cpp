@@ -0,0 +1,62 @@
+// Directory tree storage: a tree far larger than one block is kept as a
+// block chain and survives remounts, and a mutation that cannot finish
+// leaves the tree as it was.
+//
+// Usage: tree_test
+// Images are created in the working directory. Prints one line per failed
+// check and exits non-zero if there was any.
+#include "testutil.hpp"
+using namespace std;
+
+static void testLargeTree() {
+    Image img("tree_large", 512, 1024, 64);
+    FileSystem& fs = *img.fs;
+    const int files = 3000;
+    fs.beginBatch();
+    CHECK(fs.mkdir("sub"));
+    for (int i = 0; i < files; i++) {
+        string name = "file_with_a_longer_name_" + to_string(i);
+        CHECK(fs.createFile(name, 1));
+        CHECK(fs.writeFile(name, to_string(i)));
+    }
+    CHECK(fs.commitBatch());
+    CHECK(img.bm->getTreeBlocks().size() > 100);
+
+    CHECK(img.remount());
+    FileSystem& again = *img.fs;
+    CHECK((int)again.root->files.size() == files);
+    CHECK(again.root->findSubdir("sub") != nullptr);
+    CHECK(again.readFile("file_with_a_longer_name_0") == "0");
+    CHECK(again.readFile("file_with_a_longer_name_2999") == "2999");
+    CHECK(again.deleteFile("file_with_a_longer_name_1500"));
+    CHECK(img.remount());
+    CHECK((int)img.fs->root->files.size() == files - 1);
+}
+
+static void testFailedShrink() {
+    // Shrinking into a shared tail block copies it, which needs a free block
+    Image img("tree_shrink", 512, 32, 0);
+    FileSystem& fs = *img.fs;
+    string body = pattern(1000, 3);
+    CHECK(fs.createFile("a", 1000) && fs.writeFile("a", body));
+    CHECK(fs.cloneFile("a", "b"));
+    long long fill = 512LL * (img.freeBlocks() - 1);
+    CHECK(fs.createFile("fill", fill) && fs.writeFile("fill", pattern(fill, 4)));
+    CHECK(img.freeBlocks() == 0);
+
+    CHECK(!fs.resizeFile("b", 700));
+    CHECK(lastStatus() == FS_NO_SPACE);
+    CHECK(fs.readFile("b") == body);
+    CHECK(img.freeBlocks() == 0);
+    CHECK(fs.deleteFile("fill") && fs.resizeFile("b", 700));
+    CHECK(fs.readFile("b") == body.substr(0, 700) && fs.readFile("a") == body);
+    CHECK(img.remount());
+    CHECK(img.fs->readFile("b") == body.substr(0, 700));
+}
+
+int main() {
+    Log::setLevel(LOG_OFF);
+    testLargeTree();
+    testFailedShrink();
+    return finish();
+}